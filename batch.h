@@ -0,0 +1,354 @@
+/** Batched replications. BatchSimulator runs up to BATCH_MAX_LANES replications of one grid point side by side,
+    one lane per replication, with the state of all lanes in struct of arrays form: the departure time, queue
+    length and busy flag of teller t are stored for every lane next to each other (index t * lanes + lane), and
+    the customers waiting at a teller are plain (arrival time, service time) pairs in a ring buffer.
+
+    The model it runs needs no event list. A lane has at most one arrival pending, one departure per busy
+    teller and its end, so its next event is the earliest of those. The batch advances in lockstep: one pass over
+    the tellers finds the earliest departure of every lane at once (the inner loop runs across the lanes and is
+    vectorized by the compiler), then every lane handles its next event. There is no heap, no deque and no
+    virtual call on the way.
+
+    Every lane draws from the same streams as a Simulator on its substream, handles its events in the same order
+    and updates its statistics the same way, so a lane gives exactly what ReplicationRunner::runOne() gives for
+    the same job. batchable() tells which jobs it can run: heap event list, shortest queue routing with or
+    without jockeying, no balking or reneging, no arrival profile, no trace, replay, steady state or snapshots,
+    and no more than BATCH_MAX_TELLERS tellers. ReplicationRunner::run() hands it runs of consecutive batchable
+    jobs of the same grid point.
+
+    Batching is off unless --batch asks for it. Only the earliest departure is found across the lanes; arrivals,
+    departures and jockeying run lane by lane over tellers strided by the lane count, without the TellerIndex
+    and the vector scans of Simulator, and the lockstep pass costs tellers * lanes per event. That pays only
+    for a few tellers: the batched section of benchmark.cpp measures 5 to 15 percent up to 8 tellers, none at
+    16 and a slowdown beyond, growing with the teller count. */
+
+#define BATCH_MAX_LANES          64
+#define BATCH_DEFAULT_LANES      0
+#define BATCH_MAX_TELLERS        8
+
+struct BatchEntry {
+    t_simtime arrival;
+    t_simtime service;               /** drawn on arrival under synchronized service, else INVALID_TIME */
+};
+
+/** first in first out, with the tail taken by jockeying */
+class BatchQueue {
+
+        vector<BatchEntry> slots;        /** a power of two */
+        uint32_t head;
+        uint32_t count;
+
+    public:
+        BatchQueue() : slots(4) {
+            head = 0;
+            count = 0;
+        }
+
+        inline void clear()                     { head = 0; count = 0; }
+
+        inline void pushBack(const BatchEntry &entry) {
+            if(count == slots.size()) {
+                vector<BatchEntry> grown(2 * slots.size());
+                for(uint32_t i = 0; i < count; i++)
+                    grown[i] = slots[(head + i) & (slots.size() - 1)];
+                slots.swap(grown);
+                head = 0;
+            }
+            slots[(head + count++) & (slots.size() - 1)] = entry;
+        }
+
+        inline BatchEntry popFront() {
+            BatchEntry entry = slots[head];
+            head = (head + 1) & (slots.size() - 1);
+            count--;
+            return entry;
+        }
+
+        inline BatchEntry popBack() {
+            return slots[(head + --count) & (slots.size() - 1)];
+        }
+};
+
+
+class BatchSimulator {
+
+        int N;
+        int lanes;
+        t_simtime horizon;
+        bool jockeying;
+        QueuePolicy policy;
+        bool synchronizedService;
+
+        /** per teller and lane, index t * lanes + lane */
+        vector<t_simtime> departureTime;     /** HUGE_VAL while idle */
+        vector<int32_t> queueLength;
+        vector<int32_t> busy;
+        vector<t_simtime> delayInService;    /** delay of the customer being served */
+        vector<t_simtime> serviceStart;      /** and the time its service started */
+        vector<double> busyTime;             /** added on departures, as in the Simulator's TellerTotals */
+        vector<BatchQueue> queues;
+        vector<RandomStream> serviceStreams;
+
+        /** per lane */
+        vector<t_simtime> clock;
+        vector<t_simtime> nextArrival;       /** HUGE_VAL once arrivals have stopped */
+        vector<bool> exitPending;            /** the end time, an event like in the Simulator */
+        vector<t_simtime> earliest;          /** earliest departure, found for all lanes at once */
+        vector<int32_t> earliestTeller;
+        vector<int32_t> totalQueueLength;
+        vector<long long> events;
+        vector<long long> arrivals;
+        vector<long long> jockeys;
+        vector<RandomStream> arrivalStreams;
+        vector<RandomStream> customerServiceStreams;
+        vector<TimeAvgGenerator> queueLengthStats;
+        vector<AvgGenerator *> delayStats;
+
+        inline int at(int tellerId, int lane)   { return tellerId * lanes + lane; }
+
+        inline t_simtime serviceTime(const BatchEntry &entry, int tellerId, int lane) {
+            return entry.service != INVALID_TIME ? entry.service : serviceStreams[at(tellerId, lane)].next();
+        }
+
+        /** the head of the queue of tellerId goes into service */
+        inline void startService(int tellerId, int lane) {
+            int i = at(tellerId, lane);
+            BatchEntry entry = queues[i].popFront();
+            queueLength[i]--;
+            totalQueueLength[lane]--;
+            busy[i] = 1;
+            delayInService[i] = clock[lane] - entry.arrival;
+            serviceStart[i] = clock[lane];
+            departureTime[i] = clock[lane] + serviceTime(entry, tellerId, lane);
+        }
+
+        void findEarliestDepartures();
+        void arrive(int lane);
+        void depart(int lane, int tellerId);
+
+    public:
+        /** jobs[0 .. count) must all be batchable and of the same grid point, see sameBatch() */
+        BatchSimulator(const ReplicationJob *jobs, int count);
+        ~BatchSimulator();
+
+        void run();
+        ReplicationResult resultOf(int lane);
+
+        static bool batchable(const ReplicationJob &job);
+        static bool sameBatch(const ReplicationJob &a, const ReplicationJob &b);   /** may share a batch */
+};
+
+
+inline BatchSimulator::BatchSimulator(const ReplicationJob *jobs, int count) {
+    const ReplicationJob &job = jobs[0];
+    N = job.numTellers;
+    lanes = count;
+    horizon = job.horizon;
+    jockeying = job.jockeying;
+    policy = job.policy;
+    synchronizedService = job.synchronizedService;
+
+    departureTime.assign(N * lanes, HUGE_VAL);
+    queueLength.assign(N * lanes, 0);
+    busy.assign(N * lanes, 0);
+    delayInService.assign(N * lanes, 0);
+    serviceStart.assign(N * lanes, 0);
+    busyTime.assign(N * lanes, 0);
+    queues.resize(N * lanes);
+    for(int t = 0; t < N; t++)
+        for(int l = 0; l < lanes; l++)
+            serviceStreams.push_back(RandomStream(job.serviceTimeMean, job.masterSeed, jobs[l].substream, SERVICE_STREAM(t),
+                                                  jobs[l].antithetic, job.serviceDistribution));
+
+    clock.assign(lanes, 0.0);
+    nextArrival.assign(lanes, 0.0);      /** every run starts with an arrival at time 0 */
+    exitPending.assign(lanes, true);
+    earliest.assign(lanes, HUGE_VAL);
+    earliestTeller.assign(lanes, -1);
+    totalQueueLength.assign(lanes, 0);
+    events.assign(lanes, 0);
+    arrivals.assign(lanes, 0);
+    jockeys.assign(lanes, 0);
+    queueLengthStats.assign(lanes, TimeAvgGenerator());
+    for(int l = 0; l < lanes; l++) {
+        arrivalStreams.push_back(RandomStream(job.interArrivalTimeMean, job.masterSeed, jobs[l].substream, ARRIVAL_STREAM,
+                                              jobs[l].antithetic, job.arrivalDistribution));
+        customerServiceStreams.push_back(RandomStream(job.serviceTimeMean, job.masterSeed, jobs[l].substream, CUSTOMER_SERVICE_STREAM,
+                                                      jobs[l].antithetic, job.serviceDistribution));
+        delayStats.push_back(new AvgGenerator(job.delayQuantiles));
+    }
+}
+
+
+inline BatchSimulator::~BatchSimulator() {
+    for(size_t l = 0; l < delayStats.size(); l++)
+        delete delayStats[l];
+}
+
+
+/** one pass over the tellers for all lanes; the leftmost teller on equal times */
+inline void BatchSimulator::findEarliestDepartures() {
+    t_simtime *best = &earliest[0];
+    int32_t *which = &earliestTeller[0];
+    for(int l = 0; l < lanes; l++) {
+        best[l] = HUGE_VAL;
+        which[l] = -1;
+    }
+    for(int t = 0; t < N; t++) {
+        const t_simtime *times = &departureTime[t * lanes];
+        for(int l = 0; l < lanes; l++) {
+            bool sooner = times[l] < best[l];
+            best[l] = sooner ? times[l] : best[l];
+            which[l] = sooner ? t : which[l];
+        }
+    }
+}
+
+
+/** as Simulator::arrive with shortest queue routing: the next arrival is drawn first, then the customer goes
+    to the leftmost idle teller, else to the leftmost shortest queue */
+inline void BatchSimulator::arrive(int lane) {
+    t_simtime now = clock[lane];
+    BatchEntry entry = { now, synchronizedService ? customerServiceStreams[lane].next() : INVALID_TIME };
+    t_simtime next = now + arrivalStreams[lane].next();
+    nextArrival[lane] = next <= horizon ? next : HUGE_VAL;
+    arrivals[lane]++;
+
+    int tellerId = -1;
+    for(int t = 0; t < N && tellerId == -1; t++)
+        if(queueLength[at(t, lane)] + busy[at(t, lane)] == 0)
+            tellerId = t;
+    if(tellerId == -1) {
+        tellerId = 0;
+        for(int t = 1; t < N; t++)
+            if(queueLength[at(t, lane)] < queueLength[at(tellerId, lane)])
+                tellerId = t;
+    }
+
+    int i = at(tellerId, lane);
+    queues[i].pushBack(entry);
+    queueLength[i]++;
+    totalQueueLength[lane]++;
+    if(!busy[i])
+        startService(tellerId, lane);
+    queueLengthStats[lane].pushData(totalQueueLength[lane], now);
+}
+
+
+/** as Simulator::depart with shortest queue routing and nearest jockeying */
+inline void BatchSimulator::depart(int lane, int tellerId) {
+    t_simtime now = clock[lane];
+    int i = at(tellerId, lane);
+    busy[i] = 0;
+    departureTime[i] = HUGE_VAL;
+    delayStats[lane]->pushData(delayInService[i]);
+    busyTime[i] += now - serviceStart[i];
+
+    bool changed = false;
+    if(queueLength[i] > 0) {
+        startService(tellerId, lane);
+        changed = true;
+    }
+
+    if(jockeying) {
+        int32_t threshold = queueLength[i] + busy[i] + policy.jockeyThreshold - 1;
+        int from = -1;
+        int minDistance = N * N;
+        for(int t = 0; t < N; t++) {
+            int distance = t > tellerId ? t - tellerId : tellerId - t;
+            if(t != tellerId && distance < minDistance && queueLength[at(t, lane)] + busy[at(t, lane)] > threshold) {
+                from = t;
+                minDistance = distance;
+            }
+        }
+        if(from != -1 && (policy.jockeyDistance == 0 || minDistance <= policy.jockeyDistance)) {
+            int j = at(from, lane);
+            queues[i].pushBack(queues[j].popBack());
+            queueLength[j]--;
+            queueLength[i]++;
+            jockeys[lane]++;
+            if(!busy[i])
+                startService(tellerId, lane);
+            changed = true;
+        }
+    }
+
+    /** the Simulator records every change of a queue length; changes at the same time add nothing to the area */
+    if(changed)
+        queueLengthStats[lane].pushData(totalQueueLength[lane], now);
+}
+
+
+inline void BatchSimulator::run() {
+    int active = lanes;
+    while(active > 0) {
+        findEarliestDepartures();
+        active = 0;
+        for(int l = 0; l < lanes; l++) {
+            t_simtime arrival = nextArrival[l];
+            t_simtime departure = earliest[l];
+            t_simtime end = exitPending[l] ? horizon : HUGE_VAL;
+            if(arrival == HUGE_VAL && departure == HUGE_VAL && end == HUGE_VAL)
+                continue;
+            active++;
+            events[l]++;
+            if(arrival <= departure && arrival <= end) {
+                clock[l] = arrival;
+                arrive(l);
+            }
+            else if(departure <= end) {
+                clock[l] = departure;
+                depart(l, earliestTeller[l]);
+            }
+            else {
+                clock[l] = end;
+                exitPending[l] = false;
+            }
+        }
+    }
+}
+
+
+inline ReplicationResult BatchSimulator::resultOf(int lane) {
+    AvgGenerator *delays = delayStats[lane];
+    ReplicationResult r;
+    r.avgQueueLength = queueLengthStats[lane].timeAvg(clock[lane]);
+    r.utilization = 0;
+    for(int t = 0; clock[lane] > 0 && t < N; t++)
+        r.utilization += busyTime[at(t, lane)] / clock[lane];
+    r.utilization /= N;
+    r.avgDelay = delays->avg();
+    r.confidenceRange = delays->getConfidenceIntervalRange();
+    r.delayP50 = delays->quantile(0.50);
+    r.delayP95 = delays->quantile(0.95);
+    r.delayP99 = delays->quantile(0.99);
+    r.events = events[lane];
+    r.arrivals = arrivals[lane];
+    r.balked = 0;
+    r.reneged = 0;
+    r.lost = 0;
+    r.served = delays->getSampleCount();
+    r.transferred = 0;
+    r.jockeys = jockeys[lane];
+    r.warmupTime = 0;
+    r.batches = 0;
+    r.tailProbability = 0;
+    return r;
+}
+
+
+inline bool BatchSimulator::batchable(const ReplicationJob &job) {
+    return job.numTellers <= BATCH_MAX_TELLERS && job.eventList == HEAP_EVENT_LIST && job.policy.routing == SHORTEST_QUEUE_ROUTING && job.policy.balkAt == 0 && job.policy.queueCapacity == 0 &&
+           job.policy.patienceMean == 0 && !job.arrivalProfile && job.traceFile.empty() && job.replayFile.empty() &&
+           !job.steadyState && job.checkpointFile.empty() && !job.startFrom && !job.splitting;
+}
+
+
+inline bool BatchSimulator::sameBatch(const ReplicationJob &a, const ReplicationJob &b) {
+    return a.numTellers == b.numTellers && a.interArrivalTimeMean == b.interArrivalTimeMean &&
+           a.serviceTimeMean == b.serviceTimeMean && a.horizon == b.horizon && a.jockeying == b.jockeying &&
+           a.policy.jockeyThreshold == b.policy.jockeyThreshold && a.policy.jockeyDistance == b.policy.jockeyDistance &&
+           a.serviceDistribution == b.serviceDistribution && a.arrivalDistribution == b.arrivalDistribution &&
+           a.masterSeed == b.masterSeed && a.delayQuantiles == b.delayQuantiles &&
+           a.synchronizedService == b.synchronizedService;
+}
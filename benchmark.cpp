@@ -0,0 +1,346 @@
+/** Scalability benchmark for the simulator core. Drives Simulator::run() over a grid of teller counts, traffic
+    intensities and horizons and writes one JSON document with events/s, ns/event, peak RSS and allocations per
+    event for every grid point, so that the event loop, the teller selection and jockeying can be tracked over time.
+
+    build:  g++ -std=c++11 -O2 -pthread -o benchmark benchmark.cpp
+    run:    ./benchmark [--tellers 4,64,1024] [--utilization 0.5,0.9] [--horizon 480,1e5]
+                        [--routing shortest,jiq,power_of_d,shared] [--choices 2]
+                        [--event-list heap|pointer] [--max-events 2e7] [--lanes 16] [--seed S] [--out file.json]
+
+    The traffic intensity is given as the utilization rho of each teller; the inter-arrival mean of a grid point
+    is SERVICE_TIME_MEAN / (rho * tellers), and both means are reported. Grid points whose expected number of
+    events (about two per customer) exceeds --max-events are listed as skipped instead of being run. Every
+    routing policy of --routing (see kernels.h) runs the same grid on the same substreams, so their throughput and
+    delays compare directly.
+
+    The "batched" section runs --lanes replications of every grid point of up to 4 * BATCH_MAX_TELLERS tellers
+    (shortest queue routing, jockeying) one by one on a reused Simulator and side by side in one BatchSimulator,
+    with the time of both, the speedup and the number of lanes whose mean delay differs from the single run;
+    "batchable" tells whether ReplicationRunner would batch the point at all (see batch.h).
+
+    The "scan_kernels" section cross-checks the vectorized teller scans of simdscan.h against the scalar ones on
+    random teller states and reports any choice that differs, with the time per scan of each version. */
+
+#define SIMULATOR_NO_MAIN
+#include "simulator.cpp"
+
+#include <sys/resource.h>
+
+
+/** every allocation of the process is counted, so allocations per event come straight out of the run.
+    (gcc takes the malloc/free pairing below for a mismatch, hence the pragma) */
+
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+static atomic<long long> allocationCount(0);
+
+void *operator new(size_t size) {
+    allocationCount.fetch_add(1, memory_order_relaxed);
+    void *p = malloc(size ? size : 1);
+    if(!p)
+        throw bad_alloc();
+    return p;
+}
+
+void *operator new[](size_t size)               { return operator new(size); }
+void operator delete(void *p) noexcept          { free(p); }
+void operator delete[](void *p) noexcept        { free(p); }
+void operator delete(void *p, size_t) noexcept  { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+
+
+/** peak resident set size in kB. on Linux the high water mark is reset before every grid point, so the figure
+    belongs to that point alone; elsewhere it is the peak of the whole process so far */
+static bool resetPeakRss() {
+    ofstream clearRefs("/proc/self/clear_refs");
+    if(!clearRefs)
+        return false;
+    clearRefs << "5";
+    return (bool) clearRefs;
+}
+
+static long peakRssKb() {
+    ifstream status("/proc/self/status");
+    string line;
+    while(getline(status, line))
+        if(line.compare(0, 6, "VmHWM:") == 0)
+            return atol(line.c_str() + 6);
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+
+/** the job of grid point and replication, on substream `substream` */
+static ReplicationJob benchmarkJob(const QueuePolicy &policy, int tellers, double utilization, double horizon,
+                                   uint64_t masterSeed, uint32_t substream, EventListKind eventList) {
+    ReplicationJob job;
+    job.scenario = 0;
+    job.jockeying = true;
+    job.policy = policy;
+    job.serviceDistribution = NULL;
+    job.arrivalDistribution = NULL;
+    job.arrivalProfile = NULL;
+    job.numTellers = tellers;
+    job.replication = 0;
+    job.serviceTimeMean = SERVICE_TIME_MEAN;
+    job.interArrivalTimeMean = SERVICE_TIME_MEAN / (utilization * tellers);
+    job.horizon = horizon;
+    job.masterSeed = masterSeed;
+    job.substream = substream;
+    job.eventList = eventList;
+    job.delayQuantiles = false;
+    job.antithetic = false;
+    job.synchronizedService = false;
+    job.steadyState = false;
+    job.checkpointEvery = 0;
+    job.startFrom = NULL;
+    job.freshStatistics = false;
+    job.splitting = NULL;
+    job.fingerprint = 0;
+    return job;
+}
+
+
+static vector<double> parseList(const char *text) {
+    vector<double> values;
+    string s(text);
+    size_t start = 0;
+    while(start <= s.size()) {
+        size_t comma = s.find(',', start);
+        if(comma == string::npos)
+            comma = s.size();
+        if(comma > start)
+            values.push_back(atof(s.substr(start, comma - start).c_str()));
+        start = comma + 1;
+    }
+    return values;
+}
+
+
+/** runs every scan of one kernel set on the same random teller states as the scalar set. returns the number of
+    answers that differ from the scalar ones and the average time per scan */
+static long long crossCheckScans(const ScanKernels &kernels, double &nsPerScan) {
+
+    StreamEngine engine(DEFAULT_MASTER_SEED, 0, 0);
+    vector<int32_t> a(1024);
+    long long mismatches = 0, scans = 0;
+    double seconds = 0;
+    volatile int sink = 0;
+
+    for(int trial = 0; trial < 20000; trial++) {
+        int n = 1 + engine.next32() % 1024;
+        int range = 1 + engine.next32() % 8;         /** small values, so that ties are frequent */
+        for(int i = 0; i < n; i++)
+            a[i] = engine.next32() % range;
+        int teller = engine.next32() % n;
+        int32_t value = engine.next32() % range;
+        int32_t threshold = a[teller] + 1;
+
+        mismatches += kernels.firstEqual(&a[0], n, value) != firstEqualScalar(&a[0], n, value);
+        mismatches += kernels.argMin(&a[0], n) != argMinScalar(&a[0], n);
+        mismatches += kernels.firstAbove(&a[0], teller + 1, n, threshold) != firstAboveScalar(&a[0], teller + 1, n, threshold);
+        mismatches += kernels.lastAbove(&a[0], teller - 1, threshold) != lastAboveScalar(&a[0], teller - 1, threshold);
+
+        chrono::steady_clock::time_point started = chrono::steady_clock::now();
+        for(int repeat = 0; repeat < 8; repeat++) {
+            sink += kernels.firstEqual(&a[0], n, value);
+            sink += kernels.argMin(&a[0], n);
+            sink += kernels.firstAbove(&a[0], teller + 1, n, threshold);
+            sink += kernels.lastAbove(&a[0], teller - 1, threshold);
+        }
+        seconds += chrono::duration<double>(chrono::steady_clock::now() - started).count();
+        scans += 32;
+    }
+
+    nsPerScan = seconds * 1e9 / scans;
+    return mismatches;
+
+}
+
+
+int main(int argc, char **argv) {
+
+    vector<double> tellers = parseList("4,16,64,256,1024,10000");
+    vector<double> utilizations = parseList("0.5,0.9,0.99");
+    vector<double> horizons = parseList("480,1e4,1e5,1e7");
+    vector<RoutingKind> routings(1, SHORTEST_QUEUE_ROUTING);
+    QueuePolicy policy = defaultQueuePolicy();
+    EventListKind eventList = HEAP_EVENT_LIST;
+    double maxEvents = 2e7;
+    int lanes = 16;
+    uint64_t masterSeed = DEFAULT_MASTER_SEED;
+    string outFile;
+
+    for(int i = 1; i + 1 < argc; i += 2) {
+        string option(argv[i]);
+        if(option == "--tellers")            tellers = parseList(argv[i + 1]);
+        else if(option == "--utilization")   utilizations = parseList(argv[i + 1]);
+        else if(option == "--horizon")       horizons = parseList(argv[i + 1]);
+        else if(option == "--routing") {
+            routings.clear();
+            stringstream names(argv[i + 1]);
+            string name;
+            while(getline(names, name, ',')) {
+                int kind = SHORTEST_QUEUE_ROUTING;
+                while(kind <= SHARED_QUEUE_ROUTING && name != routingName((RoutingKind) kind))
+                    kind++;
+                if(kind > SHARED_QUEUE_ROUTING) {
+                    cerr << "unknown routing " << name << endl;
+                    return 1;
+                }
+                routings.push_back((RoutingKind) kind);
+            }
+        }
+        else if(option == "--choices")       policy.choices = max(1, atoi(argv[i + 1]));
+        else if(option == "--event-list")    eventList = string(argv[i + 1]) == "pointer" ? POINTER_EVENT_LIST : HEAP_EVENT_LIST;
+        else if(option == "--max-events")    maxEvents = atof(argv[i + 1]);
+        else if(option == "--lanes")         lanes = max(2, min(atoi(argv[i + 1]), BATCH_MAX_LANES));
+        else if(option == "--seed")          masterSeed = strtoull(argv[i + 1], NULL, 10);
+        else if(option == "--out")           outFile = argv[i + 1];
+        else {
+            cerr << "unknown option " << option << endl;
+            return 1;
+        }
+    }
+
+    ofstream file;
+    if(!outFile.empty())
+        file.open(outFile.c_str());
+    ostream &out = outFile.empty() ? cout : file;
+    out << setprecision(10);
+
+    bool perPointRss = resetPeakRss();
+
+    out << "{\n  \"benchmark\": \"simulator\",\n"
+        << "  \"event_list\": \"" << (eventList == HEAP_EVENT_LIST ? "heap" : "pointer") << "\",\n"
+        << "  \"seed\": " << masterSeed << ",\n"
+        << "  \"peak_rss_scope\": \"" << (perPointRss ? "point" : "process") << "\",\n"
+        << "  \"points\": [";
+
+    bool first = true;
+    for(size_t p = 0; p < routings.size(); p++) {
+        uint32_t substream = 0;
+        for(size_t t = 0; t < tellers.size(); t++) {
+            for(size_t u = 0; u < utilizations.size(); u++) {
+                for(size_t h = 0; h < horizons.size(); h++) {
+
+                    QueuePolicy pointPolicy = policy;
+                    pointPolicy.routing = routings[p];
+                    ReplicationJob job = benchmarkJob(pointPolicy, (int) tellers[t], utilizations[u], horizons[h], masterSeed,
+                                                      substream++, eventList);
+
+                    out << (first ? "\n" : ",\n") << "    {\"routing\": \"" << routingName(routings[p])
+                        << "\", \"tellers\": " << job.numTellers
+                        << ", \"utilization\": " << utilizations[u]
+                        << ", \"inter_arrival_mean\": " << job.interArrivalTimeMean
+                        << ", \"service_mean\": " << job.serviceTimeMean
+                        << ", \"inter_arrival_to_service_ratio\": " << job.interArrivalTimeMean / job.serviceTimeMean
+                        << ", \"horizon\": " << job.horizon;
+                    first = false;
+
+                    double expectedEvents = 2 * job.horizon / job.interArrivalTimeMean;
+                    if(expectedEvents > maxEvents) {
+                        out << ", \"skipped\": true, \"expected_events\": " << expectedEvents << "}";
+                        continue;
+                    }
+
+                    if(perPointRss)
+                        resetPeakRss();
+                    long long allocationsBefore = allocationCount.load();
+                    chrono::steady_clock::time_point started = chrono::steady_clock::now();
+                    ReplicationResult r = ReplicationRunner::runOne(job);
+                    double seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+                    long long allocations = allocationCount.load() - allocationsBefore;
+
+                    out << ", \"events\": " << r.events
+                        << ", \"seconds\": " << seconds
+                        << ", \"events_per_sec\": " << r.events / seconds
+                        << ", \"ns_per_event\": " << seconds * 1e9 / r.events
+                        << ", \"allocations\": " << allocations
+                        << ", \"allocations_per_event\": " << (double) allocations / r.events
+                        << ", \"peak_rss_kb\": " << peakRssKb()
+                        << ", \"avg_delay\": " << r.avgDelay
+                        << ", \"avg_queue_length\": " << r.avgQueueLength << "}";
+                    out.flush();
+                }
+            }
+        }
+    }
+
+    /** the lanes of a point run one by one and then batched, both single threaded on the same substreams */
+    out << "\n  ],\n  \"batched\": {\n    \"lanes\": " << lanes << ",\n    \"max_tellers\": " << BATCH_MAX_TELLERS
+        << ",\n    \"points\": [";
+    QueuePolicy batchPolicy = policy;
+    batchPolicy.routing = SHORTEST_QUEUE_ROUTING;
+    first = true;
+    long long batchMismatches = 0;
+    for(size_t t = 0; t < tellers.size(); t++) {
+        if(tellers[t] > 4 * BATCH_MAX_TELLERS)
+            continue;
+        for(size_t u = 0; u < utilizations.size(); u++) {
+            for(size_t h = 0; h < horizons.size(); h++) {
+                vector<ReplicationJob> jobs;
+                for(int lane = 0; lane < lanes; lane++)
+                    jobs.push_back(benchmarkJob(batchPolicy, (int) tellers[t], utilizations[u], horizons[h], masterSeed, lane,
+                                                HEAP_EVENT_LIST));
+                if(2 * jobs[0].horizon / jobs[0].interArrivalTimeMean * lanes > maxEvents)
+                    continue;
+
+                Simulator sim(jobs[0].numTellers, masterSeed, 0, HEAP_EVENT_LIST, jobs[0].interArrivalTimeMean, jobs[0].serviceTimeMean);
+                vector<ReplicationResult> single(lanes);
+                long long events = 0;
+                chrono::steady_clock::time_point started = chrono::steady_clock::now();
+                for(int lane = 0; lane < lanes; lane++) {
+                    single[lane] = ReplicationRunner::runOne(jobs[lane], sim);
+                    events += single[lane].events;
+                }
+                double singleSeconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+
+                started = chrono::steady_clock::now();
+                BatchSimulator batch(&jobs[0], lanes);
+                batch.run();
+                double batchSeconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+                long long mismatches = 0;
+                for(int lane = 0; lane < lanes; lane++)
+                    mismatches += batch.resultOf(lane).avgDelay != single[lane].avgDelay;
+                batchMismatches += mismatches;
+
+                out << (first ? "\n" : ",\n") << "      {\"tellers\": " << jobs[0].numTellers
+                    << ", \"utilization\": " << utilizations[u]
+                    << ", \"horizon\": " << jobs[0].horizon
+                    << ", \"batchable\": " << (BatchSimulator::batchable(jobs[0]) ? "true" : "false")
+                    << ", \"events\": " << events
+                    << ", \"single_seconds\": " << singleSeconds
+                    << ", \"batched_seconds\": " << batchSeconds
+                    << ", \"speedup\": " << singleSeconds / batchSeconds
+                    << ", \"mismatches\": " << mismatches << "}";
+                first = false;
+                out.flush();
+            }
+        }
+    }
+
+    out << "\n    ]\n  },\n  \"scan_kernels\": {\n    \"selected\": \"" << scanKernels().name << "\",\n    \"checks\": [";
+
+    vector<const ScanKernels *> kernelSets;
+    kernelSets.push_back(&SCALAR_SCAN_KERNELS);
+#ifdef SIMD_SCAN_X86
+    if(__builtin_cpu_supports("sse4.1"))
+        kernelSets.push_back(&SSE_SCAN_KERNELS);
+    if(__builtin_cpu_supports("avx2"))
+        kernelSets.push_back(&AVX2_SCAN_KERNELS);
+#endif
+    long long totalMismatches = 0;
+    for(size_t k = 0; k < kernelSets.size(); k++) {
+        double nsPerScan;
+        long long mismatches = crossCheckScans(*kernelSets[k], nsPerScan);
+        totalMismatches += mismatches;
+        out << (k ? ",\n" : "\n") << "      {\"kernels\": \"" << kernelSets[k]->name << "\", \"mismatches\": " << mismatches
+            << ", \"ns_per_scan\": " << nsPerScan << "}";
+    }
+    out << "\n    ]\n  }\n}\n";
+
+    return totalMismatches == 0 && batchMismatches == 0 ? 0 : 2;
+
+}
@@ -0,0 +1,171 @@
+/** Snapshots of the whole state of a simulator: clock, event list, queues, tellers, customers, random streams and
+    statistics (Simulator::saveState and restoreState). A long run can write one every so often and be resumed
+    from the last one after a crash, and what-if runs (more tellers, another jockey rule) can all start from one
+    warmed-up bank instead of simulating the warm-up again each.
+
+    The snapshot holds the state of the bank, not its configuration: policy, jockeying, distributions, trace,
+    replay, metrics and network come from whoever restores it. A snapshot restored into a simulator with the same
+    configuration continues exactly as the run it was taken from would have.
+
+    In memory a snapshot is a byte buffer; SimulatorSnapshot::save() writes it after a SnapshotHeader, in the byte
+    order of the machine, through a temporary file renamed into place, so a crash while writing leaves the
+    previous snapshot whole. */
+
+#define SNAPSHOT_MAGIC           "BANKSNP1"
+#define SNAPSHOT_VERSION         3
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t tellers;                /** of the saved bank */
+    uint64_t size;                   /** bytes of state after the header */
+};
+
+
+/** appends plain values to a byte buffer */
+class StateWriter {
+
+        vector<char> &bytes;
+
+    public:
+        StateWriter(vector<char> &bytes) : bytes(bytes) { }
+
+        template <class T> inline void putArray(const T *values, size_t n) {
+            const char *p = (const char *) values;
+            bytes.insert(bytes.end(), p, p + n * sizeof(T));
+        }
+
+        template <class T> inline void put(const T &value) {
+            putArray(&value, 1);
+        }
+
+        template <class T> void putVector(const vector<T> &values) {
+            put((uint64_t) values.size());
+            if(!values.empty())
+                putArray(&values[0], values.size());
+        }
+
+        template <class T> void putDeque(const deque<T> &values) {
+            put((uint64_t) values.size());
+            for(typename deque<T>::const_iterator i = values.begin(); i != values.end(); ++i)
+                put(*i);
+        }
+};
+
+
+/** reads the values back in the order they were written. a read past the end fails, and so does every read
+    after it */
+class StateReader {
+
+        const vector<char> &bytes;
+        size_t position;
+        bool failed;
+
+    public:
+        StateReader(const vector<char> &bytes) : bytes(bytes) {
+            position = 0;
+            failed = false;
+        }
+
+        template <class T> bool getArray(T *values, size_t n) {
+            if(failed || n > (bytes.size() - position) / sizeof(T)) {
+                failed = true;
+                return false;
+            }
+            if(n > 0)
+                memcpy(values, &bytes[position], n * sizeof(T));
+            position += n * sizeof(T);
+            return true;
+        }
+
+        template <class T> inline bool get(T &value) {
+            return getArray(&value, 1);
+        }
+
+        template <class T> bool getVector(vector<T> &values) {
+            uint64_t n;
+            if(!get(n) || n > (bytes.size() - position) / sizeof(T)) {
+                failed = true;
+                return false;
+            }
+            values.resize(n);
+            return n == 0 || getArray(&values[0], n);
+        }
+
+        template <class T> bool getDeque(deque<T> &values) {
+            uint64_t n;
+            if(!get(n) || n > (bytes.size() - position) / sizeof(T)) {
+                failed = true;
+                return false;
+            }
+            values.clear();
+            for(uint64_t i = 0; i < n; i++) {
+                T value;
+                get(value);
+                values.push_back(value);
+            }
+            return !failed;
+        }
+
+        inline bool ok()                        { return !failed; }
+        inline bool atEnd()                     { return position == bytes.size(); }
+};
+
+
+class SimulatorSnapshot {
+
+    public:
+        vector<char> bytes;              /** the state, as written by Simulator::saveState() */
+        uint32_t tellers;                /** of the saved bank */
+
+        SimulatorSnapshot() {
+            tellers = 0;
+        }
+
+        inline bool empty() const               { return bytes.empty(); }
+
+        bool save(const string &path, string &error) const {
+            string temporary = path + ".tmp";
+            FILE *file = fopen(temporary.c_str(), "wb");
+            if(!file) {
+                error = "cannot open snapshot file " + temporary;
+                return false;
+            }
+            SnapshotHeader header;
+            memcpy(header.magic, SNAPSHOT_MAGIC, 8);
+            header.version = SNAPSHOT_VERSION;
+            header.tellers = tellers;
+            header.size = bytes.size();
+            bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                      (bytes.empty() || fwrite(&bytes[0], 1, bytes.size(), file) == bytes.size());
+            ok = fclose(file) == 0 && ok;
+            if(!ok || rename(temporary.c_str(), path.c_str()) != 0) {
+                error = "cannot write snapshot file " + path;
+                remove(temporary.c_str());
+                return false;
+            }
+            return true;
+        }
+
+        bool load(const string &path, string &error) {
+            FILE *file = fopen(path.c_str(), "rb");
+            if(!file) {
+                error = "cannot open snapshot file " + path;
+                return false;
+            }
+            SnapshotHeader header;
+            bool ok = fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, SNAPSHOT_MAGIC, 8) == 0 &&
+                      header.version == SNAPSHOT_VERSION;
+            if(ok) {
+                bytes.resize(header.size);
+                ok = bytes.empty() || fread(&bytes[0], 1, bytes.size(), file) == bytes.size();
+                tellers = header.tellers;
+            }
+            fclose(file);
+            if(!ok) {
+                bytes.clear();
+                error = path + " is not a snapshot file";
+            }
+            return ok;
+        }
+};
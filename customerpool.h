@@ -0,0 +1,181 @@
+/** Per simulator customer arena. Customers live in fixed size slabs and are referred to by a 32 bit handle
+    (slab number in the high bits, slot in the low bits), so the queues hold 4 byte handles instead of 8 byte
+    pointers and a slab never moves once allocated. Released slots go on a free list and are reused by the
+    next arrival; after the warm-up no arrival or departure touches malloc/free. The pool belongs to a single
+    simulator and is only used by the thread running it, so the free list needs no locking.
+
+    A pool can be given a limit: its slabs are allocated up front and allocate() hands out NO_CUSTOMER once
+    that many customers are live, so the memory of a run with a bounded queue capacity never grows (see
+    QueuePolicy::queueCapacity). The queues are rings of handles (CustomerQueue) that only grow when full. */
+
+typedef uint32_t t_customer;
+
+#define NO_CUSTOMER              0xFFFFFFFFu
+#define CUSTOMER_SLAB_BITS       10
+#define CUSTOMER_SLAB_SIZE       (1u << CUSTOMER_SLAB_BITS)
+
+class CustomerPool {
+
+        vector<Customer*> slabs;
+        vector<t_customer> freeHandles;  /** released handles, reused last in first out */
+        t_customer nextUnused;           /** handles below this have been handed out at least once */
+
+        t_customer limit;                /** most live customers, 0: no limit */
+
+    public:
+        CustomerPool() {
+            nextUnused = 0;
+            limit = 0;
+        }
+
+        ~CustomerPool() {
+            for(size_t i = 0; i < slabs.size(); i++)
+                delete [] slabs[i];
+        }
+
+        inline Customer &operator [] (t_customer handle) {
+            return slabs[handle >> CUSTOMER_SLAB_BITS][handle & (CUSTOMER_SLAB_SIZE - 1)];
+        }
+
+        t_customer allocate(int customerId, t_simtime arrivalTime) {
+            t_customer handle;
+            if(!freeHandles.empty()) {
+                handle = freeHandles.back();
+                freeHandles.pop_back();
+            }
+            else {
+                if(limit && nextUnused >= limit)
+                    return NO_CUSTOMER;
+                handle = nextUnused++;
+                if((handle >> CUSTOMER_SLAB_BITS) == slabs.size())
+                    slabs.push_back(new Customer[CUSTOMER_SLAB_SIZE]);
+            }
+            (*this)[handle] = Customer(customerId, arrivalTime);
+            return handle;
+        }
+
+        inline void release(t_customer handle)  { freeHandles.push_back(handle); }
+
+        /** forgets every customer but keeps the slabs for the next run */
+        inline void clear()                     { freeHandles.clear(); nextUnused = 0; }
+
+        /** at most limit customers live from now on (0: any number), with their slabs and free list allocated
+            now. call on an empty pool */
+        void setLimit(t_customer limit) {
+            this->limit = limit;
+            while(slabs.size() * CUSTOMER_SLAB_SIZE < limit)
+                slabs.push_back(new Customer[CUSTOMER_SLAB_SIZE]);
+            freeHandles.reserve(limit);
+        }
+
+        /** the customers handed out so far, live or released, and the free list */
+        void save(StateWriter &out) const {
+            out.put(nextUnused);
+            for(t_customer first = 0; first < nextUnused; first += CUSTOMER_SLAB_SIZE)
+                out.putArray(slabs[first >> CUSTOMER_SLAB_BITS], min(CUSTOMER_SLAB_SIZE, nextUnused - first));
+            out.putVector(freeHandles);
+        }
+
+        bool restore(StateReader &in) {
+            clear();
+            if(!in.get(nextUnused))
+                return false;
+            for(t_customer first = 0; first < nextUnused && in.ok(); first += CUSTOMER_SLAB_SIZE) {
+                if((first >> CUSTOMER_SLAB_BITS) == slabs.size())
+                    slabs.push_back(new Customer[CUSTOMER_SLAB_SIZE]);
+                in.getArray(slabs[first >> CUSTOMER_SLAB_BITS], min(CUSTOMER_SLAB_SIZE, nextUnused - first));
+            }
+            in.getVector(freeHandles);
+            if(!in.ok())
+                clear();
+            return in.ok();
+        }
+
+        inline size_t liveCount()               { return nextUnused - freeHandles.size(); }
+        inline size_t capacity()                { return slabs.size() * CUSTOMER_SLAB_SIZE; }
+        inline t_customer getLimit()            { return limit; }
+};
+
+
+/** first in first out queue of customer handles in a ring buffer of a power of two size, with the tail also
+    taken by jockeying and any customer by reneging. it only grows when full, and keeps its memory when
+    cleared */
+class CustomerQueue {
+
+        vector<t_customer> slots;
+        uint32_t head;
+        uint32_t count;
+
+        void grow() {
+            vector<t_customer> larger(slots.empty() ? 16 : 2 * slots.size());
+            for(uint32_t i = 0; i < count; i++)
+                larger[i] = (*this)[i];
+            slots.swap(larger);
+            head = 0;
+        }
+
+    public:
+        CustomerQueue() {
+            head = 0;
+            count = 0;
+        }
+
+        inline t_customer operator [] (uint32_t i) const { return slots[(head + i) & (slots.size() - 1)]; }
+        inline t_customer front() const         { return slots[head]; }
+        inline t_customer back() const          { return (*this)[count - 1]; }
+        inline uint32_t size() const            { return count; }
+        inline bool empty() const               { return count == 0; }
+        inline void clear()                     { head = 0; count = 0; }
+
+        inline void push_back(t_customer C) {
+            if(count == slots.size())
+                grow();
+            slots[(head + count) & (slots.size() - 1)] = C;
+            count++;
+        }
+
+        inline void pop_front() {
+            head = (head + 1) & (slots.size() - 1);
+            count--;
+        }
+
+        inline void pop_back()                  { count--; }
+
+        /** room for n customers without growing */
+        void reserve(uint32_t n) {
+            while(slots.size() < n)
+                grow();
+        }
+
+        /** takes C out of the queue, keeping the order of the others */
+        void remove(t_customer C) {
+            uint32_t i = 0;
+            while(i < count && (*this)[i] != C)
+                i++;
+            for(; i + 1 < count; i++)
+                slots[(head + i) & (slots.size() - 1)] = (*this)[i + 1];
+            if(i < count)
+                count--;
+        }
+
+        /** in the format of StateWriter::putDeque, so that snapshots read the same either way */
+        void save(StateWriter &out) const {
+            out.put((uint64_t) count);
+            for(uint32_t i = 0; i < count; i++)
+                out.put((*this)[i]);
+        }
+
+        bool restore(StateReader &in) {
+            clear();
+            uint64_t n = 0;
+            in.get(n);
+            for(uint64_t i = 0; i < n && in.ok(); i++) {
+                t_customer C = NO_CUSTOMER;
+                if(in.get(C))
+                    push_back(C);
+            }
+            return in.ok();
+        }
+
+        inline size_t memory() const            { return slots.capacity() * sizeof(t_customer); }
+};
@@ -0,0 +1,316 @@
+/** Service and inter-arrival time distributions. A Distribution is the shape of a distribution with mean 1; a
+    RandomStream (simulator.h) scales it by the mean of its grid point, so a grid over the means keeps the shape.
+
+        exponential          the original model
+        lognormal:cv         lognormal with coefficient of variation cv (standard deviation / mean)
+        gamma:k              gamma with shape k, coefficient of variation 1 / sqrt(k)
+        empirical:file       the durations listed in file, one "value" or "value, weight" per line, rescaled to
+                             mean 1; sampled in O(1) through an alias table (Vose's method)
+
+    Streams do not draw one sample per event: they fill a block of SAMPLE_BLOCK samples at a time with a tight
+    loop for the one distribution they have (fill()), and events take samples off the block. Exponential samples
+    are the very ones drawing one at a time would give, in the same order.
+
+    ArrivalProfile makes the arrivals a non-homogeneous Poisson process: the arrival rate 1 / inter_arrival_mean
+    is multiplied by a piecewise constant factor of the time of day, and arrivals are drawn by thinning (Lewis
+    and Shedler, 1979): candidates come at the peak rate, and one at time t is kept with probability
+    factor(t) / peak factor. */
+
+#define SAMPLE_BLOCK             32
+
+enum DistributionKind {
+    EXPONENTIAL_DISTRIBUTION,
+    LOGNORMAL_DISTRIBUTION,
+    GAMMA_DISTRIBUTION,
+    EMPIRICAL_DISTRIBUTION
+};
+
+
+/** two independent standard normals from two uniforms (Box-Muller) */
+inline void normalPair(StreamEngine &engine, double &z0, double &z1) {
+    double r = sqrt(-2 * log(engine.nextUniform()));
+    double angle = 2 * M_PI * engine.nextUniform();
+    z0 = r * cos(angle);
+    z1 = r * sin(angle);
+}
+
+
+/** Discrete distribution sampled in constant time: column i is picked uniformly, and gives values[i] with
+    probability threshold[i], values[alias[i]] otherwise. */
+class AliasTable {
+
+        vector<double> values;
+        vector<double> threshold;
+        vector<uint32_t> alias;
+
+    public:
+        /** weights need not be normalized */
+        void build(const vector<double> &values, const vector<double> &weights) {
+            size_t n = values.size();
+            this->values = values;
+            threshold.assign(n, 1.0);
+            alias.resize(n);
+            double total = 0;
+            for(size_t i = 0; i < n; i++)
+                total += weights[i];
+
+            /** columns with less than the average weight are topped up from columns with more */
+            vector<double> scaled(n);
+            vector<uint32_t> small, large;
+            for(size_t i = 0; i < n; i++) {
+                scaled[i] = weights[i] * n / total;
+                alias[i] = i;
+                (scaled[i] < 1 ? small : large).push_back(i);
+            }
+            while(!small.empty() && !large.empty()) {
+                uint32_t s = small.back(), l = large.back();
+                small.pop_back();
+                threshold[s] = scaled[s];
+                alias[s] = l;
+                scaled[l] -= 1 - scaled[s];
+                if(scaled[l] < 1) {
+                    large.pop_back();
+                    small.push_back(l);
+                }
+            }
+        }
+
+        inline double sample(StreamEngine &engine) const {
+            uint32_t column = (uint32_t) (((uint64_t) engine.next32() * values.size()) >> 32);
+            double coin = engine.next32() * (1.0 / 4294967296.0);
+            return values[coin < threshold[column] ? column : alias[column]];
+        }
+
+        inline bool empty() const               { return values.empty(); }
+
+        /** everything the samples depend on, for the result cache key (see resultcache.h) */
+        void fingerprint(StateWriter &out) const {
+            out.putVector(values);
+            out.putVector(threshold);
+            out.putVector(alias);
+        }
+};
+
+
+class Distribution {
+
+        DistributionKind kind;
+        double parameter;                /** cv of the lognormal, shape of the gamma */
+        string source;                   /** file of the empirical distribution */
+
+        double mu, sigma;                /** lognormal: the normal behind it, mean 1 */
+        double d, c;                     /** gamma: Marsaglia and Tsang's constants for shape k, k + 1 below 1 */
+        AliasTable empirical;            /** values already divided by their mean */
+
+        /** gamma(k) with mean k, k >= 1 through d and c; below 1 boosted from gamma(k + 1). normals come in
+            pairs, the second one is kept in spare for the next try */
+        inline double gamma(StreamEngine &engine, double &spare, bool &haveSpare) const {
+            while(true) {
+                double z;
+                if(haveSpare)
+                    z = spare;
+                else
+                    normalPair(engine, z, spare);
+                haveSpare = !haveSpare;
+                double v = 1 + c * z;
+                if(v <= 0)
+                    continue;
+                v = v * v * v;
+                double u = engine.nextUniform();
+                if(log(u) < 0.5 * z * z + d - d * v + d * log(v))
+                    return parameter < 1 ? d * v * pow(engine.nextUniform(), 1 / parameter) : d * v;
+            }
+        }
+
+        bool loadEmpirical(const string &path, string &error) {
+            ifstream in(path.c_str());
+            if(!in) {
+                error = "cannot open " + path;
+                return false;
+            }
+            vector<double> values, weights;
+            double sum = 0, total = 0;
+            string line;
+            for(int lineNo = 1; getline(in, line); lineNo++) {
+                size_t hash = line.find('#');
+                if(hash != string::npos)
+                    line.erase(hash);
+                if(line.find_first_not_of(" \t\r") == string::npos)
+                    continue;
+                double value, weight = 1;
+                char extra;
+                int fields = sscanf(line.c_str(), " %lf , %lf %c", &value, &weight, &extra);
+                if(fields < 1 || fields > 2 || !(value >= 0) || !(weight > 0)) {
+                    ostringstream where;
+                    where << path << ":" << lineNo << ": expected \"value\" or \"value, weight\"";
+                    error = where.str();
+                    return false;
+                }
+                values.push_back(value);
+                weights.push_back(weight);
+                sum += value * weight;
+                total += weight;
+            }
+            if(values.empty() || !(sum > 0)) {
+                error = path + " has no positive durations";
+                return false;
+            }
+            for(size_t i = 0; i < values.size(); i++)
+                values[i] /= sum / total;
+            empirical.build(values, weights);
+            return true;
+        }
+
+    public:
+        Distribution() {
+            kind = EXPONENTIAL_DISTRIBUTION;
+            parameter = 0;
+            mu = sigma = d = c = 0;
+        }
+
+        /** "exponential", "lognormal:0.5", "gamma:2" or "empirical:file" */
+        bool parse(const string &text, string &error) {
+            size_t colon = text.find(':');
+            string name = text.substr(0, colon);
+            string argument = colon == string::npos ? string() : text.substr(colon + 1);
+            char *end = NULL;
+            double value = strtod(argument.c_str(), &end);
+            bool numeric = !argument.empty() && *end == '\0' && value > 0;
+
+            if(name == "exponential" && argument.empty())
+                kind = EXPONENTIAL_DISTRIBUTION;
+            else if(name == "lognormal" && numeric) {
+                kind = LOGNORMAL_DISTRIBUTION;
+                sigma = sqrt(log(1 + value * value));
+                mu = -sigma * sigma / 2;
+            }
+            else if(name == "gamma" && numeric) {
+                kind = GAMMA_DISTRIBUTION;
+                d = (value < 1 ? value + 1 : value) - 1.0 / 3;
+                c = 1 / sqrt(9 * d);
+            }
+            else if(name == "empirical" && !argument.empty()) {
+                if(!loadEmpirical(argument, error))
+                    return false;
+                kind = EMPIRICAL_DISTRIBUTION;
+            }
+            else {
+                error = "bad distribution '" + text + "', expected exponential, lognormal:cv, gamma:k or empirical:file";
+                return false;
+            }
+            parameter = numeric ? value : 0;
+            source = argument;
+            return true;
+        }
+
+        /** the next n samples of the distribution scaled to the given mean */
+        void fill(StreamEngine &engine, double mean, t_simtime *out, int n) const {
+            switch(kind) {
+                case EXPONENTIAL_DISTRIBUTION:
+                    for(int i = 0; i < n; i++)
+                        out[i] = -mean * log(engine.nextUniform());
+                    break;
+                case LOGNORMAL_DISTRIBUTION:
+                    for(int i = 0; i < n; i += 2) {
+                        double z0, z1;
+                        normalPair(engine, z0, z1);
+                        out[i] = mean * exp(mu + sigma * z0);
+                        if(i + 1 < n)
+                            out[i + 1] = mean * exp(mu + sigma * z1);
+                    }
+                    break;
+                case GAMMA_DISTRIBUTION: {
+                    double spare = 0;
+                    bool haveSpare = false;
+                    for(int i = 0; i < n; i++)
+                        out[i] = mean / parameter * gamma(engine, spare, haveSpare);
+                    break;
+                }
+                case EMPIRICAL_DISTRIBUTION:
+                    for(int i = 0; i < n; i++)
+                        out[i] = mean * empirical.sample(engine);
+                    break;
+            }
+        }
+
+        inline DistributionKind getKind() const { return kind; }
+
+        /** the shape, an empirical one by its values rather than its file name, for the result cache key */
+        void fingerprint(StateWriter &out) const {
+            out.put(kind);
+            out.put(parameter);
+            empirical.fingerprint(out);
+        }
+
+        string describe() const {
+            ostringstream out;
+            switch(kind) {
+                case EXPONENTIAL_DISTRIBUTION: out << "exponential";                            break;
+                case LOGNORMAL_DISTRIBUTION:   out << "lognormal, cv " << parameter;             break;
+                case GAMMA_DISTRIBUTION:       out << "gamma, shape " << parameter;              break;
+                case EMPIRICAL_DISTRIBUTION:   out << "empirical, from " << source;              break;
+            }
+            return out.str();
+        }
+};
+
+
+/** piecewise constant factor on the arrival rate: factor[i] from start[i] on, until the next start */
+class ArrivalProfile {
+
+        vector<double> start;
+        vector<double> factor;
+        double peak;
+
+    public:
+        ArrivalProfile() {
+            peak = 0;
+        }
+
+        /** "0:0.5, 120:1.5, 240:0.8": start times in increasing order from 0, factors >= 0, one of them > 0 */
+        bool parse(const string &text, string &error) {
+            vector<double> starts, factors;
+            stringstream items(text);
+            string item;
+            while(getline(items, item, ',')) {
+                double at, f;
+                char extra;
+                if(sscanf(item.c_str(), " %lf : %lf %c", &at, &f, &extra) != 2 || f < 0 ||
+                   (starts.empty() ? at != 0 : at <= starts.back())) {
+                    error = "bad arrival profile '" + text + "', expected start:factor, ... with increasing starts from 0";
+                    return false;
+                }
+                starts.push_back(at);
+                factors.push_back(f);
+            }
+            double highest = factors.empty() ? 0 : *max_element(factors.begin(), factors.end());
+            if(!(highest > 0)) {
+                error = "bad arrival profile '" + text + "', no positive factor";
+                return false;
+            }
+            start = starts;
+            factor = factors;
+            peak = highest;
+            return true;
+        }
+
+        inline bool empty() const               { return start.empty(); }
+        inline double getPeak() const           { return peak; }
+
+        void fingerprint(StateWriter &out) const {
+            out.putVector(start);
+            out.putVector(factor);
+        }
+
+        inline double at(t_simtime t) const {
+            size_t i = upper_bound(start.begin(), start.end(), t) - start.begin();
+            return factor[i - 1];
+        }
+
+        string describe() const {
+            ostringstream out;
+            for(size_t i = 0; i < start.size(); i++)
+                out << (i ? ", " : "") << "x" << factor[i] << " from " << start[i];
+            return out.str();
+        }
+};
@@ -0,0 +1,73 @@
+/** Allocation free event list. An event is a plain 16 byte record (time, type, teller id) kept by value in a
+    4-ary min-heap on a single vector, so scheduling an event never calls malloc once the vector has grown to the
+    working size, and the simulator dispatches on the type with a switch instead of a virtual call.
+    The pointer based priority_queue<Event*> is kept next to it (see EventListKind) for side by side measurement. */
+
+enum EventListKind {
+    HEAP_EVENT_LIST,                 /** value typed 4-ary heap, the default */
+    POINTER_EVENT_LIST               /** the original priority_queue of heap allocated Event objects */
+};
+
+struct EventRecord {
+    t_simtime time;
+    int32_t type;                    /** an EventType */
+    int32_t tellerId;                /** teller of a departure, customer handle of a renege */
+};
+
+class EventHeap {
+
+        vector<EventRecord> heap;
+
+        static const size_t D = 4;
+
+    public:
+        inline bool empty()                     { return heap.empty(); }
+        inline size_t size()                    { return heap.size(); }
+        inline void clear()                     { heap.clear(); }
+        inline void reserve(size_t n)           { heap.reserve(n); }
+        inline const EventRecord &top()         { return heap[0]; }
+        inline const vector<EventRecord> &records() { return heap; }    /** in heap order; pushed back in this order they make the same heap */
+
+        void push(t_simtime time, EventType type, int tellerId) {
+            EventRecord e;
+            e.time = time;
+            e.type = type;
+            e.tellerId = tellerId;
+            size_t i = heap.size();
+            heap.push_back(e);
+            while(i > 0) {
+                size_t parent = (i - 1) / D;
+                if(heap[parent].time <= e.time)
+                    break;
+                heap[i] = heap[parent];
+                i = parent;
+            }
+            heap[i] = e;
+        }
+
+        EventRecord pop() {
+            EventRecord first = heap[0];
+            EventRecord last = heap.back();
+            heap.pop_back();
+            size_t n = heap.size();
+            if(n == 0)
+                return first;
+            size_t i = 0;
+            while(true) {
+                size_t child = i * D + 1;
+                if(child >= n)
+                    break;
+                size_t end = child + D < n ? child + D : n;
+                size_t smallest = child;
+                for(size_t c = child + 1; c < end; c++)
+                    if(heap[c].time < heap[smallest].time)
+                        smallest = c;
+                if(last.time <= heap[smallest].time)
+                    break;
+                heap[i] = heap[smallest];
+                i = smallest;
+            }
+            heap[i] = last;
+            return first;
+        }
+};
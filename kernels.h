@@ -0,0 +1,191 @@
+/** Compile time specialized teller selection. The simulator keeps the per teller state it decides on in one
+    contiguous block (queue lengths, busy flags and their sum, all int32), and the selection scans below are
+    templates on the number of tellers: FIXED_N = 1..FIXED_KERNEL_MAX_TELLERS gives loops with a constant trip
+    count that the compiler unrolls, FIXED_N = 0 is the generic path, which runs the vectorized scans of
+    simdscan.h or, for very large pools, asks the TellerIndex.
+
+    The arrival routing and the jockeying rule are policies, plain structs with static members, so the event loop
+    Simulator::runKernel<FIXED_N, Routing, Jockeying>() is compiled once per combination with no indirect calls.
+    Simulator::run() picks the specialization for the teller count and the QueuePolicy of the run.
+
+        routing      shortest     an idle teller if there is one, else the shortest queue (the original rule)
+                     jiq          join idle queue: an idle teller if there is one, else a random teller
+                     power_of_d   the least loaded of d tellers drawn at random, O(d) instead of O(N)
+                     shared       one queue for the whole bank, served first come first served
+        jockeying    nearest      after a departure, the tail customer of the nearest teller whose load (queue +
+                                  service) is at least jockeyThreshold above the freed teller's moves over, if
+                                  it is at most jockeyDistance tellers away (0: any distance)
+                     none
+
+    Balking (a customer does not join a queue of balkAt or more), a queue capacity (a customer who finds the
+    queue chosen full is lost) and reneging (a customer waiting longer than an exponential patience leaves)
+    apply on top of any routing and jockeying, see Simulator::join. */
+
+#define FIXED_KERNEL_MAX_TELLERS 16
+
+enum RoutingKind {
+    SHORTEST_QUEUE_ROUTING,
+    JOIN_IDLE_QUEUE_ROUTING,
+    POWER_OF_D_ROUTING,
+    SHARED_QUEUE_ROUTING
+};
+
+/** everything about how customers pick and change queues, set per run */
+struct QueuePolicy {
+    RoutingKind routing;
+    int choices;                     /** d of power_of_d */
+    int jockeyThreshold;             /** load difference that makes a customer jockey, at least 2, 2 originally */
+    int jockeyDistance;              /** farthest teller a customer jockeys from, 0: any */
+    int balkAt;                      /** queue length at which arrivals balk, 0: never */
+    t_simtime patienceMean;          /** mean patience of a waiting customer, 0: infinite */
+    int queueCapacity;               /** customers waiting at a teller at most, N times that in the shared queue.
+                                         0: no bound, else the memory of a run is bounded too, see
+                                         Simulator::memoryCeiling */
+};
+
+inline QueuePolicy defaultQueuePolicy() {
+    QueuePolicy policy = { SHORTEST_QUEUE_ROUTING, 2, 2, 0, 0, 0, 0 };
+    return policy;
+}
+
+inline const char *routingName(RoutingKind routing) {
+    static const char *names[] = { "shortest", "jiq", "power_of_d", "shared" };
+    return names[routing];
+}
+
+/** returned by a routing policy for the shared queue */
+#define SHARED_QUEUE             -1
+
+/** read only view of the state the policies decide on */
+struct TellerView {
+    int N;
+    const int32_t *queueLength;      /** customers waiting, not counting the one in service */
+    const int32_t *busy;             /** 1 while the teller serves someone */
+    const int32_t *load;             /** queueLength + busy */
+    TellerIndex *index;              /** NULL unless the pool is large, see tellerindex.h */
+    StreamEngine *random;            /** for the policies that draw, e.g. power of d */
+    const QueuePolicy *policy;
+};
+
+template <int FIXED_N>
+struct TellerScan {
+
+    /** leftmost teller that is idle with nobody queued, -1 if none */
+    static inline int freeTeller(const TellerView &v) {
+        const int n = FIXED_N ? FIXED_N : v.N;
+        if(!FIXED_N)
+            return v.index ? v.index->getFreeTellerId() : scanKernels().firstEqual(v.load, n, 0);
+        for(int i = 0; i < n; i++)
+            if(v.load[i] == 0)
+                return i;
+        return -1;
+    }
+
+    /** leftmost teller with the fewest customers waiting */
+    static inline int shortestQueue(const TellerView &v) {
+        const int n = FIXED_N ? FIXED_N : v.N;
+        if(!FIXED_N)
+            return v.index ? v.index->getShortestQuedTellerId() : scanKernels().argMin(v.queueLength, n);
+        int best = 0;
+        int32_t least = v.queueLength[0];
+        for(int i = 1; i < n; i++) {
+            bool shorter = v.queueLength[i] < least;
+            best = shorter ? i : best;
+            least = shorter ? v.queueLength[i] : least;
+        }
+        return best;
+    }
+
+    /** teller drawn uniformly at random */
+    static inline int randomTeller(const TellerView &v) {
+        const int n = FIXED_N ? FIXED_N : v.N;
+        return (int) (((uint64_t) v.random->next32() * n) >> 32);
+    }
+
+    /** nearest teller other than tellerId whose queue + service exceeds threshold, the left one on equal
+        distance, -1 if none */
+    static inline int nearestAbove(const TellerView &v, int tellerId, int threshold) {
+        const int n = FIXED_N ? FIXED_N : v.N;
+        if(!FIXED_N) {
+            if(v.index)
+                return v.index->getNearestAbove(tellerId, threshold);
+            int left = tellerId > 0 ? scanKernels().lastAbove(v.load, tellerId - 1, threshold) : -1;
+            int right = scanKernels().firstAbove(v.load, tellerId + 1, n, threshold);
+            if(left == -1 || right == -1)
+                return left == -1 ? right : left;
+            return tellerId - left <= right - tellerId ? left : right;
+        }
+        int jumper = -1;
+        int minDistance = n * n;
+        for(int i = 0; i < n; i++) {
+            int distance = i > tellerId ? i - tellerId : tellerId - i;
+            bool candidate = i != tellerId && distance < minDistance && v.load[i] > threshold;
+            jumper = candidate ? i : jumper;
+            minDistance = candidate ? distance : minDistance;
+        }
+        return jumper;
+    }
+};
+
+
+/** arrival routing: an idle teller if there is one, otherwise the shortest queue */
+struct ShortestQueueRouting {
+    static const bool sharedQueue = false;
+    template <int FIXED_N>
+    static inline int route(const TellerView &v) {
+        int idle = TellerScan<FIXED_N>::freeTeller(v);
+        return idle != -1 ? idle : TellerScan<FIXED_N>::shortestQueue(v);
+    }
+};
+
+/** arrival routing: an idle teller if there is one, otherwise any teller at random */
+struct JoinIdleQueueRouting {
+    static const bool sharedQueue = false;
+    template <int FIXED_N>
+    static inline int route(const TellerView &v) {
+        int idle = TellerScan<FIXED_N>::freeTeller(v);
+        return idle != -1 ? idle : TellerScan<FIXED_N>::randomTeller(v);
+    }
+};
+
+/** arrival routing: the least loaded of d tellers drawn at random (with replacement), the first drawn on ties */
+struct PowerOfDRouting {
+    static const bool sharedQueue = false;
+    template <int FIXED_N>
+    static inline int route(const TellerView &v) {
+        int best = TellerScan<FIXED_N>::randomTeller(v);
+        for(int i = 1; i < v.policy->choices; i++) {
+            int candidate = TellerScan<FIXED_N>::randomTeller(v);
+            best = v.load[candidate] < v.load[best] ? candidate : best;
+        }
+        return best;
+    }
+};
+
+/** arrival routing: an idle teller if there is one, otherwise the single queue of the bank (SHARED_QUEUE), from
+    which every teller that becomes free takes the head */
+struct SharedQueueRouting {
+    static const bool sharedQueue = true;
+    template <int FIXED_N>
+    static inline int route(const TellerView &v) {
+        int idle = TellerScan<FIXED_N>::freeTeller(v);
+        return idle != -1 ? idle : SHARED_QUEUE;
+    }
+};
+
+/** jockeying: after a departure, the tail customer of the nearest teller that has at least jockeyThreshold more
+    customers (queue + service) than the teller just freed moves over, if that teller is close enough */
+struct NearestJockeying {
+    template <int FIXED_N>
+    static inline int source(const TellerView &v, int tellerId) {
+        int from = TellerScan<FIXED_N>::nearestAbove(v, tellerId, v.load[tellerId] + v.policy->jockeyThreshold - 1);
+        int limit = v.policy->jockeyDistance;
+        return from == -1 || limit == 0 || abs(from - tellerId) <= limit ? from : -1;
+    }
+};
+
+/** jockeying switched off */
+struct NoJockeying {
+    template <int FIXED_N>
+    static inline int source(const TellerView &, int)  { return -1; }
+};
@@ -0,0 +1,285 @@
+/** Opt-in instrumentation of the event loop. A simulator with a SimulatorMetrics attached (Simulator::setMetrics)
+    counts its events by type, the jockeys landing at each teller and the high water mark of the event list, and
+    times one event in METRICS_TIMING_SAMPLE with steady_clock, which gives the time spent per event type without
+    reading the clock on every event. Every METRICS_TIMING_SAMPLE events it also publishes its clock and its
+    current and mean total queue length, so a queue running away shows up while the run is still going.
+    Without metrics attached the event loop pays one predictable branch per event.
+
+    The counters are written by the thread running the simulator alone and read concurrently by the
+    MetricsExporter, hence relaxed atomics: on the writing side they cost what plain stores do. The exporter
+    writes a snapshot of all workers of a ReplicationRunner every interval, either as one JSON object per line
+    appended to a file, or as a Prometheus text exposition file that is replaced on every snapshot (suitable for
+    the node exporter's textfile collector). */
+
+#define METRICS_TIMING_SAMPLE    64
+#define METRICS_EVENT_TYPES      5       /** EXIT, ARRIVAL, DEPARTURE, RENEGE, TRANSFER */
+
+enum MetricsFormat {
+    METRICS_JSON_LINES,
+    METRICS_PROMETHEUS
+};
+
+class SimulatorMetrics {
+
+        /** single writer, so an increment is a relaxed load and store, not a locked add */
+        static inline void bump(atomic<long long> &counter, long long by = 1) {
+            counter.store(counter.load(memory_order_relaxed) + by, memory_order_relaxed);
+        }
+
+        vector<atomic<long long> *> byTeller;   /** jockeys landing at each teller, current job. grown under lock */
+
+    public:
+        atomic<long long> events[METRICS_EVENT_TYPES];
+        atomic<long long> timedEvents[METRICS_EVENT_TYPES];
+        atomic<long long> timedNanos[METRICS_EVENT_TYPES];
+        atomic<long long> jockeys;
+        atomic<long long> eventListHighWater;
+
+        atomic<int> job;                 /** index of the job running, -1 between jobs */
+        atomic<int> tellers;
+        atomic<double> clock;
+        atomic<int32_t> queueLength;     /** total over the tellers */
+        atomic<double> meanQueueLength;  /** time average of the total so far */
+
+        mutex lock;                      /** guards byTeller against growing while it is read */
+
+        SimulatorMetrics() {
+            for(int t = 0; t < METRICS_EVENT_TYPES; t++) {
+                events[t] = 0;
+                timedEvents[t] = 0;
+                timedNanos[t] = 0;
+            }
+            jockeys = 0;
+            eventListHighWater = 0;
+            job = -1;
+            tellers = 0;
+            clock = 0;
+            queueLength = 0;
+            meanQueueLength = 0;
+        }
+
+        ~SimulatorMetrics() {
+            for(size_t i = 0; i < byTeller.size(); i++)
+                delete byTeller[i];
+        }
+
+        void startJob(int job, int tellers) {
+            lock_guard<mutex> guard(lock);
+            while((int) byTeller.size() < tellers)
+                byTeller.push_back(new atomic<long long>(0));
+            for(size_t i = 0; i < byTeller.size(); i++)
+                byTeller[i]->store(0, memory_order_relaxed);
+            this->tellers = tellers;
+            clock = 0;
+            queueLength = 0;
+            meanQueueLength = 0;
+            this->job = job;
+        }
+
+        inline void endJob()                    { job = -1; }
+
+        /** counts an event taken off a list that held depth events. true if this one is to be timed */
+        inline bool countEvent(int type, size_t depth, long long eventNumber) {
+            bump(events[type]);
+            if((long long) depth > eventListHighWater.load(memory_order_relaxed))
+                eventListHighWater.store(depth, memory_order_relaxed);
+            return eventNumber % METRICS_TIMING_SAMPLE == 0;
+        }
+
+        inline void timedEvent(int type, long long nanos, t_simtime now, int32_t totalQueueLength, double meanTotalQueueLength) {
+            bump(timedEvents[type]);
+            bump(timedNanos[type], nanos);
+            clock.store(now, memory_order_relaxed);
+            queueLength.store(totalQueueLength, memory_order_relaxed);
+            meanQueueLength.store(meanTotalQueueLength, memory_order_relaxed);
+        }
+
+        inline void jockeyed(int toTeller) {
+            bump(jockeys);
+            bump(*byTeller[toTeller]);
+        }
+
+        /** copies the per teller counts, call with lock held */
+        vector<long long> jockeysByTeller() {
+            vector<long long> counts;
+            for(int i = 0; i < tellers; i++)
+                counts.push_back(byTeller[i]->load(memory_order_relaxed));
+            return counts;
+        }
+};
+
+
+class MetricsExporter {
+
+        string path;
+        MetricsFormat format;
+        double interval;                 /** seconds between snapshots */
+
+        vector<SimulatorMetrics *> workers;
+        atomic<long long> jobsDone;
+        atomic<long long> jobsTotal;
+        chrono::steady_clock::time_point started;
+
+        mutex lock;                      /** guards workers and stopping */
+        condition_variable wake;
+        bool stopping;
+        thread exporter;
+
+        static const char *typeName(int type) {
+            static const char *names[] = { "exit", "arrival", "departure", "renege", "transfer" };
+            return names[type];
+        }
+
+        void writeJsonLine(FILE *out, double seconds) {
+            long long events[METRICS_EVENT_TYPES] = { 0 }, timed[METRICS_EVENT_TYPES] = { 0 };
+            long long nanos[METRICS_EVENT_TYPES] = { 0 }, jockeys = 0, highWater = 0;
+            for(size_t w = 0; w < workers.size(); w++) {
+                for(int t = 0; t < METRICS_EVENT_TYPES; t++) {
+                    events[t] += workers[w]->events[t];
+                    timed[t] += workers[w]->timedEvents[t];
+                    nanos[t] += workers[w]->timedNanos[t];
+                }
+                jockeys += workers[w]->jockeys;
+                highWater = max(highWater, workers[w]->eventListHighWater.load());
+            }
+
+            fprintf(out, "{\"time_s\": %.3f, \"jobs_done\": %lld, \"jobs_total\": %lld, \"events\": {", seconds, jobsDone.load(), jobsTotal.load());
+            for(int t = 0; t < METRICS_EVENT_TYPES; t++)
+                fprintf(out, "%s\"%s\": %lld", t ? ", " : "", typeName(t), events[t]);
+            fprintf(out, "}, \"ns_per_event\": {");
+            for(int t = 0; t < METRICS_EVENT_TYPES; t++)
+                fprintf(out, "%s\"%s\": %.1f", t ? ", " : "", typeName(t), timed[t] ? (double) nanos[t] / timed[t] : 0.0);
+            fprintf(out, "}, \"jockeys\": %lld, \"event_list_high_water\": %lld, \"workers\": [", jockeys, highWater);
+            for(size_t w = 0; w < workers.size(); w++) {
+                SimulatorMetrics &m = *workers[w];
+                lock_guard<mutex> guard(m.lock);
+                fprintf(out, "%s{\"job\": %d, \"tellers\": %d, \"clock\": %g, \"queue_length\": %d, \"mean_queue_length\": %g, \"jockeys_by_teller\": [",
+                        w ? ", " : "", m.job.load(), m.tellers.load(), m.clock.load(), m.queueLength.load(), m.meanQueueLength.load());
+                vector<long long> byTeller = m.jockeysByTeller();
+                for(size_t i = 0; i < byTeller.size(); i++)
+                    fprintf(out, "%s%lld", i ? ", " : "", byTeller[i]);
+                fprintf(out, "]}");
+            }
+            fprintf(out, "]}\n");
+        }
+
+        void writePrometheus(FILE *out) {
+            fprintf(out, "# TYPE bank_jobs_done_total counter\nbank_jobs_done_total %lld\n", jobsDone.load());
+            fprintf(out, "# TYPE bank_jobs_total gauge\nbank_jobs_total %lld\n", jobsTotal.load());
+            fprintf(out, "# TYPE bank_events_total counter\n");
+            for(size_t w = 0; w < workers.size(); w++)
+                for(int t = 0; t < METRICS_EVENT_TYPES; t++)
+                    fprintf(out, "bank_events_total{worker=\"%zu\",type=\"%s\"} %lld\n", w, typeName(t), workers[w]->events[t].load());
+            fprintf(out, "# TYPE bank_event_seconds_sampled counter\n");
+            for(size_t w = 0; w < workers.size(); w++)
+                for(int t = 0; t < METRICS_EVENT_TYPES; t++)
+                    fprintf(out, "bank_event_seconds_sampled{worker=\"%zu\",type=\"%s\"} %.9f\n", w, typeName(t), workers[w]->timedNanos[t].load() * 1e-9);
+            fprintf(out, "# TYPE bank_events_sampled counter\n");
+            for(size_t w = 0; w < workers.size(); w++)
+                for(int t = 0; t < METRICS_EVENT_TYPES; t++)
+                    fprintf(out, "bank_events_sampled{worker=\"%zu\",type=\"%s\"} %lld\n", w, typeName(t), workers[w]->timedEvents[t].load());
+            fprintf(out, "# TYPE bank_jockeys_total counter\n");
+            for(size_t w = 0; w < workers.size(); w++)
+                fprintf(out, "bank_jockeys_total{worker=\"%zu\"} %lld\n", w, workers[w]->jockeys.load());
+            fprintf(out, "# TYPE bank_event_list_high_water gauge\n");
+            for(size_t w = 0; w < workers.size(); w++)
+                fprintf(out, "bank_event_list_high_water{worker=\"%zu\"} %lld\n", w, workers[w]->eventListHighWater.load());
+            fprintf(out, "# TYPE bank_job gauge\n# TYPE bank_clock gauge\n# TYPE bank_queue_length gauge\n# TYPE bank_mean_queue_length gauge\n");
+            for(size_t w = 0; w < workers.size(); w++) {
+                SimulatorMetrics &m = *workers[w];
+                fprintf(out, "bank_job{worker=\"%zu\"} %d\nbank_clock{worker=\"%zu\"} %g\nbank_queue_length{worker=\"%zu\"} %d\n"
+                             "bank_mean_queue_length{worker=\"%zu\"} %g\n",
+                        w, m.job.load(), w, m.clock.load(), w, m.queueLength.load(), w, m.meanQueueLength.load());
+            }
+            fprintf(out, "# TYPE bank_teller_jockeys counter\n");
+            for(size_t w = 0; w < workers.size(); w++) {
+                lock_guard<mutex> guard(workers[w]->lock);
+                vector<long long> byTeller = workers[w]->jockeysByTeller();
+                for(size_t i = 0; i < byTeller.size(); i++)
+                    fprintf(out, "bank_teller_jockeys{worker=\"%zu\",teller=\"%zu\"} %lld\n", w, i, byTeller[i]);
+            }
+        }
+
+        /** call with lock held */
+        void snapshot() {
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+            if(format == METRICS_JSON_LINES) {
+                FILE *out = fopen(path.c_str(), "a");
+                if(!out)
+                    return;
+                writeJsonLine(out, seconds);
+                fclose(out);
+                return;
+            }
+            /** written aside and renamed, so a reader never sees half a file */
+            string temporary = path + ".tmp";
+            FILE *out = fopen(temporary.c_str(), "w");
+            if(!out)
+                return;
+            writePrometheus(out);
+            if(fclose(out) == 0)
+                rename(temporary.c_str(), path.c_str());
+        }
+
+        /** the last snapshot is taken after stopping, also when the sweep ended before the first interval */
+        void exportLoop() {
+            unique_lock<mutex> guard(lock);
+            while(true) {
+                if(!stopping)
+                    wake.wait_for(guard, chrono::duration<double>(interval));
+                snapshot();
+                if(stopping)
+                    return;
+            }
+        }
+
+    public:
+        MetricsExporter(const string &path, MetricsFormat format, double interval) {
+            this->path = path;
+            this->format = format;
+            this->interval = interval;
+            jobsDone = 0;
+            jobsTotal = 0;
+            stopping = false;
+            started = chrono::steady_clock::now();
+            if(format == METRICS_JSON_LINES) {
+                FILE *out = fopen(path.c_str(), "w");     /** a new file for every sweep */
+                if(out)
+                    fclose(out);
+            }
+            exporter = thread(&MetricsExporter::exportLoop, this);
+        }
+
+        /** stops the exporter after a last snapshot */
+        ~MetricsExporter() {
+            {
+                lock_guard<mutex> guard(lock);
+                stopping = true;
+                wake.notify_all();
+            }
+            exporter.join();
+            for(size_t w = 0; w < workers.size(); w++)
+                delete workers[w];
+        }
+
+        /** counters for one more worker, owned by the exporter */
+        SimulatorMetrics *addWorker() {
+            lock_guard<mutex> guard(lock);
+            workers.push_back(new SimulatorMetrics());
+            return workers.back();
+        }
+
+        inline void addJobs(long long jobs)     { jobsTotal += jobs; }
+        inline void jobDone()                   { jobsDone++; }
+
+        /** true if the file can be written */
+        static bool check(const string &path, string &error) {
+            FILE *out = fopen(path.c_str(), "a");
+            if(!out) {
+                error = "cannot write metrics file " + path;
+                return false;
+            }
+            fclose(out);
+            return true;
+        }
+};
@@ -0,0 +1,415 @@
+/** Networks of branches. Every branch is a bank of its own, a Simulator with its own random streams; a customer
+    who would balk at a branch (see QueuePolicy::balkAt) goes on to the next branch of the ring instead, where it
+    arrives transferTime later, at most maxTransfers times before it balks for good. The branches are spread over
+    shards, threads of this process or processes of their own, each running its branches' event loops.
+
+    The shards keep in step conservatively with time windows (YAWNS, Nicol 1993). A transfer takes transferTime,
+    the lookahead, so a customer sent on at time t arrives no earlier than t + transferTime. All shards run their
+    branches up to the end of the window [T, T + transferTime) and then exchange the transfers sent in it, none
+    of which can arrive within the window. The next window starts at the first event anywhere in the network,
+    pending transfers included, so idle stretches are skipped. The exchange delivers the transfers of a branch
+    sorted by time, sender and the sender's sequence number, and the windows do not depend on the sharding, so
+    every branch sees the same events in the same order whatever the number of shards: --shards 1 is the
+    sequential run, and any other number gives the very same table.
+
+    ThreadExchange passes the transfers between threads through shared mailboxes and a barrier. SocketExchange
+    runs each shard in a child process (fork) connected to the coordinating parent by a Unix socket pair; the
+    parent gathers the transfers of a window from all shards, routes them and answers with the next window. */
+
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+struct TransferMessage {
+    t_simtime time;                  /** arrival at the destination */
+    t_simtime arrivalTime;           /** first arrival at the network, the customer's delay counts from here */
+    int32_t destination;             /** branch */
+    int32_t source;
+    int32_t transfers;               /** times sent on, this one included */
+    int32_t unused;
+    int64_t sequence;                /** messages the source sent before this one */
+};
+
+/** the order in which a branch takes in the transfers of a window */
+inline bool earlierTransfer(const TransferMessage &a, const TransferMessage &b) {
+    if(a.time != b.time)
+        return a.time < b.time;
+    if(a.source != b.source)
+        return a.source < b.source;
+    return a.sequence < b.sequence;
+}
+
+enum ShardTransport {
+    THREAD_TRANSPORT,                /** shards are threads of this process */
+    SOCKET_TRANSPORT                 /** shards are child processes, talking over Unix sockets */
+};
+
+/** one run of a network of identical branches */
+struct NetworkJob {
+    ReplicationJob branch;           /** parameters of every branch. branch b runs on substream
+                                         branch.substream * branches + b */
+    int branches;
+    t_simtime transferTime;          /** > 0, the lookahead */
+    int maxTransfers;
+    int shards;
+    ShardTransport transport;
+};
+
+
+class ShardExchange {
+    public:
+        /** hands over what a shard sent in the window just run and the time of its next event (the earliest
+            of its branches' events and of the transfers it sent), and gives back the transfers for its
+            branches and the start of the next window, HUGE_VAL once nothing is left anywhere */
+        virtual t_simtime exchange(int shard, const vector<TransferMessage> &outgoing, t_simtime next,
+                                   vector<TransferMessage> &incoming) = 0;
+        virtual ~ShardExchange() { }
+};
+
+
+/** the shards of one process. mailboxes alternate between two sets by window, so a fast shard posting for the
+    next window never mixes with one still collecting from this one */
+class ThreadExchange : public ShardExchange {
+
+        int shards;
+        mutex lock;
+        condition_variable windowDone;
+        vector<vector<TransferMessage> > mailbox[2];   /** [window parity][shard] */
+        t_simtime earliest[2];
+        t_simtime nextWindow[2];
+        int arrived;
+        long long window;
+
+    public:
+        ThreadExchange(int shards) {
+            this->shards = shards;
+            mailbox[0].resize(shards);
+            mailbox[1].resize(shards);
+            earliest[0] = earliest[1] = HUGE_VAL;
+            nextWindow[0] = nextWindow[1] = HUGE_VAL;
+            arrived = 0;
+            window = 0;
+        }
+
+        t_simtime exchange(int shard, const vector<TransferMessage> &outgoing, t_simtime next, vector<TransferMessage> &incoming) {
+            unique_lock<mutex> guard(lock);
+            int parity = window & 1;
+            for(size_t i = 0; i < outgoing.size(); i++)
+                mailbox[parity][outgoing[i].destination % shards].push_back(outgoing[i]);
+            earliest[parity] = min(earliest[parity], next);
+            if(++arrived == shards) {
+                arrived = 0;
+                nextWindow[parity] = earliest[parity];
+                earliest[parity ^ 1] = HUGE_VAL;
+                window++;
+                windowDone.notify_all();
+            }
+            else {
+                long long mine = window;
+                while(window == mine)
+                    windowDone.wait(guard);
+            }
+            incoming.swap(mailbox[parity][shard]);
+            mailbox[parity][shard].clear();
+            return nextWindow[parity];
+        }
+};
+
+
+inline bool writeAll(int fd, const void *data, size_t size) {
+    const char *p = (const char *) data;
+    while(size > 0) {
+        ssize_t n = write(fd, p, size);
+        if(n <= 0)
+            return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+inline bool readAll(int fd, void *data, size_t size) {
+    char *p = (char *) data;
+    while(size > 0) {
+        ssize_t n = read(fd, p, size);
+        if(n <= 0)
+            return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+/** a batch on the socket: the count and a time, then the messages */
+struct ShardFrame {
+    uint64_t count;
+    t_simtime time;
+};
+
+inline bool writeFrame(int fd, t_simtime time, const vector<TransferMessage> &messages) {
+    ShardFrame frame = { messages.size(), time };
+    return writeAll(fd, &frame, sizeof(frame)) &&
+           (messages.empty() || writeAll(fd, &messages[0], messages.size() * sizeof(TransferMessage)));
+}
+
+inline bool readFrame(int fd, t_simtime &time, vector<TransferMessage> &messages) {
+    ShardFrame frame;
+    if(!readAll(fd, &frame, sizeof(frame)))
+        return false;
+    time = frame.time;
+    messages.resize(frame.count);
+    return messages.empty() || readAll(fd, &messages[0], messages.size() * sizeof(TransferMessage));
+}
+
+
+/** the shard side of the socket transport, in the child process */
+class SocketExchange : public ShardExchange {
+
+        int fd;
+
+    public:
+        SocketExchange(int fd) {
+            this->fd = fd;
+        }
+
+        t_simtime exchange(int, const vector<TransferMessage> &outgoing, t_simtime next, vector<TransferMessage> &incoming) {
+            t_simtime nextWindow;
+            if(!writeFrame(fd, next, outgoing) || !readFrame(fd, nextWindow, incoming))
+                _exit(1);            /** the coordinator is gone */
+            return nextWindow;
+        }
+};
+
+
+class BranchNetwork {
+
+        /** runs the branches b = shard, shard + shards, ... of the network to the end. results[i] belongs to
+            branch shard + i * shards; returns the number of windows */
+        static long long runShard(const NetworkJob &job, int shard, ShardExchange &exchange, vector<ReplicationResult> &results) {
+
+            vector<Simulator *> sims;
+            vector<TransferMessage> outbox, incoming;
+            for(int b = shard; b < job.branches; b += job.shards) {
+                ReplicationJob branch = job.branch;
+                branch.substream = job.branch.substream * job.branches + b;
+                Simulator *sim = new Simulator(branch.numTellers, branch.masterSeed, branch.substream, branch.eventList,
+                                               branch.interArrivalTimeMean, branch.serviceTimeMean);
+                ReplicationRunner::prepare(branch, *sim);
+                sim->setNetwork(&outbox, b, job.branches, job.transferTime, job.maxTransfers);
+                ReplicationRunner::startArrivals(branch, *sim);
+                sims.push_back(sim);
+            }
+
+            long long windows = 0;
+            t_simtime next = HUGE_VAL;
+            for(size_t i = 0; i < sims.size(); i++)
+                next = min(next, sims[i]->nextEventTime());
+            t_simtime windowStart = exchange.exchange(shard, outbox, next, incoming);
+            while(windowStart != HUGE_VAL) {
+                t_simtime limit = windowStart + job.transferTime;
+                for(size_t i = 0; i < sims.size(); i++)
+                    sims[i]->runUntil(limit);
+                windows++;
+
+                next = HUGE_VAL;
+                for(size_t i = 0; i < sims.size(); i++)
+                    next = min(next, sims[i]->nextEventTime());
+                for(size_t i = 0; i < outbox.size(); i++)
+                    next = min(next, outbox[i].time);
+                windowStart = exchange.exchange(shard, outbox, next, incoming);
+                outbox.clear();
+
+                sort(incoming.begin(), incoming.end(), earlierTransfer);
+                for(size_t i = 0; i < incoming.size(); i++)
+                    sims[incoming[i].destination / job.shards]->injectTransfer(incoming[i]);
+            }
+
+            results.clear();
+            for(size_t i = 0; i < sims.size(); i++) {
+                results.push_back(ReplicationRunner::resultOf(*sims[i]));
+                delete sims[i];
+            }
+            return windows;
+
+        }
+
+        static void runThread(const NetworkJob *job, int shard, ThreadExchange *exchange, vector<ReplicationResult> *results,
+                              long long *windows) {
+            *windows = runShard(*job, shard, *exchange, *results);
+        }
+
+        /** one child process per shard. the parent routes the transfers of every window and collects the results */
+        static bool runProcesses(const NetworkJob &job, vector<vector<ReplicationResult> > &shardResults, long long &windows,
+                                 string &error) {
+
+            vector<int> sockets;
+            vector<pid_t> children;
+            bool ok = true;
+            for(int s = 0; s < job.shards && ok; s++) {
+                int pair[2];
+                if(socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0) {
+                    error = "cannot create a socket pair for the shards";
+                    ok = false;
+                    break;
+                }
+                pid_t pid = fork();
+                if(pid == 0) {
+                    for(size_t i = 0; i < sockets.size(); i++)
+                        close(sockets[i]);
+                    close(pair[0]);
+                    SocketExchange exchange(pair[1]);
+                    vector<ReplicationResult> results;
+                    long long shardWindows = runShard(job, s, exchange, results);
+                    uint64_t count = results.size();
+                    bool sent = writeAll(pair[1], &shardWindows, sizeof(shardWindows)) && writeAll(pair[1], &count, sizeof(count)) &&
+                                (results.empty() || writeAll(pair[1], &results[0], count * sizeof(ReplicationResult)));
+                    _exit(sent ? 0 : 1);
+                }
+                close(pair[1]);
+                if(pid < 0) {
+                    close(pair[0]);
+                    error = "cannot fork a shard process";
+                    ok = false;
+                    break;
+                }
+                sockets.push_back(pair[0]);
+                children.push_back(pid);
+            }
+
+            /** the windows: every shard reports, then every shard gets its transfers and the next window start */
+            vector<vector<TransferMessage> > routed(sockets.size());
+            vector<TransferMessage> messages;
+            t_simtime windowStart = 0;
+            while(ok && windowStart != HUGE_VAL) {
+                windowStart = HUGE_VAL;
+                for(size_t s = 0; s < sockets.size() && ok; s++) {
+                    t_simtime next = HUGE_VAL;
+                    ok = readFrame(sockets[s], next, messages);
+                    windowStart = min(windowStart, next);
+                    for(size_t i = 0; i < messages.size(); i++)
+                        routed[messages[i].destination % job.shards].push_back(messages[i]);
+                }
+                for(size_t s = 0; s < sockets.size() && ok; s++) {
+                    ok = writeFrame(sockets[s], windowStart, routed[s]);
+                    routed[s].clear();
+                }
+            }
+
+            shardResults.assign(sockets.size(), vector<ReplicationResult>());
+            for(size_t s = 0; s < sockets.size() && ok; s++) {
+                uint64_t count;
+                ok = readAll(sockets[s], &windows, sizeof(windows)) && readAll(sockets[s], &count, sizeof(count));
+                shardResults[s].resize(ok ? count : 0);
+                ok = ok && (count == 0 || readAll(sockets[s], &shardResults[s][0], count * sizeof(ReplicationResult)));
+            }
+            if(!ok && error.empty())
+                error = "a shard process failed";
+
+            for(size_t s = 0; s < sockets.size(); s++)
+                close(sockets[s]);
+            for(size_t s = 0; s < children.size(); s++) {
+                int status;
+                waitpid(children[s], &status, 0);
+            }
+            return ok;
+
+        }
+
+    public:
+        /** runs the network. results[b] is the result of branch b; windows is the number of time windows the run
+            took. false with a message if the shards could not be started */
+        static bool run(const NetworkJob &requested, vector<ReplicationResult> &results, long long &windows, string &error) {
+
+            /** a shard without branches would have nothing to do */
+            NetworkJob job = requested;
+            job.shards = max(1, min(job.shards, job.branches));
+            vector<vector<ReplicationResult> > shardResults(job.shards);
+            vector<long long> shardWindows(job.shards, 0);
+            if(job.transport == SOCKET_TRANSPORT) {
+                if(!runProcesses(job, shardResults, windows, error))
+                    return false;
+            }
+            else {
+                /** the calling thread runs shard 0 */
+                ThreadExchange exchange(job.shards);
+                vector<thread> pool;
+                for(int s = 1; s < job.shards; s++)
+                    pool.push_back(thread(runThread, &job, s, &exchange, &shardResults[s], &shardWindows[s]));
+                runThread(&job, 0, &exchange, &shardResults[0], &shardWindows[0]);
+                for(size_t i = 0; i < pool.size(); i++)
+                    pool[i].join();
+                windows = shardWindows[0];
+            }
+
+            results.resize(job.branches);
+            for(int b = 0; b < job.branches; b++)
+                results[b] = shardResults[b % job.shards][b / job.shards];
+            return true;
+
+        }
+
+        /** the networks of a grid, one per grid point and replication, run one after the other on all the shards.
+            network gives everything but the branch job, which is the scenario's; substreams, antithetic pairs
+            and common random numbers as in ReplicationRunner::runScenarios(), which the stopping rule is left
+            to. results[g][i] is replication i of grid point g as a whole, see combine(); windows adds up the
+            windows of all the runs. with a result file every replication goes to it as soon as it is done, its
+            fingerprint that of the scenario (see ResultCache::keyOf) and the branches, transfer time and transfers */
+        static bool runScenarios(const vector<ReplicationJob> &scenarios, const vector<int> &maxReplications,
+                                 const ReplicationPlan &plan, const NetworkJob &network,
+                                 vector<vector<ReplicationResult> > &results, long long &windows, string &error,
+                                 ResultWriter *resultFile = NULL) {
+
+            int step = plan.antithetic ? 2 : 1;
+            results.assign(scenarios.size(), vector<ReplicationResult>());
+            windows = 0;
+            for(size_t g = 0; g < scenarios.size(); g++) {
+                int limit = (maxReplications[g] + step - 1) / step * step;
+                uint64_t fingerprint = 0;
+                if(resultFile) {
+                    vector<char> bytes;
+                    StateWriter out(bytes);
+                    out.put(ResultCache::keyOf(scenarios[g], plan));
+                    out.put(network.branches);
+                    out.put(network.transferTime);
+                    out.put(network.maxTransfers);
+                    fingerprint = ResultCache::hash(bytes);
+                }
+                for(int i = 0; i < limit; i++) {
+                    NetworkJob job = network;
+                    job.branch = ReplicationRunner::jobOf(scenarios[g], i, plan, fingerprint);
+                    vector<ReplicationResult> branches;
+                    long long runWindows;
+                    if(!run(job, branches, runWindows, error))
+                        return false;
+                    results[g].push_back(combine(branches));
+                    if(resultFile)
+                        resultFile->addReplication(job.branch, results[g].back());
+                    windows += runWindows;
+                }
+            }
+            return true;
+
+        }
+
+        /** the branch results of one run as a single result for the whole network: the delay over all customers
+            served, the queue length per branch, the counts summed */
+        static ReplicationResult combine(const vector<ReplicationResult> &branches) {
+            ReplicationResult r;
+            memset(&r, 0, sizeof(r));
+            for(size_t b = 0; b < branches.size(); b++) {
+                const ReplicationResult &branch = branches[b];
+                r.avgQueueLength += branch.avgQueueLength / branches.size();
+                r.utilization += branch.utilization / branches.size();
+                r.avgDelay += branch.avgDelay * branch.served;
+                r.events += branch.events;
+                r.arrivals += branch.arrivals;
+                r.served += branch.served;
+                r.balked += branch.balked;
+                r.reneged += branch.reneged;
+                r.lost += branch.lost;
+                r.transferred += branch.transferred;
+                r.jockeys += branch.jockeys;
+            }
+            r.avgDelay = r.served > 0 ? r.avgDelay / r.served : 0;
+            return r;
+        }
+};
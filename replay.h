@@ -0,0 +1,207 @@
+/** Trace driven replay. Instead of drawing them, the simulator can take the arrival times and the service
+    durations of the customers from a recorded file (Simulator::setReplay), e.g. the log of a real branch. The
+    file is columnar:
+
+        ReplayHeader                     magic, version, number of customers
+        t_simtime arrivalTime[count]     nondecreasing
+        t_simtime serviceTime[count]     service duration of the same customer, wherever it is served
+
+    It is mapped into memory and read front to back. As in the random runs only the next arrival is ever in the
+    event list, and every REPLAY_CHUNK_RECORDS customers the pages already read are handed back to the kernel and
+    the next chunk is prefetched, so memory stays flat however long the file is. writeReplayColumns() builds such
+    a file from a text file of "arrival, service" lines. */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define REPLAY_MAGIC             "BANKRPL1"
+#define REPLAY_VERSION           1
+#define REPLAY_CHUNK_RECORDS     65536
+
+struct ReplayHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t columns;                /** 2: arrival times, then service durations */
+    uint64_t count;
+};
+
+
+class ArrivalReplay {
+
+        void *mapping;
+        size_t mappingSize;
+        const t_simtime *arrivals;
+        const t_simtime *services;
+        uint64_t count;
+        uint64_t next;                   /** the customer to arrive next */
+
+        static void advise(const t_simtime *column, uint64_t from, uint64_t to, int advice) {
+            static const uintptr_t page = sysconf(_SC_PAGESIZE);
+            uintptr_t first = (uintptr_t) (column + from) & ~(page - 1);
+            uintptr_t last = (uintptr_t) (column + to);
+            if(advice == MADV_DONTNEED)
+                last &= ~(page - 1);     /** never drop the page the cursor is on */
+            if(last > first)
+                madvise((void *) first, last - first, advice);
+        }
+
+        /** the cursor entered a new chunk: drop the one behind it, prefetch the one after it */
+        void nextChunk() {
+            uint64_t ahead = min(count, next + REPLAY_CHUNK_RECORDS);
+            advise(arrivals, next - REPLAY_CHUNK_RECORDS, next, MADV_DONTNEED);
+            advise(services, next - REPLAY_CHUNK_RECORDS, next, MADV_DONTNEED);
+            advise(arrivals, next, ahead, MADV_WILLNEED);
+            advise(services, next, ahead, MADV_WILLNEED);
+        }
+
+    public:
+        ArrivalReplay() {
+            mapping = NULL;
+            mappingSize = 0;
+            arrivals = NULL;
+            services = NULL;
+            count = 0;
+            next = 0;
+        }
+
+        ~ArrivalReplay() {
+            close();
+        }
+
+        bool open(const char *path, string &error) {
+            close();
+            int fd = ::open(path, O_RDONLY);
+            if(fd < 0) {
+                error = string("cannot open replay file ") + path;
+                return false;
+            }
+            struct stat info;
+            if(fstat(fd, &info) != 0 || (size_t) info.st_size < sizeof(ReplayHeader)) {
+                ::close(fd);
+                error = string(path) + " is not a replay file";
+                return false;
+            }
+            mappingSize = info.st_size;
+            mapping = mmap(NULL, mappingSize, PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            if(mapping == MAP_FAILED) {
+                mapping = NULL;
+                error = string("cannot map replay file ") + path;
+                return false;
+            }
+
+            const ReplayHeader *header = (const ReplayHeader *) mapping;
+            if(memcmp(header->magic, REPLAY_MAGIC, sizeof(header->magic)) != 0 || header->version != REPLAY_VERSION ||
+               header->columns != 2 || mappingSize != sizeof(ReplayHeader) + 2 * header->count * sizeof(t_simtime)) {
+                close();
+                error = string(path) + " is not a replay file of this version";
+                return false;
+            }
+            count = header->count;
+            arrivals = (const t_simtime *) ((const char *) mapping + sizeof(ReplayHeader));
+            services = arrivals + count;
+            rewind();
+            return true;
+        }
+
+        void close() {
+            if(mapping)
+                munmap(mapping, mappingSize);
+            mapping = NULL;
+            mappingSize = 0;
+            arrivals = NULL;
+            services = NULL;
+            count = 0;
+            next = 0;
+        }
+
+        /** back to the first customer */
+        void rewind() {
+            next = 0;
+            advise(arrivals, 0, min(count, (uint64_t) REPLAY_CHUNK_RECORDS), MADV_WILLNEED);
+            advise(services, 0, min(count, (uint64_t) REPLAY_CHUNK_RECORDS), MADV_WILLNEED);
+        }
+
+        inline bool done()                      { return next >= count; }
+        inline t_simtime arrivalTime()          { return arrivals[next]; }     /** of the next customer, not done() */
+        inline t_simtime serviceTime()          { return services[next]; }
+        inline void advance()                   { if(++next % REPLAY_CHUNK_RECORDS == 0 && next < count) nextChunk(); }
+
+        inline uint64_t size()                  { return count; }
+
+    private:
+        ArrivalReplay(const ArrivalReplay &);
+        ArrivalReplay &operator = (const ArrivalReplay &);
+};
+
+
+/** converts a text file with one "arrival, service" pair per line (blank lines and # comments skipped) into a
+    replay file. the text is read twice, once to count and once to fill both columns, so it can be any size */
+inline bool writeReplayColumns(const char *textPath, const char *replayPath, string &error) {
+
+    ifstream in(textPath);
+    if(!in) {
+        error = string("cannot open ") + textPath;
+        return false;
+    }
+
+    uint64_t count = 0;
+    string line;
+    t_simtime previous = 0;
+    for(int lineNo = 1; getline(in, line); lineNo++) {
+        size_t hash = line.find('#');
+        if(hash != string::npos)
+            line.erase(hash);
+        if(line.find_first_not_of(" \t\r") == string::npos)
+            continue;
+        double arrival, service;
+        char extra;
+        if(sscanf(line.c_str(), " %lf , %lf %c", &arrival, &service, &extra) != 2 || arrival < previous || service < 0) {
+            ostringstream where;
+            where << textPath << ":" << lineNo << ": expected \"arrival, service\" with nondecreasing arrivals";
+            error = where.str();
+            return false;
+        }
+        previous = arrival;
+        count++;
+    }
+
+    /** one handle writes the arrival column, a second one the service column further down the same file */
+    FILE *arrivalColumn = fopen(replayPath, "wb");
+    FILE *serviceColumn = arrivalColumn ? fopen(replayPath, "r+b") : NULL;
+    if(!serviceColumn) {
+        if(arrivalColumn)
+            fclose(arrivalColumn);
+        error = string("cannot write ") + replayPath;
+        return false;
+    }
+    ReplayHeader header;
+    memcpy(header.magic, REPLAY_MAGIC, sizeof(header.magic));
+    header.version = REPLAY_VERSION;
+    header.columns = 2;
+    header.count = count;
+    bool ok = fwrite(&header, sizeof(header), 1, arrivalColumn) == 1 &&
+              fseek(serviceColumn, sizeof(header) + count * sizeof(t_simtime), SEEK_SET) == 0;
+
+    in.clear();
+    in.seekg(0);
+    while(ok && getline(in, line)) {
+        size_t hash = line.find('#');
+        if(hash != string::npos)
+            line.erase(hash);
+        if(line.find_first_not_of(" \t\r") == string::npos)
+            continue;
+        t_simtime arrival, service;
+        sscanf(line.c_str(), " %lf , %lf", &arrival, &service);
+        ok = fwrite(&arrival, sizeof(arrival), 1, arrivalColumn) == 1 && fwrite(&service, sizeof(service), 1, serviceColumn) == 1;
+    }
+
+    ok = fclose(arrivalColumn) == 0 && ok;
+    ok = fclose(serviceColumn) == 0 && ok;
+    if(!ok)
+        error = string("cannot write ") + replayPath;
+    return ok;
+
+}
@@ -0,0 +1,144 @@
+/** Parallel replication engine. Every (grid point, replication) pair of the sweep in main() is an independent job;
+    the jobs are handed out to a pool of worker threads and the results are written back by job index, so that
+    the reduction in main() sees exactly the same numbers no matter how many threads were used. Each worker keeps
+    one Simulator and resets it between jobs instead of building a new one. Consecutive replications of a grid
+    point that the batched engine can run (see batch.h) are handed out together and run side by side in one
+    BatchSimulator, with the same results.
+
+    Every grid point has random streams of its own (streamKey()), so its results do not depend on which other
+    points are in the grid, and with a ResultCache (see resultcache.h) replications run before are read back
+    instead of simulated again.
+
+    runScenarios() builds the jobs of a whole grid according to a ReplicationPlan: common random numbers across
+    the scenarios, antithetic pairs, and a sequential stopping rule that keeps adding replications to a scenario
+    until the confidence interval of its mean delay is as narrow as asked for. */
+
+#define PRECISION_PILOT_REPLICATIONS 10
+
+/** One independent run of the bank. Its random streams are fixed by the master seed and the substream
+    (see streams.h), so the outcome of a job does not depend on which thread runs it or when. */
+struct ReplicationJob {
+    int scenario;                   /** index of the grid point the job belongs to */
+    int numTellers;
+    int replication;
+    t_simtime interArrivalTimeMean;
+    t_simtime serviceTimeMean;
+    t_simtime horizon;              /** no arrivals after this time, the bank then drains */
+    bool jockeying;
+    QueuePolicy policy;             /** routing, balking and reneging, see kernels.h */
+    const Distribution *serviceDistribution;    /** NULL: exponential, see distributions.h */
+    const Distribution *arrivalDistribution;    /** NULL: exponential */
+    const ArrivalProfile *arrivalProfile;       /** NULL: constant arrival rate */
+    uint64_t masterSeed;
+    uint32_t substream;
+    EventListKind eventList;
+    bool delayQuantiles;            /** also fill the delay quantiles of the result */
+    string traceFile;               /** write the binary event trace of this run here, see trace.h. empty: no trace */
+    string replayFile;              /** take arrivals and service times from this file, see replay.h. empty: draw them */
+    bool antithetic;                /** draw 1 - u where the run on the same substream draws u */
+    bool synchronizedService;       /** service times drawn per customer, see Simulator::setSynchronizedService */
+    bool steadyState;               /** estimate from batch means after an MSER warm-up, see steadystate.h */
+    string checkpointFile;          /** write a snapshot of the run here every checkpointEvery minutes, see
+                                        checkpoint.h. empty: none */
+    t_simtime checkpointEvery;
+    const SimulatorSnapshot *startFrom;  /** NULL: start from an empty bank, else from this state, on the job's
+                                        own random streams unless it is the run the snapshot was taken from */
+    bool freshStatistics;           /** started from a snapshot: report only what happens after it */
+    const SplittingPlan *splitting; /** NULL: an ordinary run, else one importance splitting estimate of a queue
+                                        length tail probability, see splitting.h */
+    uint64_t fingerprint;           /** of the grid point in result files, see ReplicationRunner::jobOf. 0: none */
+};
+
+/** What main() needs out of a single run. */
+struct ReplicationResult {
+    double avgQueueLength;          /** sum over the tellers of the time averaged queue length */
+    double utilization;             /** fraction of the time the tellers were serving, averaged over the tellers */
+    double avgDelay;
+    double confidenceRange;
+    double delayP50;                /** delay quantiles, 0 unless the job asked for them */
+    double delayP95;
+    double delayP99;
+    long long events;               /** events processed, for throughput figures; not those restored from a snapshot */
+    long long arrivals;             /** customers who came to the bank, not counting transfers from other branches */
+    long long balked;               /** of them, customers who did not join a queue */
+    long long reneged;              /** and customers who gave up waiting */
+    long long lost;                 /** and customers turned away by a full queue, see QueuePolicy::queueCapacity */
+    long long served;               /** customers whose service started, the delays averaged */
+    long long transferred;          /** networks: customers sent on to another branch, see network.h */
+    long long jockeys;              /** customers who moved to another queue */
+    double warmupTime;              /** steady state runs: time deleted as warm-up */
+    int batches;                    /** steady state runs: batches the estimates come from */
+    double tailProbability;         /** splitting runs: estimate of P(total queue length reaches the target) */
+};
+
+/** How the replications of the scenarios are drawn and how many of them are run. */
+struct ReplicationPlan {
+    bool commonRandomNumbers;       /** replication i of every scenario uses substream i and synchronized service
+                                        times, so all scenarios are compared on the same customers */
+    bool antithetic;                /** replications come in pairs, the second one antithetic to the first; a pair
+                                        counts as one observation. odd replication counts are rounded up */
+    double relativePrecision;       /** if > 0, stop adding replications to a scenario once the confidence
+                                        interval half width of its mean delay is at most this fraction of the mean */
+    double confidence;
+};
+
+class ReplicationRunner {
+
+        int threads;                 /** number of worker threads, at least 1 */
+        MetricsExporter *exporter;   /** NULL unless the workers are instrumented, see metrics.h */
+        vector<SimulatorMetrics *> workerMetrics;   /** one per worker thread, owned by the exporter */
+        int batchLanes;              /** most replications per BatchSimulator, 1: no batching */
+        ResultCache *cache;          /** NULL: every replication is simulated */
+        long long cachedReplications;    /** served from the cache by the last runScenarios() */
+        long long cachedEvents;          /** and the events they took when they were simulated */
+        ResultWriter *resultFile;    /** NULL unless the tellers of every simulated replication go to a result file */
+
+        /** a task is the jobs [first, second) of the list, more than one only if they make a batch */
+        static void worker(const vector<ReplicationJob> *jobs, const vector<pair<size_t, size_t> > *tasks,
+                           vector<ReplicationResult> *results, atomic<size_t> *nextTask, SimulatorMetrics *metrics,
+                           MetricsExporter *exporter, ResultWriter *resultFile);
+
+    public:
+        ReplicationRunner(int threads);
+
+        static ReplicationResult runOne(const ReplicationJob &job);     /** runs a single replication start to end on the calling thread */
+        static ReplicationResult runOne(const ReplicationJob &job, Simulator &sim);  /** same, reusing sim (reset first) */
+
+        /** the parts of runOne(): sim reset and set up for the job, the first arrival scheduled, the result read off */
+        static void prepare(const ReplicationJob &job, Simulator &sim);
+        static void startArrivals(const ReplicationJob &job, Simulator &sim);
+        static ReplicationResult resultOf(Simulator &sim);
+        vector<ReplicationResult> run(const vector<ReplicationJob> &jobs);  /** results[i] belongs to jobs[i] */
+
+        /** master seed of the runs of a grid point. under common random numbers the master seed itself, so that
+            replication i of every point is on the same streams; else a hash of it and the parameters of the point
+            (tellers, means, jockeying, routing), so that every point has streams of its own wherever it is in the
+            grid. the horizon is left out: a longer day goes on from a shorter one */
+        static uint64_t streamKey(const ReplicationJob &scenario, const ReplicationPlan &plan);
+
+        /** replication i of the scenario as runScenarios() runs it, the fingerprint of its grid point given */
+        static ReplicationJob jobOf(const ReplicationJob &scenario, int i, const ReplicationPlan &plan, uint64_t fingerprint);
+
+        /** runs every scenario (a job whose replication, substream and antithetic fields are filled in here) for
+            up to maxReplications[g] replications as the plan says. results[g] holds the replications of scenario
+            g in order, and depends neither on the thread count nor on how many rounds the stopping rule took */
+        vector<vector<ReplicationResult> > runScenarios(const vector<ReplicationJob> &scenarios, const vector<int> &maxReplications,
+                                                         const ReplicationPlan &plan);
+
+        /** mean delay over the replications of one scenario (over the pair averages if antithetic) and the half
+            width of its confidence interval */
+        static void acrossReplications(const vector<ReplicationResult> &results, bool antithetic, double confidence,
+                                       double &mean, double &halfWidth);
+
+        void setBatchLanes(int lanes);               /** up to BATCH_MAX_LANES, 0 or 1 runs every job on its own */
+        void setMetrics(MetricsExporter *exporter);   /** instruments the simulators of the workers from now on, NULL stops */
+        inline void setCache(ResultCache *cache)      { this->cache = cache; }   /** NULL stops caching */
+        inline long long getCachedReplications()      { return cachedReplications; }
+        inline long long getCachedEvents()            { return cachedEvents; }
+
+        /** the row of every replication of runScenarios() from now on goes to the file as soon as it is done
+            or read from the cache, and the rows of the tellers of every one simulated; NULL stops */
+        inline void setResultFile(ResultWriter *file) { resultFile = file; }
+
+        inline int getThreadCount()    { return threads; }
+};
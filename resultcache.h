@@ -0,0 +1,164 @@
+/** On-disk cache of replication results, for what-if sweeps that change one input and run the grid again.
+    A grid point is identified by a 64 bit hash of everything its results depend on: the parameters of the
+    point, the policy, the shapes of the distributions (the values of an empirical one, not its file name), the
+    arrival profile, the master seed, the replication plan, the replay file (path, size and modification time)
+    and the snapshot the runs start from. The streams of a point do not depend on the rest of the grid (see
+    ReplicationRunner::streamKey), so a point that did not change is the same point however the grid around it
+    changed.
+
+    Each point has one file in the cache directory, named after its hash, holding its replications 0 .. n - 1
+    as ReplicationResult records after a ResultCacheHeader. ReplicationRunner::runScenarios() takes a point's
+    replications from the file as far as it goes and simulates only the rest, so a point asked for more
+    replications than were cached reuses the cached prefix; the file is then rewritten with the longer prefix
+    through a temporary file renamed into place. The results, and the table, are the same with or without the
+    cache.
+
+    Runs that write a trace or checkpoints are always simulated, and networks are not cached. RESULT_CACHE_VERSION
+    goes up whenever a change of the simulator changes the numbers of a run, which invalidates every file. */
+
+#include <cerrno>
+
+#define RESULT_CACHE_MAGIC       "BANKRES1"
+#define RESULT_CACHE_VERSION     2
+
+struct ResultCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize;             /** sizeof(ReplicationResult) of the writer */
+    uint64_t key;
+    uint64_t count;                  /** records after the header */
+};
+
+class ResultCache {
+
+        string directory;
+
+        string pathOf(uint64_t key) const {
+            char name[32];
+            snprintf(name, sizeof(name), "%016llx.res", (unsigned long long) key);
+            return directory + "/" + name;
+        }
+
+    public:
+        /** FNV-1a */
+        static uint64_t hash(const vector<char> &bytes) {
+            uint64_t h = 0xCBF29CE484222325ULL;
+            for(size_t i = 0; i < bytes.size(); i++)
+                h = (h ^ (unsigned char) bytes[i]) * 0x100000001B3ULL;
+            return h;
+        }
+
+        /** the directory is made if it is not there */
+        bool open(const string &directory, string &error) {
+            if(mkdir(directory.c_str(), 0777) != 0 && errno != EEXIST) {
+                error = "cannot make result cache directory " + directory;
+                return false;
+            }
+            struct stat info;
+            if(stat(directory.c_str(), &info) != 0 || !S_ISDIR(info.st_mode)) {
+                error = directory + " is not a directory";
+                return false;
+            }
+            this->directory = directory;
+            return true;
+        }
+
+        /** whether the runs of the scenario can be served from the cache at all */
+        static bool cacheable(const ReplicationJob &scenario) {
+            return scenario.traceFile.empty() && scenario.checkpointFile.empty();
+        }
+
+        /** the hash of a grid point: the scenario as it goes to ReplicationRunner::runScenarios() and the plan */
+        static uint64_t keyOf(const ReplicationJob &scenario, const ReplicationPlan &plan) {
+            vector<char> bytes;
+            StateWriter out(bytes);
+            out.put((uint32_t) RESULT_CACHE_VERSION);
+            out.put(scenario.numTellers);
+            out.put(scenario.interArrivalTimeMean);
+            out.put(scenario.serviceTimeMean);
+            out.put(scenario.horizon);
+            out.put(scenario.jockeying);
+            out.put(scenario.policy.routing);
+            out.put(scenario.policy.choices);
+            out.put(scenario.policy.jockeyThreshold);
+            out.put(scenario.policy.jockeyDistance);
+            out.put(scenario.policy.balkAt);
+            out.put(scenario.policy.patienceMean);
+            out.put(scenario.policy.queueCapacity);
+            out.put(scenario.serviceDistribution != NULL);
+            if(scenario.serviceDistribution)
+                scenario.serviceDistribution->fingerprint(out);
+            out.put(scenario.arrivalDistribution != NULL);
+            if(scenario.arrivalDistribution)
+                scenario.arrivalDistribution->fingerprint(out);
+            out.put(scenario.arrivalProfile != NULL);
+            if(scenario.arrivalProfile)
+                scenario.arrivalProfile->fingerprint(out);
+            out.put(scenario.masterSeed);
+            out.put(scenario.eventList);
+            out.put(scenario.delayQuantiles);
+            out.put(scenario.steadyState);
+            out.put(plan.commonRandomNumbers);
+            out.put(plan.antithetic);
+            out.putVector(vector<char>(scenario.replayFile.begin(), scenario.replayFile.end()));
+            struct stat info;
+            if(!scenario.replayFile.empty() && stat(scenario.replayFile.c_str(), &info) == 0) {
+                out.put((int64_t) info.st_size);
+                out.put((int64_t) info.st_mtime);
+            }
+            out.put(scenario.startFrom != NULL);
+            if(scenario.startFrom) {
+                out.put(scenario.startFrom->tellers);
+                out.putVector(scenario.startFrom->bytes);
+                out.put(scenario.freshStatistics);
+            }
+            out.put(scenario.splitting != NULL);
+            if(scenario.splitting) {
+                out.putVector(scenario.splitting->levels);
+                out.put(scenario.splitting->effort);
+            }
+            return hash(bytes);
+        }
+
+        /** the cached replications of the point, none if there is no file or it does not belong to the key */
+        vector<ReplicationResult> load(uint64_t key) const {
+            vector<ReplicationResult> results;
+            FILE *file = fopen(pathOf(key).c_str(), "rb");
+            if(!file)
+                return results;
+            ResultCacheHeader header;
+            if(fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, RESULT_CACHE_MAGIC, 8) == 0 &&
+               header.version == RESULT_CACHE_VERSION && header.recordSize == sizeof(ReplicationResult) && header.key == key &&
+               header.count > 0 && header.count < (1u << 31)) {
+                results.resize(header.count);
+                if(fread(&results[0], sizeof(ReplicationResult), results.size(), file) != results.size())
+                    results.clear();
+            }
+            fclose(file);
+            return results;
+        }
+
+        bool store(uint64_t key, const vector<ReplicationResult> &results, string &error) const {
+            string path = pathOf(key), temporary = path + ".tmp";
+            FILE *file = fopen(temporary.c_str(), "wb");
+            if(!file) {
+                error = "cannot open result cache file " + temporary;
+                return false;
+            }
+            ResultCacheHeader header;
+            memcpy(header.magic, RESULT_CACHE_MAGIC, 8);
+            header.version = RESULT_CACHE_VERSION;
+            header.recordSize = sizeof(ReplicationResult);
+            header.key = key;
+            header.count = results.size();
+            bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                      (results.empty() || fwrite(&results[0], sizeof(ReplicationResult), results.size(), file) == results.size());
+            ok = fclose(file) == 0 && ok;
+            if(!ok || rename(temporary.c_str(), path.c_str()) != 0) {
+                error = "cannot write result cache file " + path;
+                remove(temporary.c_str());
+                return false;
+            }
+            return true;
+        }
+};
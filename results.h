@@ -0,0 +1,446 @@
+/** Result files: the numbers of every replication and of every teller in it, kept for later analysis instead of
+    only the averaged table. ./simulator --results file appends to the file one row per replication (delays,
+    queue length, utilization, counts, jockeys) and one row per teller of each simulated replication (its queue
+    length, utilization, customers served, their mean delay, jockeys to it).
+
+    The file is column chunked. A ResultFileHeader and the schema of both tables (a ResultSchemaHeader and the
+    ResultColumns of each) come first, then chunks: a ResultChunkHeader and the values of the rows of one table,
+    column after column, each value 8 bytes (int64 or double, in the byte order of the machine). A chunk is
+    written as a whole, so the file only ever grows by whole chunks; a chunk cut short by a crash is dropped the
+    next time the file is opened for writing. Files of several runs, or of workers run in parallel, are merged
+    into one with ./resulttool --merge (see resulttool.cpp), and a reader needs nothing but the header to find
+    any column of any chunk.
+
+    ResultWriter fills a chunk per table from any thread and hands full chunks to a background thread that writes
+    them out, the way TraceWriter does (see trace.h); ResultReader maps a file into memory and gives out the
+    columns of its chunks where they lie. */
+
+#define RESULT_FILE_MAGIC        "BANKCOL1"
+#define RESULT_FILE_VERSION      2
+#define RESULT_CHUNK_ROWS        1024
+#define RESULT_CHUNKS            6
+
+enum ResultTable {
+    REPLICATION_TABLE,               /** one row per replication */
+    TELLER_TABLE,                    /** one row per teller of a replication */
+    RESULT_TABLES
+};
+
+enum ResultColumnType {
+    RESULT_INT64,
+    RESULT_DOUBLE
+};
+
+union ResultValue {
+    int64_t i;
+    double d;
+};
+
+struct ResultColumn {
+    char name[28];
+    int32_t type;                    /** a ResultColumnType */
+};
+
+struct ResultFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t tables;                 /** schemas after the header */
+};
+
+struct ResultSchemaHeader {
+    uint32_t table;
+    uint32_t columns;                /** ResultColumns after this header */
+};
+
+struct ResultChunkHeader {
+    char magic[4];                   /** "CHNK" */
+    uint32_t table;
+    uint64_t rows;                   /** followed by columns * rows values */
+};
+
+/** the rows of a replication are told apart by the fingerprint of its grid point (see ResultCache::keyOf), the
+    key of its streams, the substream and the antithetic flag, which are the same wherever the run was made; the
+    stream key alone is not enough, it is the same for every point under common random numbers and leaves out the
+    horizon. scenario and replication are the indices in the run's grid */
+static const ResultColumn replicationColumns[] = {
+    { "fingerprint", RESULT_INT64 },
+    { "scenario", RESULT_INT64 },           { "replication", RESULT_INT64 },       { "stream_key", RESULT_INT64 },
+    { "substream", RESULT_INT64 },          { "antithetic", RESULT_INT64 },        { "tellers", RESULT_INT64 },
+    { "inter_arrival_mean", RESULT_DOUBLE }, { "service_mean", RESULT_DOUBLE },    { "horizon", RESULT_DOUBLE },
+    { "jockeying", RESULT_INT64 },          { "routing", RESULT_INT64 },           { "avg_delay", RESULT_DOUBLE },
+    { "delay_half_width", RESULT_DOUBLE },  { "delay_p50", RESULT_DOUBLE },        { "delay_p95", RESULT_DOUBLE },
+    { "delay_p99", RESULT_DOUBLE },         { "avg_queue_length", RESULT_DOUBLE }, { "utilization", RESULT_DOUBLE },
+    { "events", RESULT_INT64 },             { "arrivals", RESULT_INT64 },          { "served", RESULT_INT64 },
+    { "balked", RESULT_INT64 },             { "reneged", RESULT_INT64 },           { "lost", RESULT_INT64 },
+    { "transferred", RESULT_INT64 },        { "jockeys", RESULT_INT64 },           { "warmup_time", RESULT_DOUBLE },
+    { "batches", RESULT_INT64 },            { "tail_probability", RESULT_DOUBLE }
+};
+
+static const ResultColumn tellerColumns[] = {
+    { "fingerprint", RESULT_INT64 },
+    { "scenario", RESULT_INT64 },           { "replication", RESULT_INT64 },       { "stream_key", RESULT_INT64 },
+    { "substream", RESULT_INT64 },          { "antithetic", RESULT_INT64 },        { "tellers", RESULT_INT64 },
+    { "teller", RESULT_INT64 },             { "avg_queue_length", RESULT_DOUBLE }, { "utilization", RESULT_DOUBLE },
+    { "served", RESULT_INT64 },             { "avg_delay", RESULT_DOUBLE },        { "jockeys_in", RESULT_INT64 }
+};
+
+#define REPLICATION_COLUMNS      (sizeof(replicationColumns) / sizeof(ResultColumn))
+#define TELLER_COLUMNS           (sizeof(tellerColumns) / sizeof(ResultColumn))
+
+inline const ResultColumn *resultColumns(int table)     { return table == REPLICATION_TABLE ? replicationColumns : tellerColumns; }
+inline int resultColumnCount(int table)                 { return table == REPLICATION_TABLE ? REPLICATION_COLUMNS : TELLER_COLUMNS; }
+
+/** index of the named column of the table, -1 if it has none */
+inline int resultColumnOf(int table, const char *name) {
+    for(int c = 0; c < resultColumnCount(table); c++)
+        if(strcmp(resultColumns(table)[c].name, name) == 0)
+            return c;
+    return -1;
+}
+
+
+class ResultWriter {
+
+        /** rows of one table, column c at values[c * RESULT_CHUNK_ROWS] */
+        struct Chunk {
+            int table;
+            size_t rows;
+            vector<ResultValue> values;
+        };
+
+        FILE *file;
+        Chunk *current[RESULT_TABLES];   /** being filled, NULL until the table's next row */
+
+        vector<Chunk *> chunks;          /** all RESULT_CHUNKS buffers, for freeing */
+        deque<Chunk *> full;             /** waiting for the writer thread, oldest first */
+        vector<Chunk *> empty;
+        bool closing;
+        bool failed;                     /** a write came short, the file misses rows */
+        mutex lock;
+        condition_variable changed;
+        thread writer;
+
+        void writeChunks() {
+            unique_lock<mutex> guard(lock);
+            while(true) {
+                while(full.empty() && !closing)
+                    changed.wait(guard);
+                if(full.empty())
+                    return;
+                Chunk *chunk = full.front();
+                full.pop_front();
+                guard.unlock();
+                ResultChunkHeader header;
+                memcpy(header.magic, "CHNK", sizeof(header.magic));
+                header.table = chunk->table;
+                header.rows = chunk->rows;
+                bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+                for(int c = 0; c < resultColumnCount(chunk->table); c++)
+                    written = written && fwrite(&chunk->values[c * RESULT_CHUNK_ROWS], sizeof(ResultValue), chunk->rows, file) == chunk->rows;
+                written = fflush(file) == 0 && written;
+                guard.lock();
+                failed = failed || !written;
+                empty.push_back(chunk);
+                changed.notify_all();
+            }
+        }
+
+        /** the size of the file up to the end of its last whole chunk, 0 if it is not a result file of this
+            version. the file is positioned behind its schemas */
+        static long validLength(FILE *file, long size) {
+            ResultFileHeader header;
+            if(fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, RESULT_FILE_MAGIC, 8) != 0 ||
+               header.version != RESULT_FILE_VERSION || header.tables != RESULT_TABLES)
+                return 0;
+            for(int t = 0; t < RESULT_TABLES; t++) {
+                ResultSchemaHeader schema;
+                vector<ResultColumn> columns(resultColumnCount(t));
+                if(fread(&schema, sizeof(schema), 1, file) != 1 || schema.table != (uint32_t) t ||
+                   schema.columns != columns.size() || fread(&columns[0], sizeof(ResultColumn), columns.size(), file) != columns.size() ||
+                   memcmp(&columns[0], resultColumns(t), columns.size() * sizeof(ResultColumn)) != 0)
+                    return 0;
+            }
+            long end = ftell(file);
+            ResultChunkHeader chunk;
+            while(fread(&chunk, sizeof(chunk), 1, file) == 1 && memcmp(chunk.magic, "CHNK", 4) == 0 && chunk.table < RESULT_TABLES &&
+                  chunk.rows <= (uint64_t) size) {
+                long next = end + (long) (sizeof(chunk) + chunk.rows * resultColumnCount(chunk.table) * sizeof(ResultValue));
+                if(next > size || fseek(file, next, SEEK_SET) != 0)
+                    break;
+                end = next;
+            }
+            return end;
+        }
+
+    public:
+        ResultWriter() {
+            file = NULL;
+            for(int t = 0; t < RESULT_TABLES; t++)
+                current[t] = NULL;
+            closing = false;
+            failed = false;
+        }
+
+        ~ResultWriter() {
+            close();
+        }
+
+        /** a new file, or the end of an existing result file, where a chunk left cut short is dropped first */
+        bool open(const string &path, string &error) {
+            FILE *existing = fopen(path.c_str(), "rb");
+            if(existing) {
+                struct stat info;
+                long size = fstat(fileno(existing), &info) == 0 ? (long) info.st_size : 0;
+                long length = size > 0 ? validLength(existing, size) : 0;
+                fclose(existing);
+                if(length == 0 && size > 0) {
+                    error = path + " is not a result file of this version";
+                    return false;
+                }
+                if(length > 0 && length < size && truncate(path.c_str(), length) != 0) {
+                    error = "cannot drop the incomplete chunk at the end of " + path;
+                    return false;
+                }
+                if(length > 0)
+                    file = fopen(path.c_str(), "ab");
+            }
+            if(!file) {
+                file = fopen(path.c_str(), "wb");
+                if(!file) {
+                    error = "cannot open result file " + path;
+                    return false;
+                }
+                ResultFileHeader header;
+                memcpy(header.magic, RESULT_FILE_MAGIC, sizeof(header.magic));
+                header.version = RESULT_FILE_VERSION;
+                header.tables = RESULT_TABLES;
+                bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+                for(int t = 0; t < RESULT_TABLES; t++) {
+                    ResultSchemaHeader schema = { (uint32_t) t, (uint32_t) resultColumnCount(t) };
+                    written = written && fwrite(&schema, sizeof(schema), 1, file) == 1;
+                    written = written && fwrite(resultColumns(t), sizeof(ResultColumn), resultColumnCount(t), file) ==
+                                         (size_t) resultColumnCount(t);
+                }
+                if(!written) {
+                    fclose(file);
+                    file = NULL;
+                    error = "cannot write result file " + path;
+                    return false;
+                }
+            }
+
+            for(int i = 0; i < RESULT_CHUNKS; i++) {
+                chunks.push_back(new Chunk());
+                chunks.back()->values.resize(REPLICATION_COLUMNS * RESULT_CHUNK_ROWS);
+            }
+            empty = chunks;
+            closing = false;
+            failed = false;
+            writer = thread(&ResultWriter::writeChunks, this);
+            return true;
+        }
+
+        inline bool isOpen()            { return file != NULL; }
+
+        /** one row of the table, a value per column. safe to call from several threads */
+        void addRow(int table, const ResultValue *row) {
+            unique_lock<mutex> guard(lock);
+            if(!current[table]) {
+                while(empty.empty())
+                    changed.wait(guard);
+                current[table] = empty.back();
+                empty.pop_back();
+                current[table]->table = table;
+                current[table]->rows = 0;
+            }
+            Chunk *chunk = current[table];
+            for(int c = 0; c < resultColumnCount(table); c++)
+                chunk->values[c * RESULT_CHUNK_ROWS + chunk->rows] = row[c];
+            if(++chunk->rows == RESULT_CHUNK_ROWS) {
+                full.push_back(chunk);
+                current[table] = NULL;
+                changed.notify_all();
+            }
+        }
+
+        /** the row of a replication. the job is the one the replication ran as, its replication, stream key,
+            fingerprint, substream and antithetic flag filled in (see ReplicationRunner::jobOf) */
+        void addReplication(const ReplicationJob &job, const ReplicationResult &r) {
+            ResultValue row[REPLICATION_COLUMNS];            /** in the order of replicationColumns */
+            int64_t ints[] = { (int64_t) job.fingerprint, job.scenario, job.replication, (int64_t) job.masterSeed, job.substream,
+                               job.antithetic, job.numTellers };
+            for(int c = 0; c < 7; c++)
+                row[c].i = ints[c];
+            row[7].d = job.interArrivalTimeMean;
+            row[8].d = job.serviceTimeMean;
+            row[9].d = job.horizon;
+            row[10].i = job.jockeying;
+            row[11].i = job.policy.routing;
+            double doubles[] = { r.avgDelay, r.confidenceRange, r.delayP50, r.delayP95, r.delayP99, r.avgQueueLength, r.utilization };
+            for(int c = 0; c < 7; c++)
+                row[12 + c].d = doubles[c];
+            long long counts[] = { r.events, r.arrivals, r.served, r.balked, r.reneged, r.lost, r.transferred, r.jockeys };
+            for(int c = 0; c < 8; c++)
+                row[19 + c].i = counts[c];
+            row[27].d = r.warmupTime;
+            row[28].i = r.batches;
+            row[29].d = r.tailProbability;
+            addRow(REPLICATION_TABLE, row);
+        }
+
+        /** the rows of the tellers of a replication just run on sim */
+        void addTellers(const ReplicationJob &job, Simulator &sim) {
+            ResultValue row[TELLER_COLUMNS];                 /** in the order of tellerColumns */
+            int64_t ints[] = { (int64_t) job.fingerprint, job.scenario, job.replication, (int64_t) job.masterSeed, job.substream,
+                               job.antithetic, sim.getTellerCount() };
+            for(int c = 0; c < 7; c++)
+                row[c].i = ints[c];
+            for(int t = 0; t < sim.getTellerCount(); t++) {
+                const TellerTotals &totals = sim.getTellerTotals(t);
+                row[7].i = t;
+                row[8].d = sim.getQueueLengthStats(t)->timeAvg(sim.now());
+                row[9].d = sim.getUtilization(t);
+                row[10].i = totals.served;
+                row[11].d = totals.served > 0 ? totals.delaySum / totals.served : 0;
+                row[12].i = totals.jockeysIn;
+                addRow(TELLER_TABLE, row);
+            }
+        }
+
+        /** writes out the rows left and closes the file. false if any of them could not be written */
+        bool close() {
+            if(!file)
+                return true;
+            {
+                lock_guard<mutex> guard(lock);
+                for(int t = 0; t < RESULT_TABLES; t++) {
+                    if(current[t] && current[t]->rows > 0)
+                        full.push_back(current[t]);
+                    else if(current[t])
+                        empty.push_back(current[t]);
+                    current[t] = NULL;
+                }
+                closing = true;
+                changed.notify_all();
+            }
+            writer.join();
+            bool ok = !failed && fclose(file) == 0;
+            file = NULL;
+            for(size_t i = 0; i < chunks.size(); i++)
+                delete chunks[i];
+            chunks.clear();
+            empty.clear();
+            return ok;
+        }
+
+    private:
+        ResultWriter(const ResultWriter &);
+        ResultWriter &operator = (const ResultWriter &);
+};
+
+
+/** one chunk of a mapped result file */
+struct ResultChunkView {
+    int table;
+    size_t rows;
+    const ResultValue *values;
+
+    inline const ResultValue *column(int c) const      { return values + c * rows; }
+};
+
+/** read only view of a result file, mapped into memory. a chunk cut short at the end is left out */
+class ResultReader {
+
+        void *mapping;
+        size_t mappingSize;
+        vector<ResultChunkView> chunks;
+
+    public:
+        ResultReader() {
+            mapping = NULL;
+            mappingSize = 0;
+        }
+
+        ~ResultReader() {
+            close();
+        }
+
+        bool open(const char *path, string &error) {
+            close();
+            int fd = ::open(path, O_RDONLY);
+            if(fd < 0) {
+                error = string("cannot open result file ") + path;
+                return false;
+            }
+            struct stat info;
+            if(fstat(fd, &info) != 0 || (size_t) info.st_size < sizeof(ResultFileHeader)) {
+                ::close(fd);
+                error = string(path) + " is not a result file";
+                return false;
+            }
+            mappingSize = info.st_size;
+            mapping = mmap(NULL, mappingSize, PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            if(mapping == MAP_FAILED) {
+                mapping = NULL;
+                error = string("cannot map result file ") + path;
+                return false;
+            }
+
+            const char *p = (const char *) mapping, *end = p + mappingSize;
+            const ResultFileHeader *header = (const ResultFileHeader *) p;
+            bool ok = memcmp(header->magic, RESULT_FILE_MAGIC, sizeof(header->magic)) == 0 && header->version == RESULT_FILE_VERSION &&
+                      header->tables == RESULT_TABLES;
+            p += sizeof(ResultFileHeader);
+            for(int t = 0; ok && t < RESULT_TABLES; t++) {
+                const ResultSchemaHeader *schema = (const ResultSchemaHeader *) p;
+                size_t columns = resultColumnCount(t);
+                ok = end - p >= (ptrdiff_t) (sizeof(ResultSchemaHeader) + columns * sizeof(ResultColumn)) && schema->table == (uint32_t) t &&
+                     schema->columns == columns && memcmp(schema + 1, resultColumns(t), columns * sizeof(ResultColumn)) == 0;
+                p += sizeof(ResultSchemaHeader) + columns * sizeof(ResultColumn);
+            }
+            if(!ok) {
+                close();
+                error = string(path) + " is not a result file of this version";
+                return false;
+            }
+
+            while(end - p >= (ptrdiff_t) sizeof(ResultChunkHeader)) {
+                const ResultChunkHeader *chunk = (const ResultChunkHeader *) p;
+                if(memcmp(chunk->magic, "CHNK", 4) != 0 || chunk->table >= RESULT_TABLES || chunk->rows > mappingSize)
+                    break;
+                size_t bytes = chunk->rows * resultColumnCount(chunk->table) * sizeof(ResultValue);
+                if((size_t) (end - p) - sizeof(ResultChunkHeader) < bytes)
+                    break;
+                ResultChunkView view = { (int) chunk->table, (size_t) chunk->rows, (const ResultValue *) (chunk + 1) };
+                chunks.push_back(view);
+                p += sizeof(ResultChunkHeader) + bytes;
+            }
+            madvise(mapping, mappingSize, MADV_SEQUENTIAL);
+            return true;
+        }
+
+        void close() {
+            if(mapping)
+                munmap(mapping, mappingSize);
+            mapping = NULL;
+            mappingSize = 0;
+            chunks.clear();
+        }
+
+        inline size_t size()                                    { return chunks.size(); }
+        inline const ResultChunkView &operator[](size_t i)      { return chunks[i]; }
+
+        /** rows of the table over all chunks */
+        size_t rows(int table) {
+            size_t n = 0;
+            for(size_t i = 0; i < chunks.size(); i++)
+                if(chunks[i].table == table)
+                    n += chunks[i].rows;
+            return n;
+        }
+
+    private:
+        ResultReader(const ResultReader &);
+        ResultReader &operator = (const ResultReader &);
+};
@@ -0,0 +1,249 @@
+/** Reads result files (see results.h) written by ./simulator --results file, and merges the files of several
+    runs, such as workers that ran parts of a sweep in parallel, into one.
+
+    build:  g++ -std=c++11 -O2 -pthread -o resulttool resulttool.cpp
+    run:    ./resulttool --csv replications|tellers file...    the rows of a table as CSV, with a header line
+            ./resulttool --aggregate file...                   per grid point, across all the replications of
+                                                               all the files: mean delay and its 95% CI, mean
+                                                               queue length, utilization and jockeys
+            ./resulttool --merge out file...                   one file with the rows of all of them
+
+    A run that is made again, or a file merged twice, gives the same rows again. --aggregate and --merge keep the
+    first row of each replication (of each teller of it) and drop the others, which they count on stderr; a
+    replication is its grid point's fingerprint, its stream key, substream and antithetic flag (see results.h).
+    The grid points of --aggregate are told apart by their fingerprints and listed in the order they first come.
+
+    The CI of --aggregate is the confidence interval of the mean delay across the replications, one observation
+    per replication or, for a point run with antithetic pairs, per pair (the mean of its two rows, matched on
+    stream key and substream), as ReplicationRunner::acrossReplications() takes it. It is what the simulator's
+    table shows with common random numbers, antithetic pairs or --precision, not the average of the per run
+    intervals of its default table, which is much narrower. Reps counts the replication rows, Obs the
+    observations of the interval; a pair missing one of its rows is left out of the interval. */
+
+#define SIMULATOR_NO_MAIN
+#include "simulator.cpp"
+
+#include <map>
+#include <set>
+
+
+static void printCsv(int table, ResultReader &reader) {
+    const ResultColumn *columns = resultColumns(table);
+    int count = resultColumnCount(table);
+    for(size_t k = 0; k < reader.size(); k++) {
+        const ResultChunkView &chunk = reader[k];
+        if(chunk.table != table)
+            continue;
+        for(size_t row = 0; row < chunk.rows; row++)
+            for(int c = 0; c < count; c++) {
+                ResultValue v = chunk.column(c)[row];
+                if(columns[c].type == RESULT_DOUBLE)
+                    printf("%.17g%c", v.d, c + 1 < count ? ',' : '\n');
+                else if(strcmp(columns[c].name, "stream_key") == 0 || strcmp(columns[c].name, "fingerprint") == 0)
+                    printf("%llu%c", (unsigned long long) v.i, c + 1 < count ? ',' : '\n');
+                else
+                    printf("%lld%c", (long long) v.i, c + 1 < count ? ',' : '\n');
+            }
+    }
+}
+
+
+/** what tells the rows of a table apart: the replication, and the teller for teller rows (-1 for replication rows) */
+struct RowKey {
+    int64_t fingerprint;
+    int64_t streamKey;
+    int64_t substream;
+    int64_t antithetic;
+    int64_t teller;
+
+    bool operator < (const RowKey &o) const {
+        if(fingerprint != o.fingerprint)    return fingerprint < o.fingerprint;
+        if(streamKey != o.streamKey)        return streamKey < o.streamKey;
+        if(substream != o.substream)        return substream < o.substream;
+        if(antithetic != o.antithetic)      return antithetic < o.antithetic;
+        return teller < o.teller;
+    }
+};
+
+/** the key of row r of the chunk */
+static RowKey rowKeyOf(const ResultChunkView &chunk, size_t r) {
+    static const char *names[] = { "fingerprint", "stream_key", "substream", "antithetic", "teller" };
+    int64_t values[5];
+    for(int c = 0; c < 5; c++) {
+        int column = resultColumnOf(chunk.table, names[c]);
+        values[c] = column < 0 ? -1 : chunk.column(column)[r].i;
+    }
+    RowKey key = { values[0], values[1], values[2], values[3], values[4] };
+    return key;
+}
+
+/** a grid point, as the parameters its first row carries, and the totals of its replications */
+struct PointTotals {
+    int64_t fingerprint;
+    int64_t tellers;
+    double interArrivalMean;
+    double serviceMean;
+    double horizon;
+    int64_t jockeying;
+    int64_t routing;
+    bool antithetic;                 /** some of its rows are the antithetic halves of pairs */
+    map<pair<int64_t, int64_t>, pair<double, int> > delays;  /** (stream key, substream) to the sum of the mean
+                                                                  delays of its rows and their number */
+    long long replications;
+    double queueLength;
+    double utilization;
+    long long jockeys;
+
+    PointTotals() : antithetic(false), replications(0), queueLength(0), utilization(0), jockeys(0) { }
+};
+
+
+int main(int argc, char **argv) {
+
+    string mode = argc > 2 ? argv[1] : "";
+    string table = argc > 3 ? argv[2] : "";
+    bool csv = mode == "--csv" && (table == "replications" || table == "tellers");
+    if(!((csv && argc > 3) || (mode == "--aggregate" && argc > 2) || (mode == "--merge" && argc > 3))) {
+        cerr << "usage: " << argv[0] << " --csv replications|tellers file..." << endl
+             << "       " << argv[0] << " --aggregate file..." << endl
+             << "       " << argv[0] << " --merge out file..." << endl;
+        return 1;
+    }
+
+    string error;
+    int first = mode == "--aggregate" ? 2 : 3;
+
+    /** the merged file is written beside the output and renamed into place, so the output may be one of the inputs */
+    if(mode == "--merge") {
+        string temporary = string(argv[2]) + ".tmp";
+        remove(temporary.c_str());
+        ResultWriter writer;
+        if(!writer.open(temporary, error)) {
+            cerr << error << endl;
+            return 1;
+        }
+        long long rows[RESULT_TABLES] = { 0, 0 }, duplicates = 0;
+        set<RowKey> seen;
+        for(int f = first; f < argc; f++) {
+            ResultReader reader;
+            if(!reader.open(argv[f], error)) {
+                cerr << error << endl;
+                return 1;
+            }
+            ResultValue row[REPLICATION_COLUMNS];
+            for(size_t k = 0; k < reader.size(); k++) {
+                const ResultChunkView &chunk = reader[k];
+                for(size_t r = 0; r < chunk.rows; r++) {
+                    if(!seen.insert(rowKeyOf(chunk, r)).second) {
+                        duplicates++;
+                        continue;
+                    }
+                    for(int c = 0; c < resultColumnCount(chunk.table); c++)
+                        row[c] = chunk.column(c)[r];
+                    writer.addRow(chunk.table, row);
+                    rows[chunk.table]++;
+                }
+            }
+        }
+        if(!writer.close() || rename(temporary.c_str(), argv[2]) != 0) {
+            cerr << "cannot write result file " << argv[2] << endl;
+            remove(temporary.c_str());
+            return 1;
+        }
+        printf("%s:\t%lld replication rows, %lld teller rows from %d files\n", argv[2], rows[REPLICATION_TABLE], rows[TELLER_TABLE],
+               argc - first);
+        if(duplicates > 0)
+            cerr << duplicates << " duplicate rows dropped" << endl;
+        return 0;
+    }
+
+    if(csv) {
+        int t = table == "replications" ? REPLICATION_TABLE : TELLER_TABLE;
+        for(int c = 0; c < resultColumnCount(t); c++)
+            printf("%s%c", resultColumns(t)[c].name, c + 1 < resultColumnCount(t) ? ',' : '\n');
+        for(int f = first; f < argc; f++) {
+            ResultReader reader;
+            if(!reader.open(argv[f], error)) {
+                cerr << error << endl;
+                return 1;
+            }
+            printCsv(t, reader);
+        }
+        return 0;
+    }
+
+    /** one pass over the replication rows, chunk by chunk; only the running totals of each point are kept, the
+        mean delay of each replication until its pair is known, and the keys of the rows seen */
+    int columns[10];
+    const char *names[] = { "tellers", "inter_arrival_mean", "service_mean", "horizon", "jockeying", "routing",
+                            "avg_delay", "avg_queue_length", "utilization", "jockeys" };
+    for(int c = 0; c < 10; c++)
+        columns[c] = resultColumnOf(REPLICATION_TABLE, names[c]);
+    map<int64_t, PointTotals> points;    /** by fingerprint */
+    vector<int64_t> order;               /** the fingerprints as they first came */
+    set<RowKey> seen;
+    long long duplicates = 0;
+    for(int f = first; f < argc; f++) {
+        ResultReader reader;
+        if(!reader.open(argv[f], error)) {
+            cerr << error << endl;
+            return 1;
+        }
+        for(size_t k = 0; k < reader.size(); k++) {
+            const ResultChunkView &chunk = reader[k];
+            if(chunk.table != REPLICATION_TABLE)
+                continue;
+            for(size_t r = 0; r < chunk.rows; r++) {
+                RowKey key = rowKeyOf(chunk, r);
+                if(!seen.insert(key).second) {
+                    duplicates++;
+                    continue;
+                }
+                PointTotals &totals = points[key.fingerprint];
+                if(totals.replications++ == 0) {
+                    order.push_back(key.fingerprint);
+                    totals.fingerprint = key.fingerprint;
+                    totals.tellers = chunk.column(columns[0])[r].i;
+                    totals.interArrivalMean = chunk.column(columns[1])[r].d;
+                    totals.serviceMean = chunk.column(columns[2])[r].d;
+                    totals.horizon = chunk.column(columns[3])[r].d;
+                    totals.jockeying = chunk.column(columns[4])[r].i;
+                    totals.routing = chunk.column(columns[5])[r].i;
+                }
+                pair<double, int> &delay = totals.delays[make_pair(key.streamKey, key.substream)];
+                delay.first += chunk.column(columns[6])[r].d;
+                delay.second++;
+                totals.antithetic = totals.antithetic || key.antithetic;
+                totals.queueLength += chunk.column(columns[7])[r].d;
+                totals.utilization += chunk.column(columns[8])[r].d;
+                totals.jockeys += chunk.column(columns[9])[r].i;
+            }
+        }
+    }
+
+    if(duplicates > 0)
+        cerr << duplicates << " duplicate rows dropped" << endl;
+    printf("Fingerprint\t\tIAT mean\tSvc mean\tHorizon\t\tJockey\tRouting\t\t#tellers\tReps\tObs\tAvg q len\tAvg delay\tCI low\t\tCI high\t\tUtilization\tJockeys/rep\n");
+    long long unpaired = 0;
+    for(size_t p = 0; p < order.size(); p++) {
+        PointTotals &totals = points[order[p]];
+        AvgGenerator observations;
+        for(map<pair<int64_t, int64_t>, pair<double, int> >::iterator d = totals.delays.begin(); d != totals.delays.end(); d++) {
+            if(totals.antithetic && d->second.second < 2)
+                unpaired++;
+            else
+                observations.pushData(d->second.first / d->second.second);
+        }
+        long long n = totals.replications;
+        double mean = observations.avg(), halfWidth = observations.getConfidenceIntervalRange();
+        printf("%016llx\t%-10g\t%-10g\t%-10g\t%s\t%-10s\t%lld\t\t%lld\t%lld\t%-10.6f\t%-10.6f\t%-10.6f\t%-10.6f\t%-10.6f\t%-10.2f\n",
+               (unsigned long long) totals.fingerprint, totals.interArrivalMean, totals.serviceMean, totals.horizon,
+               totals.jockeying ? "on" : "off", routingName((RoutingKind) totals.routing), (long long) totals.tellers, n,
+               (long long) observations.getSampleCount(), totals.queueLength / n, mean, mean - halfWidth, mean + halfWidth,
+               totals.utilization / n, (double) totals.jockeys / n);
+    }
+    if(unpaired > 0)
+        cerr << unpaired << " antithetic rows without their pair left out of the intervals" << endl;
+    return 0;
+
+}
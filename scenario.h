@@ -0,0 +1,136 @@
+/** Runtime scenario configuration. A ScenarioGrid holds a list of values for every parameter of the bank and
+    expands into the cartesian product of them, one Scenario per grid point, all run in a single process.
+    Parameters come from a scenario file and/or the command line, the command line winning:
+
+        # scenario file: one "key = value" per line, lists separated by commas,
+        # integer ranges as first:last or first:last:step
+        tellers            = 4:9
+        inter_arrival_mean = 1.0, 0.8
+        service_mean       = 4.5
+        horizon            = 480
+        replications       = 100
+        jockeying          = on, off
+        routing            = shortest, jiq, power_of_d, shared   # see kernels.h
+        choices            = 2            # d of power_of_d
+        jockey_threshold   = 2            # a customer jockeys to a teller with this many fewer customers
+        jockey_distance    = 0            # from at most this many tellers away, 0: any
+        balk_at            = 0            # arrivals who would find this many waiting leave, 0: nobody balks
+        patience_mean      = 0            # waiting customers leave after an exponential patience, 0: never
+        queue_capacity     = 0            # customers waiting per teller at most, more are lost; bounds the
+                                          # memory of a run, 0: no bound
+        service_distribution = exponential  # or lognormal:cv, gamma:k, empirical:file, see distributions.h
+        arrival_distribution = exponential
+        arrival_profile    = 0:0.5, 120:1.5, 240:0.8   # arrival rate x0.5 from time 0, x1.5 from 120, ...
+        threads            = 8
+        batch              = 16           # replications of a grid point run side by side in one engine, up
+                                          # to 8 tellers; 0 (the default): off
+        seed               = 20140921
+        event_list         = heap
+        quantiles          = off
+        trace              = run.trace    # binary event trace of the first replication of the first grid point
+        replay             = branch.replay  # recorded arrivals and service times instead of random ones
+        crn                = off          # common random numbers across the grid points
+        antithetic         = off          # antithetic pairs of replications
+        precision          = 0.05         # add replications until the 95% CI of the mean delay is within +-5%,
+                                          # up to the replications above
+        steady_state       = off          # one long run per grid point, batch means after an MSER-5 warm-up
+        metrics            = run.jsonl    # live event loop metrics, see metrics.h
+        metrics_format     = json         # or prometheus
+        metrics_interval   = 1            # seconds between snapshots
+        checkpoint         = run.snap     # snapshot of the first replication of the first grid point, see checkpoint.h
+        checkpoint_every   = 10000        # minutes of simulated time between checkpoints
+        start_from         = run.snap     # every run goes on from this snapshot instead of an empty bank; with
+                                          # more tellers the new ones open at the snapshot time
+        fresh_statistics   = off          # runs from a snapshot report only what happens after it
+        branches           = 1            # > 1: a ring of branches, balking customers go on to the next one,
+                                          # see network.h
+        transfer_time      = 1            # minutes to the next branch
+        max_transfers      = 1            # times a customer goes on before balking for good
+        shards             = 0            # threads or processes the branches are spread over, 0: one per core
+        shard_transport    = threads      # or sockets: a child process per shard
+        split_levels       = 10, 20, 30, 40, 50   # estimate P(total queue length reaches 50) by importance
+                                          # splitting at these levels instead, see splitting.h
+        split_effort       = 1000         # runs per level
+        cache              = results.cache  # directory of cached replication results, see resultcache.h
+        results            = run.results  # rows of every replication and teller appended here, see results.h
+
+    on the command line the same keys are written as --key value (dashes or underscores), and --scenario file
+    reads a scenario file at that point. Unset parameters keep the defaults from simulator.h. */
+
+/** one point of the grid */
+struct Scenario {
+    int numTellers;
+    t_simtime interArrivalTimeMean;
+    t_simtime serviceTimeMean;
+    t_simtime horizon;
+    int replications;
+    bool jockeying;
+    RoutingKind routing;
+};
+
+class ScenarioGrid {
+
+        vector<int> tellers;
+        vector<double> interArrivalTimeMeans;
+        vector<double> serviceTimeMeans;
+        vector<double> horizons;
+        vector<int> replications;
+        vector<bool> jockeying;
+        vector<RoutingKind> routings;
+
+        static bool parseInts(const string &text, vector<int> &values);
+        static bool parseDoubles(const string &text, vector<double> &values);
+        static bool parseSeed(const string &text, uint64_t &value);     /** a single decimal number that fits */
+        static bool parseSwitches(const string &text, vector<bool> &values);
+        static bool parseRoutings(const string &text, vector<RoutingKind> &values);
+
+    public:
+        int threads;                     /** 0 means one per core */
+        int batchLanes;                  /** replications run side by side, see batch.h. 0 or 1: none */
+        uint64_t masterSeed;
+        EventListKind eventList;
+        bool delayQuantiles;
+        QueuePolicy policy;              /** all but the routing, which is part of the grid */
+        Distribution serviceDistribution;    /** shapes, scaled by the means of the grid, see distributions.h */
+        Distribution arrivalDistribution;
+        ArrivalProfile arrivalProfile;   /** empty: constant arrival rate */
+        string traceFile;                /** empty: no trace */
+        string replayFile;               /** empty: random arrivals and service times */
+        bool commonRandomNumbers;        /** see ReplicationPlan */
+        bool antithetic;
+        double relativePrecision;        /** 0: run all replications */
+        bool steadyState;                /** one run per grid point, see steadystate.h */
+        string metricsFile;              /** empty: no instrumentation */
+        MetricsFormat metricsFormat;
+        double metricsInterval;          /** seconds */
+        string checkpointFile;           /** empty: no checkpoints */
+        t_simtime checkpointEvery;
+        string startFromFile;            /** empty: runs start from an empty bank */
+        SimulatorSnapshot startFrom;
+        bool freshStatistics;
+        int branches;                    /** 1: a single bank, else a network, see network.h */
+        t_simtime transferTime;
+        int maxTransfers;
+        int shards;                      /** 0 means one per core */
+        ShardTransport shardTransport;
+        SplittingPlan splitting;         /** no levels: ordinary runs */
+        string cacheDirectory;           /** empty: no result cache */
+        string resultsFile;              /** empty: only the table */
+
+        ScenarioGrid();
+
+        bool set(const string &key, const string &value, string &error);   /** one parameter, false with a message on a bad key or value */
+        bool parseFile(const char *path, string &error);
+        bool parseArgs(int argc, char **argv, string &error);
+
+        vector<Scenario> expand();       /** tellers vary fastest, so the default grid reads like the old table */
+        bool varies(const string &key);  /** more than one value given for this parameter */
+
+        inline const vector<int> &getTellers()              { return tellers; }
+        inline const vector<double> &getInterArrivalMeans() { return interArrivalTimeMeans; }
+        inline const vector<double> &getServiceMeans()      { return serviceTimeMeans; }
+        inline const vector<double> &getHorizons()          { return horizons; }
+        inline const vector<int> &getReplications()         { return replications; }
+        inline const vector<bool> &getJockeying()           { return jockeying; }
+        inline const vector<RoutingKind> &getRoutings()     { return routings; }
+};
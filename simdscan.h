@@ -0,0 +1,190 @@
+/** Vectorized scans over the contiguous per teller int32 arrays (see kernels.h). Each scan has an AVX2, an SSE4.1
+    and a scalar version giving the same answer; the best one the CPU supports is picked once, at startup.
+
+        firstEqual(a, n, value)          leftmost i with a[i] == value, -1 if none
+        argMin(a, n)                     leftmost i with the smallest a[i]
+        firstAbove(a, from, n, t)        leftmost i in [from, n) with a[i] > t, -1 if none
+        lastAbove(a, to, t)              rightmost i in [0, to] with a[i] > t, -1 if none
+
+    benchmark.cpp cross-checks every version against the scalar one on random inputs. */
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SIMD_SCAN_X86
+#endif
+
+struct ScanKernels {
+    const char *name;
+    int (*firstEqual)(const int32_t *a, int n, int32_t value);
+    int (*argMin)(const int32_t *a, int n);
+    int (*firstAbove)(const int32_t *a, int from, int n, int32_t threshold);
+    int (*lastAbove)(const int32_t *a, int to, int32_t threshold);
+};
+
+
+/** scalar */
+
+static int firstEqualScalar(const int32_t *a, int n, int32_t value) {
+    for(int i = 0; i < n; i++)
+        if(a[i] == value)
+            return i;
+    return -1;
+}
+
+static int argMinScalar(const int32_t *a, int n) {
+    int best = 0;
+    for(int i = 1; i < n; i++)
+        if(a[i] < a[best])
+            best = i;
+    return best;
+}
+
+static int firstAboveScalar(const int32_t *a, int from, int n, int32_t threshold) {
+    for(int i = from; i < n; i++)
+        if(a[i] > threshold)
+            return i;
+    return -1;
+}
+
+static int lastAboveScalar(const int32_t *a, int to, int32_t threshold) {
+    for(int i = to; i >= 0; i--)
+        if(a[i] > threshold)
+            return i;
+    return -1;
+}
+
+
+#ifdef SIMD_SCAN_X86
+
+/** SSE4.1, 4 lanes */
+
+__attribute__((target("sse4.1")))
+static int firstEqualSse(const int32_t *a, int n, int32_t value) {
+    __m128i v = _mm_set1_epi32(value);
+    int i = 0;
+    for(; i + 4 <= n; i += 4) {
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *) (a + i)), v)));
+        if(mask)
+            return i + __builtin_ctz(mask);
+    }
+    for(; i < n; i++)
+        if(a[i] == value)
+            return i;
+    return -1;
+}
+
+__attribute__((target("sse4.1")))
+static int argMinSse(const int32_t *a, int n) {
+    __m128i least = _mm_set1_epi32(INT_MAX);
+    int i = 0;
+    for(; i + 4 <= n; i += 4)
+        least = _mm_min_epi32(least, _mm_loadu_si128((const __m128i *) (a + i)));
+    least = _mm_min_epi32(least, _mm_shuffle_epi32(least, _MM_SHUFFLE(1, 0, 3, 2)));
+    least = _mm_min_epi32(least, _mm_shuffle_epi32(least, _MM_SHUFFLE(2, 3, 0, 1)));
+    int32_t m = _mm_cvtsi128_si32(least);
+    for(; i < n; i++)
+        m = a[i] < m ? a[i] : m;
+    return firstEqualSse(a, n, m);
+}
+
+__attribute__((target("sse4.1")))
+static int firstAboveSse(const int32_t *a, int from, int n, int32_t threshold) {
+    __m128i t = _mm_set1_epi32(threshold);
+    int i = from;
+    for(; i + 4 <= n; i += 4) {
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(_mm_loadu_si128((const __m128i *) (a + i)), t)));
+        if(mask)
+            return i + __builtin_ctz(mask);
+    }
+    return firstAboveScalar(a, i, n, threshold);
+}
+
+__attribute__((target("sse4.1")))
+static int lastAboveSse(const int32_t *a, int to, int32_t threshold) {
+    __m128i t = _mm_set1_epi32(threshold);
+    int end = to + 1;                /** scan [end - 4, end) blocks downwards */
+    for(; end >= 4; end -= 4) {
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(_mm_loadu_si128((const __m128i *) (a + end - 4)), t)));
+        if(mask)
+            return end - 4 + 31 - __builtin_clz(mask);
+    }
+    return lastAboveScalar(a, end - 1, threshold);
+}
+
+
+/** AVX2, 8 lanes */
+
+__attribute__((target("avx2")))
+static int firstEqualAvx2(const int32_t *a, int n, int32_t value) {
+    __m256i v = _mm256_set1_epi32(value);
+    int i = 0;
+    for(; i + 8 <= n; i += 8) {
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *) (a + i)), v)));
+        if(mask)
+            return i + __builtin_ctz(mask);
+    }
+    for(; i < n; i++)
+        if(a[i] == value)
+            return i;
+    return -1;
+}
+
+__attribute__((target("avx2")))
+static int argMinAvx2(const int32_t *a, int n) {
+    __m256i least = _mm256_set1_epi32(INT_MAX);
+    int i = 0;
+    for(; i + 8 <= n; i += 8)
+        least = _mm256_min_epi32(least, _mm256_loadu_si256((const __m256i *) (a + i)));
+    __m128i half = _mm_min_epi32(_mm256_castsi256_si128(least), _mm256_extracti128_si256(least, 1));
+    half = _mm_min_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(1, 0, 3, 2)));
+    half = _mm_min_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(2, 3, 0, 1)));
+    int32_t m = _mm_cvtsi128_si32(half);
+    for(; i < n; i++)
+        m = a[i] < m ? a[i] : m;
+    return firstEqualAvx2(a, n, m);
+}
+
+__attribute__((target("avx2")))
+static int firstAboveAvx2(const int32_t *a, int from, int n, int32_t threshold) {
+    __m256i t = _mm256_set1_epi32(threshold);
+    int i = from;
+    for(; i + 8 <= n; i += 8) {
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_loadu_si256((const __m256i *) (a + i)), t)));
+        if(mask)
+            return i + __builtin_ctz(mask);
+    }
+    return firstAboveScalar(a, i, n, threshold);
+}
+
+__attribute__((target("avx2")))
+static int lastAboveAvx2(const int32_t *a, int to, int32_t threshold) {
+    __m256i t = _mm256_set1_epi32(threshold);
+    int end = to + 1;
+    for(; end >= 8; end -= 8) {
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_loadu_si256((const __m256i *) (a + end - 8)), t)));
+        if(mask)
+            return end - 8 + 31 - __builtin_clz(mask);
+    }
+    return lastAboveScalar(a, end - 1, threshold);
+}
+
+#endif
+
+
+static const ScanKernels SCALAR_SCAN_KERNELS = { "scalar", firstEqualScalar, argMinScalar, firstAboveScalar, lastAboveScalar };
+
+#ifdef SIMD_SCAN_X86
+static const ScanKernels SSE_SCAN_KERNELS = { "sse4.1", firstEqualSse, argMinSse, firstAboveSse, lastAboveSse };
+static const ScanKernels AVX2_SCAN_KERNELS = { "avx2", firstEqualAvx2, argMinAvx2, firstAboveAvx2, lastAboveAvx2 };
+#endif
+
+/** the fastest kernels this CPU runs */
+inline const ScanKernels &scanKernels() {
+#ifdef SIMD_SCAN_X86
+    static const ScanKernels &best = __builtin_cpu_supports("avx2") ? AVX2_SCAN_KERNELS :
+                                     __builtin_cpu_supports("sse4.1") ? SSE_SCAN_KERNELS : SCALAR_SCAN_KERNELS;
+    return best;
+#else
+    return SCALAR_SCAN_KERNELS;
+#endif
+}
@@ -1,142 +1,540 @@
 #include "simulator.h"
 
-Simulator::Simulator(int N) {
-
-    this->N = N;
-    eventQueue =  new priority_queue <Event*, vector <Event*>, CompareEvent> ();
-
-    Q = new deque<Customer*>*[N];
-    for(int i = 0; i < N; i++)
-        Q[i] = new deque<Customer*>();
-
-    serverBusy = new bool[N];
-    customerBeingServed = new Customer*[N];
-    for(int i = 0; i < N; i++) {
-        serverBusy[i] = false;
-        customerBeingServed[i] = NULL;
-    }
-
-    customerIdRecord = 0;
-
-    serviceTimeStream = new RandomStream(SERVICE_TIME_MEAN);
-    interArrivalTimeStream = new RandomStream(INTER_ARRIVAL_TIME_MEAN);
-
+Simulator::Simulator(int N, uint64_t masterSeed, uint32_t substream, EventListKind eventListKind,
+                     t_simtime interArrivalTimeMean, t_simtime serviceTimeMean) {
+
+    this->N = 0;
+    this->eventListKind = eventListKind;
+    eventQueue =  new priority_queue <Event*, vector <Event*>, CompareEvent> ();
+    Q = NULL;
+    tellerState = NULL;
+    queueLength = NULL;
+    serverBusy = NULL;
+    tellerLoad = NULL;
+    customerBeingServed = NULL;
+    tellerIndex = NULL;
+    trace = NULL;
+    replay = NULL;
+    steadyState = NULL;
+    metrics = NULL;
+    serviceDistribution = NULL;
+    arrivalDistribution = NULL;
+    arrivalProfile = NULL;
+    timeAvg = NULL;
+    tellerTotals = NULL;
+    avg = new AvgGenerator();
+    serviceTimeStream = NULL;
+    interArrivalTimeStream = NULL;
+    customerServiceStream = NULL;
+    patienceStream = NULL;
+    routingEngine = NULL;
+    thinningEngine = NULL;
+    outbox = NULL;
+    branch = 0;
+    branches = 1;
+    transferTime = 0;
+    maxTransfers = 0;
+    jockeying = true;
+    policy = defaultQueuePolicy();
+    synchronizedService = false;
+
+    reset(N, masterSeed, substream, interArrivalTimeMean, serviceTimeMean);
+
+}
+
+
+void Simulator::allocateTellers(int N) {
+
+    this->N = N;
+
+    Q = new CustomerQueue*[N];
+    for(int i = 0; i < N; i++)
+        Q[i] = new CustomerQueue();
+
+    /** queue lengths, busy flags and their sums side by side in one block, see kernels.h */
+    tellerState = new int32_t[3 * N];
+    queueLength = tellerState;
+    serverBusy = tellerState + N;
+    tellerLoad = tellerState + 2 * N;
+    customerBeingServed = new t_customer[N];
+
+    tellerIndex = N >= TELLER_INDEX_MIN_TELLERS ? new TellerIndex(N) : NULL;
+
+    timeAvg = new TimeAvgGenerator[N];
+    tellerTotals = new TellerTotals[N];
+
+    serviceTimeStream = new RandomStream*[N];
+    for(int i = 0; i < N; i++)
+        serviceTimeStream[i] = new RandomStream(SERVICE_TIME_MEAN, 0, 0, SERVICE_STREAM(i));
+    interArrivalTimeStream = new RandomStream(INTER_ARRIVAL_TIME_MEAN, 0, 0, ARRIVAL_STREAM);
+    customerServiceStream = new RandomStream(SERVICE_TIME_MEAN, 0, 0, CUSTOMER_SERVICE_STREAM);
+    patienceStream = new RandomStream(1.0, 0, 0, PATIENCE_STREAM);
+    routingEngine = new StreamEngine(0, 0, ROUTING_STREAM);
+    thinningEngine = new StreamEngine(0, 0, THINNING_STREAM);
+
+}
+
+
+void Simulator::releaseTellers() {
+
+    for(int i = 0; i < N; i++)
+        delete Q[i];
+    delete [] Q;
+    delete [] tellerState;
+    delete [] customerBeingServed;
+    delete tellerIndex;
+    delete [] timeAvg;
+    delete [] tellerTotals;
+    for(int i = 0; i < N; i++)
+        delete serviceTimeStream[i];
+    delete [] serviceTimeStream;
+    delete interArrivalTimeStream;
+    delete customerServiceStream;
+    delete patienceStream;
+    delete routingEngine;
+    delete thinningEngine;
+    N = 0;
+
+}
+
+
+void Simulator::reset(int N, uint64_t masterSeed, uint32_t substream, t_simtime interArrivalTimeMean, t_simtime serviceTimeMean,
+                      bool antithetic) {
+
+    /** the per teller arrays are only reallocated when the number of tellers changes. everything else keeps
+        its memory (event heap, customer slabs, queue rings) for the next run */
+    if(N != this->N) {
+        releaseTellers();
+        allocateTellers(N);
+    }
+
+    while(!eventQueue->empty()) {
+        delete eventQueue->top();
+        eventQueue->pop();
+    }
+    eventHeap.clear();
+    eventHeap.reserve(N + 2);
+    eventCount = 0;
+    restoredEvents = 0;
+
+    customers.clear();
+    for(int i = 0; i < N; i++) {
+        Q[i]->clear();
+        queueLength[i] = 0;
+        serverBusy[i] = false;
+        tellerLoad[i] = 0;
+        customerBeingServed[i] = NO_CUSTOMER;
+        timeAvg[i] = TimeAvgGenerator();
+        tellerTotals[i] = TellerTotals();
+        if(tellerIndex)
+            tellerIndex->update(i, 0, false);
+    }
+    totalQueueLength = TimeAvgGenerator();
+    reseed(masterSeed, substream, interArrivalTimeMean, serviceTimeMean, antithetic);
+    sharedQueue.clear();
+    balked = 0;
+    reneged = 0;
+    lost = 0;
+    transferred = 0;
+    received = 0;
+    transferSequence = 0;
+    runLimit = HUGE_VAL;
+    stopAtQueueLength = INT32_MAX;
+    avg->reset();
+
+    customerIdRecord = 0;
+    statisticsFromId = 0;
+    simclock = 0.0;
+    serviceEndsAt = 0.0;
+    arrivalAfterEnd = INVALID_TIME;
+
+}
+
+
+void Simulator::reseed(uint64_t masterSeed, uint32_t substream, t_simtime interArrivalTimeMean, t_simtime serviceTimeMean,
+                       bool antithetic) {
+    this->masterSeed = masterSeed;
+    this->substream = substream;
+    this->antithetic = antithetic;
+    this->interArrivalTimeMean = interArrivalTimeMean;
+    this->serviceTimeMean = serviceTimeMean;
+    for(int i = 0; i < N; i++)
+        *serviceTimeStream[i] = RandomStream(serviceTimeMean, masterSeed, substream, SERVICE_STREAM(i), antithetic, serviceDistribution);
+    /** under a profile the stream gives the candidates, at the peak rate */
+    t_simtime candidateMean = arrivalProfile ? interArrivalTimeMean / arrivalProfile->getPeak() : interArrivalTimeMean;
+    *interArrivalTimeStream = RandomStream(candidateMean, masterSeed, substream, ARRIVAL_STREAM, antithetic, arrivalDistribution);
+    *customerServiceStream = RandomStream(serviceTimeMean, masterSeed, substream, CUSTOMER_SERVICE_STREAM, antithetic, serviceDistribution);
+    *patienceStream = RandomStream(1.0, masterSeed, substream, PATIENCE_STREAM, antithetic);
+    *routingEngine = StreamEngine(masterSeed, substream, ROUTING_STREAM, antithetic);
+    *thinningEngine = StreamEngine(masterSeed, substream, THINNING_STREAM, antithetic);
+}
+
+
+bool Simulator::hasSeed(uint64_t masterSeed, uint32_t substream, t_simtime interArrivalTimeMean, t_simtime serviceTimeMean,
+                        bool antithetic) {
+    return this->masterSeed == masterSeed && this->substream == substream && this->antithetic == antithetic &&
+           this->interArrivalTimeMean == interArrivalTimeMean && this->serviceTimeMean == serviceTimeMean;
+}
+
+
+/** a bounded queue capacity allocates everything the run can need now, so that it never allocates again:
+    the queue rings, the customer slabs up to the limit, and the event list for one arrival, the end, a
+    departure per teller and a renege per customer */
+void Simulator::setPolicy(const QueuePolicy &policy) {
+    this->policy = policy;
+    size_t limit = customerLimit(N, policy);
+    customers.setLimit(limit);
+    if(policy.queueCapacity > 0) {
+        for(int i = 0; i < N; i++)
+            Q[i]->reserve(policy.queueCapacity);
+        if(policy.routing == SHARED_QUEUE_ROUTING)
+            sharedQueue.reserve(N * policy.queueCapacity);
+        if(eventListKind == HEAP_EVENT_LIST)
+            eventHeap.reserve(limit + N + 2);
+    }
+}
+
+
+size_t Simulator::customerLimit(int N, const QueuePolicy &policy) {
+    if(policy.queueCapacity <= 0)
+        return 0;
+    size_t bank = (size_t) N * (policy.queueCapacity + 1);
+    return policy.patienceMean > 0 ? 2 * bank : bank;
+}
+
+
+size_t Simulator::memoryCeiling(int N, const QueuePolicy &policy, bool delayQuantiles) {
+    size_t limit = customerLimit(N, policy);
+    if(limit == 0)
+        return 0;
+    size_t ring = 16;
+    while(ring < (size_t) policy.queueCapacity)
+        ring *= 2;
+    size_t sharedRing = 16;
+    while(policy.routing == SHARED_QUEUE_ROUTING && sharedRing < (size_t) N * policy.queueCapacity)
+        sharedRing *= 2;
+    size_t slabs = (limit + CUSTOMER_SLAB_SIZE - 1) / CUSTOMER_SLAB_SIZE;
+    size_t bytes = sizeof(Simulator) + sizeof(AvgGenerator) + (delayQuantiles ? sizeof(QuantileHistogram) : 0);
+    bytes += slabs * (CUSTOMER_SLAB_SIZE * sizeof(Customer) + sizeof(Customer *)) + limit * sizeof(t_customer);
+    bytes += N * (sizeof(CustomerQueue) + sizeof(CustomerQueue *) + ring * sizeof(t_customer)) + sharedRing * sizeof(t_customer);
+    bytes += (limit + N + 2) * sizeof(EventRecord);
+    bytes += N * (3 * sizeof(int32_t) + sizeof(t_customer) + sizeof(TimeAvgGenerator) + sizeof(TellerTotals) + sizeof(RandomStream) +
+                  sizeof(RandomStream *));
+    bytes += 3 * sizeof(RandomStream) + 2 * sizeof(StreamEngine);
+    if(N >= TELLER_INDEX_MIN_TELLERS)
+        bytes += TellerIndex::memory(N);
+    return bytes;
+}
+
+
+long long Simulator::getJockeyCount() {
+    long long jockeys = 0;
+    for(int i = 0; i < N; i++)
+        jockeys += tellerTotals[i].jockeysIn;
+    return jockeys;
+}
+
+
+double Simulator::getUtilization(int tellerId) {
+    t_simtime span = simclock - totalQueueLength.getStart();
+    double busy = tellerTotals[tellerId].busyTime;
+    if(serverBusy[tellerId])
+        busy += simclock - customers[customerBeingServed[tellerId]].serviceTimeStartsAt;
+    return span > 0 ? busy / span : 0;
+}
+
+
+double Simulator::getUtilization() {
+    double sum = 0;
+    for(int i = 0; i < N; i++)
+        sum += getUtilization(i);
+    return N > 0 ? sum / N : 0;
 }
 
 
 t_simtime Simulator::now() {
     return this->simclock;
-}
-
-
-int Simulator::getFreeTellerId() {
-    for(int i = 0; i < N; i++)
-        if(serverBusy[i] == false && Q[i]->empty())
-            return i;
-    return -1;
-}
-
-
-int Simulator::getShortestQuedTellerId() {
-    int tellerId_ = 0;
-    int leastCustomerCount = Q[0]->size();
-    for(int i = 1; i < N; i++) {
-        if(Q[i]->size() < leastCustomerCount) {
-            leastCustomerCount = Q[i]->size();
-            tellerId_ = i;
-        }
-    }
-    return tellerId_;
-}
-
-
-int Simulator::getJockeyableQueueId(int tellerId) {
-
-    int jumper = -1;
-    int minDistance = N * N;
-    int totalSizeOfThisTeller = Q[tellerId]->size();
-    serverBusy[tellerId] ? totalSizeOfThisTeller++ : totalSizeOfThisTeller += 0;
-
-    for(int otherTellerId = 0; otherTellerId < N; otherTellerId++) {
-
-        if(otherTellerId == tellerId)
-            continue;
-
-        int totalSizeOfOtherTeller = Q[otherTellerId]->size();
-        serverBusy[otherTellerId] ? totalSizeOfOtherTeller++ : totalSizeOfOtherTeller += 0;
-        int distance = abs(tellerId - otherTellerId);
-
-        if(otherTellerId != tellerId && distance < minDistance && totalSizeOfOtherTeller > totalSizeOfThisTeller + 1) {
-            jumper = otherTellerId;
-            minDistance = distance;
-        }
-
-    }
-
-    return jumper;
-
-}
-
-
-void Simulator::jockey(int tellerId) {
-
-    /** determine if there is customer to jockey. if no, then return immediately */
-    int jumperJockeysFrom = getJockeyableQueueId(tellerId);
-    if(jumperJockeysFrom == -1) {
-        return;
-    }
-
-    /** now, there is someone to jockey. remove this customer from the tail, add to this Q */
-    Customer *C = Q[jumperJockeysFrom]->back();
-    Q[jumperJockeysFrom]->pop_back();
-    timeAvg[jumperJockeysFrom]->pushData(Q[jumperJockeysFrom]->size(), now());
-    addCustomerToQueue(C, tellerId);
-
-    /** this customer will jockey to "tellerId". determine if the teller with
-        "tellerId" is free. if so, then add customer to service by calling
-        make server busy. else, put the customer at the end of the queue */
-    bool thisTellerBusy = this->serverBusy[tellerId];
-    if(!thisTellerBusy) {
-        makeServerBusy(tellerId);
-        t_simtime departureTime = now() + serviceTimeStream->next();
-        DepartureEvent *e = new DepartureEvent(departureTime, tellerId);
-        scheduleEvent(e);
-    }
-
+}
+
+
+int Simulator::getFreeTellerId() {
+    return TellerScan<0>::freeTeller(tellerView());
+}
+
+
+int Simulator::getShortestQuedTellerId() {
+    return TellerScan<0>::shortestQueue(tellerView());
+}
+
+
+int Simulator::getJockeyableQueueId(int tellerId) {
+    return NearestJockeying::source<0>(tellerView(), tellerId);
+}
+
+
+void Simulator::jockey(int tellerId) {
+    jockeyFrom(getJockeyableQueueId(tellerId), tellerId);
+}
+
+
+void Simulator::jockeyFrom(int jumperJockeysFrom, int tellerId) {
+
+    /** determine if there is customer to jockey. if no, then return immediately */
+    if(jumperJockeysFrom == -1) {
+        return;
+    }
+
+    /** now, there is someone to jockey. remove this customer from the tail, add to this Q */
+    t_customer C = Q[jumperJockeysFrom]->back();
+    Q[jumperJockeysFrom]->pop_back();
+    traceEvent(TRACE_JOCKEY, C, jumperJockeysFrom, tellerId);
+    tellerTotals[tellerId].jockeysIn++;
+    if(metrics)
+        metrics->jockeyed(tellerId);
+    tellerChanged(jumperJockeysFrom);
+    addCustomerToQueue(C, tellerId);
+
+    /** this customer will jockey to "tellerId". determine if the teller with
+        "tellerId" is free. if so, then add customer to service by calling
+        make server busy. else, put the customer at the end of the queue */
+    bool thisTellerBusy = this->serverBusy[tellerId];
+    if(!thisTellerBusy) {
+        makeServerBusy(tellerId);
+        scheduleDeparture(now() + serviceTimeAt(tellerId), tellerId);
+    }
+
+}
+
+
+/** the head of the shared queue goes to the queue of tellerId, which is empty, ready for makeServerBusy() */
+void Simulator::takeFromSharedQueue(int tellerId) {
+    int32_t length = sharedQueue.size();
+    t_customer C = sharedQueue.front();
+    sharedQueue.pop_front();
+    sharedQueueChanged(length);
+    addCustomerToQueue(C, tellerId);
 }
 
 
 void Simulator::scheduleEvent(Event *event) {
     this->eventQueue->push(event);
-}
+}
+
+
+void Simulator::scheduleArrival(t_simtime time) {
+    if(eventListKind == HEAP_EVENT_LIST)
+        eventHeap.push(time, ARRIVAL, -1);
+    else
+        scheduleEvent(new ArrivalEvent(time));
+}
+
+
+void Simulator::scheduleDeparture(t_simtime time, int tellerId) {
+    if(eventListKind == HEAP_EVENT_LIST)
+        eventHeap.push(time, DEPARTURE, tellerId);
+    else
+        scheduleEvent(new DepartureEvent(time, tellerId));
+}
+
+
+/** under a profile, candidates at the peak rate are thinned: one at time t is kept with probability
+    factor(t) / peak. a candidate after the end time ends the search, there will be no arrival */
+t_simtime Simulator::nextArrivalAfter(t_simtime time) {
+    return thinArrivals(time + interArrivalTimeStream->next());
+}
+
+
+t_simtime Simulator::thinArrivals(t_simtime time) {
+    if(arrivalProfile)
+        while(time <= serviceEndTime() && thinningEngine->nextUniform() * arrivalProfile->getPeak() > arrivalProfile->at(time))
+            time += interArrivalTimeStream->next();
+    return time;
+}
+
+
+void Simulator::scheduleRenege(t_simtime time, t_customer C) {
+    if(eventListKind == HEAP_EVENT_LIST)
+        eventHeap.push(time, RENEGE, (int32_t) C);
+    else
+        scheduleEvent(new RenegeEvent(time, C));
+}
+
+
+/** the jockeying policy for a routing policy. with a shared queue nobody waits at a teller, so nobody jockeys */
+template <class Routing>
+void Simulator::dispatchJockeying() {
+    if(jockeying && !Routing::sharedQueue)
+        dispatchKernel<Routing, NearestJockeying>();
+    else
+        dispatchKernel<Routing, NoJockeying>();
+}
+
+
+/** picks the compiled kernel for N tellers: one of the fixed size ones, or the generic one */
+template <class Routing, class Jockeying>
+void Simulator::dispatchKernel() {
+    switch(N) {
+        case 1:  runKernel<1, Routing, Jockeying>();  break;
+        case 2:  runKernel<2, Routing, Jockeying>();  break;
+        case 3:  runKernel<3, Routing, Jockeying>();  break;
+        case 4:  runKernel<4, Routing, Jockeying>();  break;
+        case 5:  runKernel<5, Routing, Jockeying>();  break;
+        case 6:  runKernel<6, Routing, Jockeying>();  break;
+        case 7:  runKernel<7, Routing, Jockeying>();  break;
+        case 8:  runKernel<8, Routing, Jockeying>();  break;
+        case 9:  runKernel<9, Routing, Jockeying>();  break;
+        case 10: runKernel<10, Routing, Jockeying>(); break;
+        case 11: runKernel<11, Routing, Jockeying>(); break;
+        case 12: runKernel<12, Routing, Jockeying>(); break;
+        case 13: runKernel<13, Routing, Jockeying>(); break;
+        case 14: runKernel<14, Routing, Jockeying>(); break;
+        case 15: runKernel<15, Routing, Jockeying>(); break;
+        case 16: runKernel<16, Routing, Jockeying>(); break;
+        default: runKernel<0, Routing, Jockeying>();  break;
+    }
+}
+
+
+template <int FIXED_N, class Routing, class Jockeying>
+inline void Simulator::processRecord(const EventRecord &event) {
+    switch(event.type) {
+        case ARRIVAL:   arrive<FIXED_N, Routing>();                             break;
+        case DEPARTURE: depart<FIXED_N, Routing, Jockeying>(event.tellerId);    break;
+        case RENEGE:    handleRenege((t_customer) event.tellerId);              break;
+        case TRANSFER:  transferIn<FIXED_N, Routing>((t_customer) event.tellerId); break;
+        case EXIT:                                                              break;
+    }
+}
 
 
-void Simulator::run() {
+template <int FIXED_N, class Routing, class Jockeying>
+void Simulator::runKernel() {
+    while(!eventHeap.empty() && eventHeap.top().time < runLimit) {
+        size_t depth = eventHeap.size();
+        EventRecord event = eventHeap.pop();
+        this->simclock = event.time;
+        eventCount++;
+        if(metrics && metrics->countEvent(event.type, depth, eventCount)) {
+            chrono::steady_clock::time_point started = chrono::steady_clock::now();
+            processRecord<FIXED_N, Routing, Jockeying>(event);
+            eventTimed(event.type, started);
+        }
+        else
+            processRecord<FIXED_N, Routing, Jockeying>(event);
+    }
+}
+
+
+/** one of the sampled events is done: its time, and the state of the bank for the live snapshots */
+void Simulator::eventTimed(int type, chrono::steady_clock::time_point started) {
+    long long nanos = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - started).count();
+    metrics->timedEvent(type, nanos, simclock, totalQueueLength.current(), totalQueueLength.timeAvg(simclock));
+}
+
+
+void Simulator::run() {
+
+    if(eventListKind == HEAP_EVENT_LIST) {
+        switch(policy.routing) {
+            case SHORTEST_QUEUE_ROUTING:  dispatchJockeying<ShortestQueueRouting>();  break;
+            case JOIN_IDLE_QUEUE_ROUTING: dispatchJockeying<JoinIdleQueueRouting>();  break;
+            case POWER_OF_D_ROUTING:      dispatchJockeying<PowerOfDRouting>();       break;
+            case SHARED_QUEUE_ROUTING:    dispatchJockeying<SharedQueueRouting>();    break;
+        }
+        return;
+    }
+
+    while (eventQueue->empty() == false && eventQueue->top()->getEventTime() < runLimit) {
 
-    while (eventQueue->empty() == false) {
-
         Event *event = this->eventQueue->top();
         this->eventQueue->pop();
-
+
         if (event == NULL)
-            break;
+            break;
 
         // cout << (*event) << endl;
 
         this->simclock = event->getEventTime();
-        event->processEvent(this);
+        eventCount++;
+        if(metrics && metrics->countEvent(event->getEventType(), eventQueue->size() + 1, eventCount)) {
+            chrono::steady_clock::time_point started = chrono::steady_clock::now();
+            event->processEvent(this);
+            eventTimed(event->getEventType(), started);
+        }
+        else
+            event->processEvent(this);
         delete event;
-
-    }
 
-}
+    }
+
+}
+
+
+void Simulator::runUntil(t_simtime limit) {
+    runLimit = limit;
+    run();
+    runLimit = HUGE_VAL;
+}
+
+
+bool Simulator::runUntilQueueLength(int32_t level, t_simtime limit) {
+    if(totalQueueLength.current() >= level)
+        return true;
+    stopAtQueueLength = level;
+    runUntil(limit);
+    stopAtQueueLength = INT32_MAX;
+    return totalQueueLength.current() >= level;
+}
+
+
+t_simtime Simulator::nextEventTime() {
+    if(eventListKind == HEAP_EVENT_LIST)
+        return eventHeap.empty() ? HUGE_VAL : eventHeap.top().time;
+    return eventQueue->empty() ? HUGE_VAL : eventQueue->top()->getEventTime();
+}
+
+
+void Simulator::setNetwork(vector<TransferMessage> *outbox, int branch, int branches, t_simtime transferTime, int maxTransfers) {
+    this->outbox = outbox;
+    this->branch = branch;
+    this->branches = branches;
+    this->transferTime = transferTime;
+    this->maxTransfers = maxTransfers;
+}
+
+
+/** the customer keeps the time it first arrived at the network, so its delay includes the way here */
+void Simulator::injectTransfer(const TransferMessage &message) {
+    t_customer C = customers.allocate(0, message.arrivalTime);
+    if(C == NO_CUSTOMER) {
+        lost++;
+        return;
+    }
+    customers[C].transfers = message.transfers;
+    if(eventListKind == HEAP_EVENT_LIST)
+        eventHeap.push(message.time, TRANSFER, (int32_t) C);
+    else
+        scheduleEvent(new TransferEvent(message.time, C));
+}
 
 
 void Simulator::setSimulationEndTime(t_simtime endTime) {
-    Event *endEvent = new EndEvent(endTime);
-    this->scheduleEvent(endEvent);
+    if(eventListKind == HEAP_EVENT_LIST)
+        eventHeap.push(endTime, EXIT, -1);
+    else
+        this->scheduleEvent(new EndEvent(endTime));
     this->serviceEndsAt = endTime;
-}
+
+    /** a run going on past its first end time, from a snapshot, takes in the arrival it held back */
+    if(arrivalAfterEnd != INVALID_TIME) {
+        t_simtime next = thinArrivals(arrivalAfterEnd);
+        arrivalAfterEnd = INVALID_TIME;
+        if(next <= endTime)
+            scheduleArrival(next);
+        else
+            arrivalAfterEnd = next;
+    }
+}
 
 
 Simulator::~Simulator() {
@@ -147,198 +545,1588 @@ Simulator::~Simulator() {
             delete event;
         }
         delete eventQueue;
-    }
-    for(int i = 0; i < N; i++) {
-        if(Q[i]) {
-            while(!Q[i]->empty()) {
-                Customer *C = Q[i]->front();
-                Q[i]->pop_front();
-                timeAvg[i]->pushData(Q[i]->size(), now());
-                delete C;
-            }
-            delete Q[i];
-        }
-    }
-    delete Q;
-    delete serverBusy;
-    for(int i = 0; i < N; i++) {
-        if(this->customerBeingServed[i]) {
-            delete customerBeingServed[i];
-        }
-    }
-    delete customerBeingServed;
-    delete serviceTimeStream;
-    delete interArrivalTimeStream;
-
-}
-
-
-void Simulator::makeServerBusy(int tellerId) {
-    if(serverBusy[tellerId])
-        return;
-    if(Q[tellerId]->empty()) {
-        return;
-    }
-    Customer *customer = Q[tellerId]->front();
-    Q[tellerId]->pop_front();
-    timeAvg[tellerId]->pushData(Q[tellerId]->size(), now());
-    customerBeingServed[tellerId] = customer;
-    customerBeingServed[tellerId]->serviceTimeStartsAt = now();
-    serverBusy[tellerId] = true;
-}
-
-
-void Simulator::makeServerIdle(int tellerId) {
-    if(!serverBusy[tellerId] || customerBeingServed[tellerId] == NULL) {
-        return;
-    }
-    serverBusy[tellerId] = false;
-    customerBeingServed[tellerId]->departureTime = this->now();
-    delete customerBeingServed[tellerId];
-    customerBeingServed[tellerId] = NULL;
+    }
+    releaseTellers();
+    delete avg;
+}
+
+
+void Simulator::makeServerBusy(int tellerId) {
+    if(serverBusy[tellerId])
+        return;
+    if(Q[tellerId]->empty()) {
+        return;
+    }
+    t_customer customer = Q[tellerId]->front();
+    Q[tellerId]->pop_front();
+    customerBeingServed[tellerId] = customer;
+    customers[customer].serviceTimeStartsAt = now();
+    traceEvent(TRACE_SERVICE_START, customer, -1, tellerId);
+    serverBusy[tellerId] = true;
+    tellerChanged(tellerId);
+}
+
+
+void Simulator::makeServerIdle(int tellerId) {
+    if(!serverBusy[tellerId] || customerBeingServed[tellerId] == NO_CUSTOMER) {
+        return;
+    }
+    serverBusy[tellerId] = false;
+    tellerChanged(tellerId);
+
+    /** the customer leaves the bank here, so this is where its delay is recorded */
+    Customer &customer = customers[customerBeingServed[tellerId]];
+    customer.departureTime = this->now();
+    avg->pushData(customer.delay());
+    TellerTotals &totals = tellerTotals[tellerId];
+    totals.served++;
+    totals.delaySum += customer.delay();
+    totals.busyTime += customer.departureTime - customer.serviceTimeStartsAt;
+    if(steadyState && now() <= serviceEndTime() && steadyState->add(customer.delay()))
+        steadyState->closeBatch(now(), queueLengthIntegral());
+    traceEvent(TRACE_DEPARTURE, customerBeingServed[tellerId], tellerId, -1);
+    if(!customer.renegePending)      /** else the renege event still refers to it, and releases it */
+        customers.release(customerBeingServed[tellerId]);
+    customerBeingServed[tellerId] = NO_CUSTOMER;
+}
+
+// Snapshots
+
+void Simulator::pushRecord(const EventRecord &event) {
+    if(eventListKind == HEAP_EVENT_LIST) {
+        eventHeap.push(event.time, (EventType) event.type, event.tellerId);
+        return;
+    }
+    switch(event.type) {
+        case EXIT:      scheduleEvent(new EndEvent(event.time));                                 break;
+        case ARRIVAL:   scheduleEvent(new ArrivalEvent(event.time));                             break;
+        case DEPARTURE: scheduleEvent(new DepartureEvent(event.time, event.tellerId));           break;
+        case RENEGE:    scheduleEvent(new RenegeEvent(event.time, (t_customer) event.tellerId)); break;
+        case TRANSFER:  scheduleEvent(new TransferEvent(event.time, (t_customer) event.tellerId)); break;
+    }
 }
 
+
+void Simulator::saveState(SimulatorSnapshot &snapshot) {
+
+    snapshot.bytes.clear();
+    snapshot.tellers = N;
+    StateWriter out(snapshot.bytes);
+
+    out.put(masterSeed);
+    out.put(substream);
+    out.put(antithetic);
+    out.put(interArrivalTimeMean);
+    out.put(serviceTimeMean);
+    out.put(simclock);
+    out.put(eventCount);
+    out.put(customerIdRecord);
+    out.put(statisticsFromId);
+    out.put(serviceEndsAt);
+    out.put(arrivalAfterEnd);
+    out.put(balked);
+    out.put(reneged);
+    out.put(lost);
+    out.put(transferred);
+    out.put(received);
+    out.put(transferSequence);
+    out.put(policy.routing == SHARED_QUEUE_ROUTING);
+
+    customers.save(out);
+    for(int i = 0; i < N; i++) {
+        Q[i]->save(out);
+        out.put(serverBusy[i]);
+        out.put(customerBeingServed[i]);
+        out.put(timeAvg[i]);
+        out.put(tellerTotals[i]);
+        serviceTimeStream[i]->save(out);
+    }
+    sharedQueue.save(out);
+    out.put(totalQueueLength);
+    interArrivalTimeStream->save(out);
+    customerServiceStream->save(out);
+    patienceStream->save(out);
+    out.put(*routingEngine);
+    out.put(*thinningEngine);
+    avg->save(out);
+    out.put(steadyState != NULL);
+    if(steadyState)
+        out.put(*steadyState);
+
+    /** the pointer event list is saved in the order it would give the events out */
+    if(eventListKind == HEAP_EVENT_LIST)
+        out.putVector(eventHeap.records());
+    else {
+        priority_queue<Event*, vector<Event*>, CompareEvent> pending(*eventQueue);
+        vector<EventRecord> records;
+        for(; !pending.empty(); pending.pop()) {
+            EventRecord event = { pending.top()->getEventTime(), pending.top()->getEventType(), pending.top()->getArgument() };
+            records.push_back(event);
+        }
+        out.putVector(records);
+    }
+
+}
+
+
+bool Simulator::restoreState(const SimulatorSnapshot &snapshot, int tellers, string &error) {
+
+    int saved = snapshot.tellers;
+    if(tellers == 0)
+        tellers = saved;
+    if(tellers < saved) {
+        ostringstream message;
+        message << "the snapshot has " << saved << " tellers, it cannot be restored with " << tellers;
+        error = message.str();
+        return false;
+    }
+
+    /** on failure the simulator is left an empty bank */
+    StateReader in(snapshot.bytes);
+    uint64_t seed = masterSeed;
+    uint32_t stream = substream;
+    bool flipped = antithetic, sharedRouting = false;
+    t_simtime arrivalMean = interArrivalTimeMean, serviceMean = serviceTimeMean;
+    in.get(seed);
+    in.get(stream);
+    in.get(flipped);
+    in.get(arrivalMean);
+    in.get(serviceMean);
+    in.get(simclock);
+    in.get(eventCount);
+    in.get(customerIdRecord);
+    in.get(statisticsFromId);
+    in.get(serviceEndsAt);
+    in.get(arrivalAfterEnd);
+    in.get(balked);
+    in.get(reneged);
+    in.get(lost);
+    in.get(transferred);
+    in.get(received);
+    in.get(transferSequence);
+    in.get(sharedRouting);
+    if(in.ok() && sharedRouting != (policy.routing == SHARED_QUEUE_ROUTING)) {
+        error = sharedRouting ? "the snapshot was taken with a shared queue, it needs shared routing" :
+                                "the snapshot was taken with a queue per teller, it cannot be restored with shared routing";
+        reset(N, seed, stream, arrivalMean, serviceMean, flipped);
+        return false;
+    }
+
+    /** the new tellers get the streams of the saved run's key, the saved ones are overwritten below */
+    if(tellers != N) {
+        releaseTellers();
+        allocateTellers(tellers);
+    }
+    reseed(seed, stream, arrivalMean, serviceMean, flipped);
+
+    if(in.ok())
+        customers.restore(in);
+    for(int i = 0; i < N; i++) {
+        Q[i]->clear();
+        serverBusy[i] = false;
+        customerBeingServed[i] = NO_CUSTOMER;
+        timeAvg[i] = TimeAvgGenerator();
+        tellerTotals[i] = TellerTotals();
+        if(i < saved) {
+            Q[i]->restore(in);
+            in.get(serverBusy[i]);
+            in.get(customerBeingServed[i]);
+            in.get(timeAvg[i]);
+            in.get(tellerTotals[i]);
+            serviceTimeStream[i]->restore(in);
+        }
+        queueLength[i] = Q[i]->size();
+        tellerLoad[i] = queueLength[i] + serverBusy[i];
+        if(tellerIndex)
+            tellerIndex->update(i, queueLength[i], serverBusy[i]);
+    }
+    if(N > saved) {
+        /** from the snapshot time on, the new tellers' averages count their empty queues */
+        for(int i = saved; i < N; i++)
+            timeAvg[i].restart(simclock);
+    }
+    sharedQueue.restore(in);
+    in.get(totalQueueLength);
+    interArrivalTimeStream->restore(in);
+    customerServiceStream->restore(in);
+    patienceStream->restore(in);
+    in.get(*routingEngine);
+    in.get(*thinningEngine);
+    avg->restore(in);
+    bool estimating = false;
+    in.get(estimating);
+    SteadyStateEstimator estimator;
+    if(estimating) {
+        in.get(estimator);
+        if(steadyState)
+            *steadyState = estimator;
+    }
+
+    vector<EventRecord> records;
+    in.getVector(records);
+    while(!eventQueue->empty()) {
+        delete eventQueue->top();
+        eventQueue->pop();
+    }
+    eventHeap.clear();
+    for(size_t i = 0; i < records.size(); i++)
+        pushRecord(records[i]);
+
+    if(!in.ok() || !in.atEnd()) {
+        error = "the snapshot is damaged";
+        reset(N, seed, stream, arrivalMean, serviceMean, flipped);
+        return false;
+    }
+    restoredEvents = eventCount;
+    return true;
+
+}
+
+
+void Simulator::restartStatistics() {
+    for(int i = 0; i < N; i++) {
+        timeAvg[i].restart(simclock);
+        /** a service under way counts from now on only */
+        TellerTotals fresh = TellerTotals();
+        if(serverBusy[i])
+            fresh.busyTime = customers[customerBeingServed[i]].serviceTimeStartsAt - simclock;
+        tellerTotals[i] = fresh;
+    }
+    totalQueueLength.restart(simclock);
+    avg->reset();
+    if(steadyState)
+        steadyState->restart(simclock, queueLengthIntegral());
+    eventCount = 0;
+    restoredEvents = 0;
+    statisticsFromId = customerIdRecord;
+    balked = 0;
+    reneged = 0;
+    lost = 0;
+    transferred = 0;
+    received = 0;
+}
+
+
 // Event classes
 
 EndEvent::EndEvent(t_simtime time, EventType type, string name): Event (time, type, name) { }
 EndEvent::EndEvent(t_simtime time): Event (time, EXIT, string("EXIT")) { }
 void EndEvent::processEvent(Simulator *sim) { }
-
+
 
 ArrivalEvent::ArrivalEvent(t_simtime time, EventType type, string name): Event (time, type, name) { }
 ArrivalEvent::ArrivalEvent(t_simtime time): Event (time, ARRIVAL, string("ARRIVAL")) { }
+void ArrivalEvent::processEvent(Simulator *sim) { sim->handleArrival(); }
+
 
-void ArrivalEvent::processEvent(Simulator *sim) {
-
-    /*** first schedule the next arrival */
-    t_simtime nextArrivalTime = sim->now() + sim->interArrivalTimeStream->next();
-    if(nextArrivalTime <= sim->serviceEndTime()) {
-        ArrivalEvent *event = new ArrivalEvent(nextArrivalTime);
-        sim->scheduleEvent(event);
-    }
-
-    /** construct a customer object */
-    Customer *C = new Customer(sim->nextCustomerId(), sim->now());
-
-    /** is a teller idle? */
-    int idleTellerId = sim->getFreeTellerId();
-
-    /** if idle found, then add the customer to this Q, and immediately call makeServerBusy()
-        so that this customer is added to the service. After that schedule a departure */
-    if(idleTellerId != -1) {
-
-        sim->addCustomerToQueue(C, idleTellerId);
-        sim->makeServerBusy(idleTellerId);
-
-        t_simtime departureTime = sim->now() + sim->serviceTimeStream->next();
-        DepartureEvent *e = new DepartureEvent(departureTime, idleTellerId);
-        sim->scheduleEvent(e);
-
-    }
-
-    /** else, no idle is found. then add this customer C to the queue with shortest length */
-    else {
-        int shortestQuedTellerID = sim->getShortestQuedTellerId();
-        sim->addCustomerToQueue(C, shortestQuedTellerID);
-    }
-
-}
-
-
 DepartureEvent::DepartureEvent(t_simtime time, int tellerId, EventType type, string name) : Event (time, type, name) { this->tellerId = tellerId; }
 DepartureEvent::DepartureEvent(t_simtime time, int tellerId) : Event(time, DEPARTURE, string("DEPARTURE")) { this->tellerId = tellerId; }
-
-void DepartureEvent::processEvent(Simulator *sim) {
-
-    //logger << "dept from teller " << tellerId << " at " << sim->now() << endl;
-
-    /*** make the server idle (make the previous customer leave), and then try to make server busy.
-         if there is someone at the queue, then the customer from front will be automatically sent
-         to the teller for service */
-
-    sim->makeServerIdle(tellerId);
-    sim->makeServerBusy(tellerId);
-
-    /*** now determine if the server (teller) is actually busy, then someone from Q has just entered.
-         So schedule his departure */
-
-    if(sim->isServerBusy(tellerId)) {
-        t_simtime departureTime = sim->now() + sim->serviceTimeStream->next();
-        DepartureEvent *event = new DepartureEvent(departureTime, tellerId);
-        sim->scheduleEvent(event);
-    }
-
-    /*** invoke the jockey routine. this is a non-event routine. jockeying is handled separately in this
-         separate method. */
-
-    sim->jockey(tellerId);
-
-}
-
-
-int main(int argc, char **argv) {
-
-    srand(time(NULL));
-
-    result << "Multi-teller bank with jockeying " << endl;
-    result << "________________________________________________________________________________" << endl;
-    result << "Total tellers:\t\t\t\t2 to 8" << endl;
-    result << "Mean inter-arrival time:\t\t" << INTER_ARRIVAL_TIME_MEAN << " minutes" << endl;
-    result << "Mean service time:\t\t\t" << SERVICE_TIME_MEAN << " minutes" << endl;
-    result << "Duration:\t\t\t\t8 hours" << endl;
-
-    result << endl << endl;
-
-    result << "#tellers\tAvg q len\tAvg delay\tLeft boundary\tRight boundary" << endl;
+void DepartureEvent::processEvent(Simulator *sim) { sim->handleDeparture(tellerId); }
+
+
+TransferEvent::TransferEvent(t_simtime time, t_customer customer) : Event(time, TRANSFER, string("TRANSFER")) { this->customer = customer; }
+void TransferEvent::processEvent(Simulator *sim) { sim->handleTransfer(customer); }
+
+
+RenegeEvent::RenegeEvent(t_simtime time, t_customer customer) : Event(time, RENEGE, string("RENEGE")) { this->customer = customer; }
+void RenegeEvent::processEvent(Simulator *sim) { sim->handleRenege(customer); }
+
+
+// Event routines
+
+template <int FIXED_N, class Routing>
+void Simulator::arrive() {
+
+    /*** first schedule the next arrival. when replaying, the next arrival and the service time of this
+         customer come from the file instead */
+    t_simtime recordedServiceTime = synchronizedService ? customerServiceStream->next() : INVALID_TIME;
+    if(replay) {
+        recordedServiceTime = replay->serviceTime();
+        replay->advance();
+        if(!replay->done() && replay->arrivalTime() <= serviceEndTime())
+            scheduleArrival(replay->arrivalTime());
+    }
+    else {
+        t_simtime nextArrivalTime = nextArrivalAfter(now());
+        if(nextArrivalTime <= serviceEndTime())
+            scheduleArrival(nextArrivalTime);
+        else
+            arrivalAfterEnd = nextArrivalTime;
+    }
+
+    /** take a customer record from the pool. a pool at its limit turns the customer away */
+    t_customer C = customers.allocate(nextCustomerId(), now());
+    if(C == NO_CUSTOMER) {
+        lost++;
+        return;
+    }
+    customers[C].serviceTime = recordedServiceTime;
+    traceEvent(TRACE_ARRIVAL, C, -1, -1);
+    join<FIXED_N, Routing>(C);
+
+}
+
+
+/** a customer sent on from another branch, already in the pool, gets its id here on arrival */
+template <int FIXED_N, class Routing>
+void Simulator::transferIn(t_customer C) {
+    customers[C].customerId = nextCustomerId();
+    received++;
+    customers[C].serviceTime = synchronizedService ? customerServiceStream->next() : INVALID_TIME;
+    traceEvent(TRACE_ARRIVAL, C, -1, -1);
+    join<FIXED_N, Routing>(C);
+}
+
+
+template <int FIXED_N, class Routing>
+void Simulator::join(t_customer C) {
+
+    /** the routing policy picks the teller: with the default one an idle teller if there is one, else the
+        shortest queue. a customer who finds balkAt or more waiting there, or the queue full, leaves right
+        away, for the next branch if the bank is part of a network */
+    int tellerId = Routing::template route<FIXED_N>(tellerView());
+    int32_t waiting = tellerId == SHARED_QUEUE ? (int32_t) sharedQueue.size() : queueLength[tellerId];
+    bool balks = policy.balkAt > 0 && waiting >= policy.balkAt;
+    bool full = policy.queueCapacity > 0 && waiting >= (tellerId == SHARED_QUEUE ? N : 1) * policy.queueCapacity;
+    if(balks || full) {
+        if(outbox && customers[C].transfers < maxTransfers) {
+            TransferMessage message;
+            message.time = now() + transferTime;
+            message.arrivalTime = customers[C].arrivalTime;
+            message.destination = (branch + 1) % branches;
+            message.source = branch;
+            message.transfers = customers[C].transfers + 1;
+            message.sequence = transferSequence++;
+            outbox->push_back(message);
+            transferred++;
+            traceEvent(TRACE_TRANSFER, C, -1, message.destination);
+        }
+        else {
+            if(balks)
+                balked++;
+            else
+                lost++;
+            traceEvent(TRACE_BALK, C, -1, tellerId);
+        }
+        customers.release(C);
+        return;
+    }
+
+    /** the customer joins its Q, and if that teller is idle, immediately goes into service through
+        makeServerBusy(), after which the departure is scheduled */
+    if(Routing::sharedQueue && tellerId == SHARED_QUEUE) {
+        sharedQueue.push_back(C);
+        customers[C].queue = SHARED_QUEUE;
+        sharedQueueChanged(waiting);
+        traceEvent(TRACE_JOIN_QUEUE, C, -1, SHARED_QUEUE);
+    }
+    else {
+        addCustomerToQueue(C, tellerId);
+        traceEvent(TRACE_JOIN_QUEUE, C, -1, tellerId);
+        if(!serverBusy[tellerId]) {
+            makeServerBusy(tellerId);
+            scheduleDeparture(now() + serviceTimeAt(tellerId), tellerId);
+            return;
+        }
+    }
+
+    /** a customer who has to wait only waits so long */
+    if(policy.patienceMean > 0) {
+        customers[C].renegePending = true;
+        scheduleRenege(now() + policy.patienceMean * patienceStream->next(), C);
+    }
+
+}
+
+
+template <int FIXED_N, class Routing, class Jockeying>
+void Simulator::depart(int tellerId) {
+
+    //logger << "dept from teller " << tellerId << " at " << now() << endl;
+
+    /*** make the server idle (make the previous customer leave), and then try to make server busy.
+         if there is someone at the queue, then the customer from front will be automatically sent
+         to the teller for service */
+
+    makeServerIdle(tellerId);
+    if(Routing::sharedQueue && !sharedQueue.empty())
+        takeFromSharedQueue(tellerId);
+    makeServerBusy(tellerId);
+
+    /*** now determine if the server (teller) is actually busy, then someone from Q has just entered.
+         So schedule his departure */
+
+    if(isServerBusy(tellerId))
+        scheduleDeparture(now() + serviceTimeAt(tellerId), tellerId);
+
+    /*** invoke the jockey routine. this is a non-event routine. jockeying is handled separately in this
+         separate method. */
+
+    jockeyFrom(Jockeying::template source<FIXED_N>(tellerView(), tellerId), tellerId);
+
+}
+
+
+void Simulator::handleArrival() {
+    switch(policy.routing) {
+        case SHORTEST_QUEUE_ROUTING:  arrive<0, ShortestQueueRouting>();  break;
+        case JOIN_IDLE_QUEUE_ROUTING: arrive<0, JoinIdleQueueRouting>();  break;
+        case POWER_OF_D_ROUTING:      arrive<0, PowerOfDRouting>();       break;
+        case SHARED_QUEUE_ROUTING:    arrive<0, SharedQueueRouting>();    break;
+    }
+}
+
+
+void Simulator::handleTransfer(t_customer C) {
+    switch(policy.routing) {
+        case SHORTEST_QUEUE_ROUTING:  transferIn<0, ShortestQueueRouting>(C);  break;
+        case JOIN_IDLE_QUEUE_ROUTING: transferIn<0, JoinIdleQueueRouting>(C);  break;
+        case POWER_OF_D_ROUTING:      transferIn<0, PowerOfDRouting>(C);       break;
+        case SHARED_QUEUE_ROUTING:    transferIn<0, SharedQueueRouting>(C);    break;
+    }
+}
+
+
+/** on departures the routing only matters for the shared queue */
+void Simulator::handleDeparture(int tellerId) {
+    if(policy.routing == SHARED_QUEUE_ROUTING)
+        depart<0, SharedQueueRouting, NoJockeying>(tellerId);
+    else if(jockeying)
+        depart<0, ShortestQueueRouting, NearestJockeying>(tellerId);
+    else
+        depart<0, ShortestQueueRouting, NoJockeying>(tellerId);
+}
+
+
+/** the patience of customer C ran out. only a customer still waiting leaves; one in service stays, and one who
+    has left already was kept in the pool until now, for this event */
+void Simulator::handleRenege(t_customer C) {
+    Customer &customer = customers[C];
+    customer.renegePending = false;
+    if(customer.departureTime != INVALID_TIME) {
+        customers.release(C);
+        return;
+    }
+    if(customer.serviceTimeStartsAt != INVALID_TIME)
+        return;
+
+    int from = customer.queue;
+    if(from == SHARED_QUEUE) {
+        int32_t length = sharedQueue.size();
+        sharedQueue.remove(C);
+        sharedQueueChanged(length);
+    }
+    else {
+        Q[from]->remove(C);
+        tellerChanged(from);
+    }
+    reneged++;
+    traceEvent(TRACE_RENEGE, C, from, -1);
+    customers.release(C);
+}
+
+
+// Replication engine
+
+ReplicationRunner::ReplicationRunner(int threads) {
+    this->threads = threads < 1 ? 1 : threads;
+    exporter = NULL;
+    batchLanes = 1;
+    cache = NULL;
+    cachedReplications = 0;
+    cachedEvents = 0;
+    resultFile = NULL;
+}
+
+
+void ReplicationRunner::setBatchLanes(int lanes) {
+    batchLanes = max(1, min(lanes, BATCH_MAX_LANES));
+}
+
+
+void ReplicationRunner::setMetrics(MetricsExporter *exporter) {
+    this->exporter = exporter;
+    workerMetrics.clear();
+    for(int i = 0; exporter && i < threads; i++)
+        workerMetrics.push_back(exporter->addWorker());
+}
+
+
+ReplicationResult ReplicationRunner::runOne(const ReplicationJob &job) {
+    Simulator sim(job.numTellers, job.masterSeed, job.substream, job.eventList, job.interArrivalTimeMean, job.serviceTimeMean);
+    return runOne(job, sim);
+}
+
+
+void ReplicationRunner::prepare(const ReplicationJob &job, Simulator &sim) {
+    sim.setDistributions(job.serviceDistribution, job.arrivalDistribution, job.arrivalProfile);
+    sim.reset(job.numTellers, job.masterSeed, job.substream, job.interArrivalTimeMean, job.serviceTimeMean, job.antithetic);
+    sim.setJockeying(job.jockeying);
+    sim.setPolicy(job.policy);
+    sim.setSynchronizedService(job.synchronizedService);
+    if(job.delayQuantiles)
+        sim.enableDelayQuantiles();
+    sim.setSimulationEndTime(job.horizon);
+}
+
+
+/** a random run starts with an arrival at time 0, or under an arrival profile with the first arrival drawn
+    from time 0 */
+void ReplicationRunner::startArrivals(const ReplicationJob &job, Simulator &sim) {
+    if(job.arrivalProfile) {
+        t_simtime first = sim.nextArrivalAfter(0.0);
+        if(first <= job.horizon)
+            sim.scheduleArrival(first);
+    }
+    else
+        sim.scheduleArrival(0.0);
+}
+
+
+ReplicationResult ReplicationRunner::resultOf(Simulator &sim) {
+    ReplicationResult r;
+    r.avgQueueLength = sim.getTotalQueueLengthStats()->timeAvg(sim.now());
+    r.utilization = sim.getUtilization();
+    r.avgDelay = sim.getDelayStats()->avg();
+    r.confidenceRange = sim.getDelayStats()->getConfidenceIntervalRange();
+    r.delayP50 = sim.getDelayStats()->quantile(0.50);
+    r.delayP95 = sim.getDelayStats()->quantile(0.95);
+    r.delayP99 = sim.getDelayStats()->quantile(0.99);
+    r.events = sim.getEventsRun();
+    r.arrivals = sim.getArrivalCount();
+    r.served = sim.getDelayStats()->getSampleCount();
+    r.balked = sim.getBalkCount();
+    r.reneged = sim.getRenegeCount();
+    r.lost = sim.getLossCount();
+    r.transferred = sim.getTransferCount();
+    r.jockeys = sim.getJockeyCount();
+    r.warmupTime = 0;
+    r.batches = 0;
+    r.tailProbability = 0;
+    return r;
+}
+
+
+ReplicationResult ReplicationRunner::runOne(const ReplicationJob &job, Simulator &sim) {
+
+    if(job.splitting)
+        return SplittingEstimator::run(job, sim);
+
+    prepare(job, sim);
+
+    TraceWriter trace;
+    if(!job.traceFile.empty()) {
+        string error;
+        if(trace.open(job.traceFile, error))
+            sim.setTrace(&trace);
+        else
+            cerr << error << endl;
+    }
+
+    SteadyStateEstimator steadyState;
+    if(job.steadyState)
+        sim.setSteadyState(&steadyState);
+
+    /** a run from a snapshot goes on from the saved bank, on the saved random streams if it has their key,
+        else on its own. a replayed run starts with the first recorded customer */
+    ArrivalReplay replay;
+    if(job.startFrom) {
+        string error;
+        if(!sim.restoreState(*job.startFrom, job.numTellers, error)) {
+            cerr << error << endl;
+            exit(1);
+        }
+        if(!sim.hasSeed(job.masterSeed, job.substream, job.interArrivalTimeMean, job.serviceTimeMean, job.antithetic))
+            sim.reseed(job.masterSeed, job.substream, job.interArrivalTimeMean, job.serviceTimeMean, job.antithetic);
+        if(sim.serviceEndTime() != job.horizon)
+            sim.setSimulationEndTime(job.horizon);
+        if(job.freshStatistics)
+            sim.restartStatistics();
+    }
+    else if(!job.replayFile.empty()) {
+        string error;
+        if(!replay.open(job.replayFile.c_str(), error)) {
+            cerr << error << endl;
+            exit(1);
+        }
+        sim.setReplay(&replay);
+        if(!replay.done() && replay.arrivalTime() <= job.horizon)
+            sim.scheduleArrival(replay.arrivalTime());
+    }
+    else
+        startArrivals(job, sim);
+
+    /** checkpoints on the way up to the end time, the last one at the end time if it is a multiple of the
+        interval: a run with horizon T and checkpoint_every T leaves the bank at T, before it drains */
+    if(!job.checkpointFile.empty()) {
+        SimulatorSnapshot snapshot;
+        for(t_simtime t = (floor(sim.now() / job.checkpointEvery) + 1) * job.checkpointEvery; t <= job.horizon; t += job.checkpointEvery) {
+            sim.runUntil(t);
+            sim.saveState(snapshot);
+            string error;
+            if(!snapshot.save(job.checkpointFile, error))
+                cerr << error << endl;
+        }
+    }
+    sim.run();
+
+    sim.setSteadyState(NULL);
+    sim.setReplay(NULL);
+    sim.setTrace(NULL);
+    if(!trace.close())
+        cerr << "trace file " << job.traceFile << " is incomplete" << endl;
+
+    ReplicationResult r = resultOf(sim);
+
+    /** a steady state run reports the batch means estimates after the warm-up instead */
+    if(job.steadyState)
+        steadyState.estimate(0.95, r.avgDelay, r.confidenceRange, r.avgQueueLength, r.warmupTime, r.batches);
+    return r;
+
+}
+
+
+void ReplicationRunner::worker(const vector<ReplicationJob> *jobs, const vector<pair<size_t, size_t> > *tasks,
+                               vector<ReplicationResult> *results, atomic<size_t> *nextTask, SimulatorMetrics *metrics,
+                               MetricsExporter *exporter, ResultWriter *resultFile) {
+    Simulator *sim = NULL;
+    for(size_t task = nextTask->fetch_add(1); task < tasks->size(); task = nextTask->fetch_add(1)) {
+        size_t i = (*tasks)[task].first, end = (*tasks)[task].second;
+        if(end - i > 1) {
+            BatchSimulator batch(&(*jobs)[i], end - i);
+            batch.run();
+            for(size_t j = i; j < end; j++)
+                (*results)[j] = batch.resultOf(j - i);
+            continue;
+        }
+        const ReplicationJob &job = (*jobs)[i];
+        if(sim == NULL || sim->getEventListKind() != job.eventList) {
+            delete sim;
+            sim = new Simulator(job.numTellers, job.masterSeed, job.substream, job.eventList, job.interArrivalTimeMean, job.serviceTimeMean);
+            sim->setMetrics(metrics);
+        }
+        if(metrics)
+            metrics->startJob(i, job.numTellers);
+        (*results)[i] = runOne(job, *sim);
+        if(resultFile) {
+            resultFile->addReplication(job, (*results)[i]);
+            if(!job.splitting)
+                resultFile->addTellers(job, *sim);
+        }
+        if(metrics) {
+            metrics->endJob();
+            exporter->jobDone();
+        }
+    }
+    delete sim;
+}
+
+
+vector<ReplicationResult> ReplicationRunner::run(const vector<ReplicationJob> &jobs) {
+
+    vector<ReplicationResult> results(jobs.size());
+    atomic<size_t> nextTask(0);
+
+    /** instrumented runs need the Simulator's event loop and the teller rows of a result file its per teller
+        totals, so neither is batched */
+    vector<pair<size_t, size_t> > tasks;
+    for(size_t i = 0; i < jobs.size(); ) {
+        size_t end = i + 1;
+        if(!exporter && !resultFile && BatchSimulator::batchable(jobs[i]))
+            while(end < jobs.size() && end - i < (size_t) batchLanes && BatchSimulator::batchable(jobs[end]) &&
+                  BatchSimulator::sameBatch(jobs[i], jobs[end]))
+                end++;
+        tasks.push_back(make_pair(i, end));
+        i = end;
+    }
+
+    /** the calling thread works too, so threads == 1 means no extra thread at all */
+    if(exporter)
+        exporter->addJobs(jobs.size());
+    vector<thread> pool;
+    for(int i = 1; i < threads; i++)
+        pool.push_back(thread(worker, &jobs, &tasks, &results, &nextTask, exporter ? workerMetrics[i] : NULL, exporter, resultFile));
+    worker(&jobs, &tasks, &results, &nextTask, exporter ? workerMetrics[0] : NULL, exporter, resultFile);
+    for(size_t i = 0; i < pool.size(); i++)
+        pool[i].join();
+
+    return results;
+
+}
+
+
+/** splitmix64 */
+static inline uint64_t mixKey(uint64_t key, uint64_t value) {
+    uint64_t z = key ^ (value + 0x9E3779B97F4A7C15ULL + (key << 6) + (key >> 2));
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static inline uint64_t bitsOf(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+
+uint64_t ReplicationRunner::streamKey(const ReplicationJob &scenario, const ReplicationPlan &plan) {
+    if(plan.commonRandomNumbers)
+        return scenario.masterSeed;
+    uint64_t key = mixKey(scenario.masterSeed, (uint64_t) scenario.numTellers);
+    key = mixKey(key, bitsOf(scenario.interArrivalTimeMean));
+    key = mixKey(key, bitsOf(scenario.serviceTimeMean));
+    key = mixKey(key, (uint64_t) scenario.jockeying);
+    return mixKey(key, (uint64_t) scenario.policy.routing);
+}
+
+
+ReplicationJob ReplicationRunner::jobOf(const ReplicationJob &scenario, int i, const ReplicationPlan &plan, uint64_t fingerprint) {
+    int step = plan.antithetic ? 2 : 1;
+    ReplicationJob job = scenario;
+    job.replication = i;
+    job.fingerprint = fingerprint;
+    job.masterSeed = streamKey(scenario, plan);
+    job.substream = i / step;
+    job.antithetic = plan.antithetic && i % 2 == 1;
+    job.synchronizedService = plan.commonRandomNumbers;
+    if(i > 0) {
+        job.traceFile.clear();
+        job.checkpointFile.clear();
+    }
+    return job;
+}
+
+
+vector<vector<ReplicationResult> > ReplicationRunner::runScenarios(const vector<ReplicationJob> &scenarios, const vector<int> &maxReplications,
+                                                                  const ReplicationPlan &plan) {
+
+    size_t count = scenarios.size();
+    vector<vector<ReplicationResult> > results(count);
+
+    /** with antithetic variates a pair is one observation, so replications are counted in twos */
+    int step = plan.antithetic ? 2 : 1;
+    vector<int> limit(count), wanted(count);
+    for(size_t g = 0; g < count; g++) {
+        limit[g] = (maxReplications[g] + step - 1) / step * step;
+        wanted[g] = plan.relativePrecision > 0 ? min(limit[g], PRECISION_PILOT_REPLICATIONS * step) : limit[g];
+    }
+
+    /** cached replications stand in for the ones they are, only when the plan asks for them, so that the
+        stopping rule sees the same numbers in the same rounds as without the cache. the cache key of a point is
+        also its fingerprint in the result file */
+    vector<vector<ReplicationResult> > cached(count);
+    vector<uint64_t> keys(count);
+    cachedReplications = 0;
+    cachedEvents = 0;
+    for(size_t g = 0; (cache || resultFile) && g < count; g++)
+        keys[g] = ResultCache::keyOf(scenarios[g], plan);
+    for(size_t g = 0; cache && g < count; g++)
+        if(ResultCache::cacheable(scenarios[g]))
+            cached[g] = cache->load(keys[g]);
+
+    while(true) {
+
+        /** the replications still wanted, all scenarios in one batch so that they share the threads */
+        vector<ReplicationJob> jobs;
+        vector<size_t> owner;
+        for(size_t g = 0; g < count; g++) {
+            for(int i = results[g].size(); i < wanted[g]; i++) {
+                if(i < (int) cached[g].size()) {
+                    results[g].push_back(cached[g][i]);
+                    cachedReplications++;
+                    cachedEvents += cached[g][i].events;
+                    if(resultFile)
+                        resultFile->addReplication(jobOf(scenarios[g], i, plan, keys[g]), cached[g][i]);
+                    continue;
+                }
+                jobs.push_back(jobOf(scenarios[g], i, plan, keys[g]));
+                owner.push_back(g);
+            }
+        }
+
+        if(!jobs.empty()) {
+            vector<ReplicationResult> round = run(jobs);
+            for(size_t j = 0; j < jobs.size(); j++)
+                results[owner[j]].push_back(round[j]);
+        }
+
+        if(plan.relativePrecision <= 0)
+            break;
+
+        /** a scenario short of the target asks for as many observations as its variance so far says it needs,
+            at least one more and no more than its limit */
+        bool more = false;
+        for(size_t g = 0; g < count; g++) {
+            int n = results[g].size();
+            if(n >= limit[g])
+                continue;
+            double mean, halfWidth;
+            acrossReplications(results[g], plan.antithetic, plan.confidence, mean, halfWidth);
+            double target = plan.relativePrecision * fabs(mean);
+            if(halfWidth <= target)
+                continue;
+            double needed = target > 0 ? ceil(n / step * (halfWidth / target) * (halfWidth / target)) : limit[g];
+            wanted[g] = (int) min((double) limit[g], max((double) (n + step), needed * step));
+            more = true;
+        }
+        if(!more)
+            break;
+
+    }
+
+    /** the cache keeps the longest prefix run so far */
+    for(size_t g = 0; cache && g < count; g++) {
+        string error;
+        if(ResultCache::cacheable(scenarios[g]) && results[g].size() > cached[g].size() &&
+           !cache->store(keys[g], results[g], error))
+            cerr << error << endl;
+    }
+
+    return results;
+
+}
+
+
+void ReplicationRunner::acrossReplications(const vector<ReplicationResult> &results, bool antithetic, double confidence,
+                                           double &mean, double &halfWidth) {
+    AvgGenerator observations;
+    size_t step = antithetic ? 2 : 1;
+    for(size_t i = 0; i + step <= results.size(); i += step)
+        observations.pushData(antithetic ? (results[i].avgDelay + results[i + 1].avgDelay) / 2 : results[i].avgDelay);
+    mean = observations.avg();
+    halfWidth = observations.getConfidenceIntervalRange(confidence);
+}
+
+
+// Scenario configuration
+
+ScenarioGrid::ScenarioGrid() {
+    tellers.clear();
+    for(int n = 4; n <= 9; n++)
+        tellers.push_back(n);
+    interArrivalTimeMeans.assign(1, INTER_ARRIVAL_TIME_MEAN);
+    serviceTimeMeans.assign(1, SERVICE_TIME_MEAN);
+    horizons.assign(1, SIMULATION_HORIZON);
+    replications.assign(1, RUN_SIMULATION_TIMES);
+    jockeying.assign(1, true);
+    routings.assign(1, SHORTEST_QUEUE_ROUTING);
+    policy = defaultQueuePolicy();
+    serviceDistribution = Distribution();
+    arrivalDistribution = Distribution();
+    arrivalProfile = ArrivalProfile();
+    threads = 0;
+    batchLanes = BATCH_DEFAULT_LANES;
+    masterSeed = DEFAULT_MASTER_SEED;
+    eventList = HEAP_EVENT_LIST;
+    delayQuantiles = false;
+    traceFile.clear();
+    replayFile.clear();
+    commonRandomNumbers = false;
+    antithetic = false;
+    relativePrecision = 0;
+    steadyState = false;
+    metricsFile.clear();
+    metricsFormat = METRICS_JSON_LINES;
+    metricsInterval = 1.0;
+    checkpointFile.clear();
+    checkpointEvery = 0;
+    startFromFile.clear();
+    freshStatistics = false;
+    branches = 1;
+    transferTime = 1.0;
+    maxTransfers = 1;
+    shards = 0;
+    shardTransport = THREAD_TRANSPORT;
+    splitting.levels.clear();
+    splitting.effort = SPLITTING_DEFAULT_EFFORT;
+    cacheDirectory.clear();
+    resultsFile.clear();
+}
+
+
+/** splits "a, b,c" into its trimmed items */
+static vector<string> splitList(const string &text) {
+    vector<string> items;
+    size_t start = 0;
+    while(start <= text.size()) {
+        size_t comma = text.find(',', start);
+        if(comma == string::npos)
+            comma = text.size();
+        string item = text.substr(start, comma - start);
+        size_t first = item.find_first_not_of(" \t\r");
+        size_t last = item.find_last_not_of(" \t\r");
+        if(first != string::npos)
+            items.push_back(item.substr(first, last - first + 1));
+        start = comma + 1;
+    }
+    return items;
+}
+
+
+bool ScenarioGrid::parseInts(const string &text, vector<int> &values) {
+    vector<int> parsed;
+    vector<string> items = splitList(text);
+    for(size_t i = 0; i < items.size(); i++) {
+        int first, last, step = 1;
+        char extra;
+        if(sscanf(items[i].c_str(), "%d:%d:%d%c", &first, &last, &step, &extra) == 3 ||
+           sscanf(items[i].c_str(), "%d:%d%c", &first, &last, &extra) == 2) {
+            if(step < 1 || last < first)
+                return false;
+            for(int v = first; v <= last; v += step)
+                parsed.push_back(v);
+        }
+        else if(sscanf(items[i].c_str(), "%d%c", &first, &extra) == 1)
+            parsed.push_back(first);
+        else
+            return false;
+    }
+    if(parsed.empty())
+        return false;
+    values = parsed;
+    return true;
+}
+
+
+bool ScenarioGrid::parseDoubles(const string &text, vector<double> &values) {
+    vector<double> parsed;
+    vector<string> items = splitList(text);
+    for(size_t i = 0; i < items.size(); i++) {
+        char *end;
+        double v = strtod(items[i].c_str(), &end);
+        if(*end != '\0' || !(v > 0))
+            return false;
+        parsed.push_back(v);
+    }
+    if(parsed.empty())
+        return false;
+    values = parsed;
+    return true;
+}
+
+
+bool ScenarioGrid::parseSeed(const string &text, uint64_t &value) {
+    if(text.empty() || !isdigit((unsigned char) text[0]))
+        return false;
+    char *end;
+    errno = 0;
+    unsigned long long v = strtoull(text.c_str(), &end, 10);
+    if(*end != '\0' || errno == ERANGE)
+        return false;
+    value = v;
+    return true;
+}
+
+
+bool ScenarioGrid::parseSwitches(const string &text, vector<bool> &values) {
+    vector<bool> parsed;
+    vector<string> items = splitList(text);
+    for(size_t i = 0; i < items.size(); i++) {
+        if(items[i] == "on" || items[i] == "true" || items[i] == "1")
+            parsed.push_back(true);
+        else if(items[i] == "off" || items[i] == "false" || items[i] == "0")
+            parsed.push_back(false);
+        else
+            return false;
+    }
+    if(parsed.empty())
+        return false;
+    values = parsed;
+    return true;
+}
+
+
+bool ScenarioGrid::parseRoutings(const string &text, vector<RoutingKind> &values) {
+    vector<RoutingKind> parsed;
+    vector<string> items = splitList(text);
+    for(size_t i = 0; i < items.size(); i++) {
+        int kind = SHORTEST_QUEUE_ROUTING;
+        while(kind <= SHARED_QUEUE_ROUTING && items[i] != routingName((RoutingKind) kind))
+            kind++;
+        if(kind > SHARED_QUEUE_ROUTING)
+            return false;
+        parsed.push_back((RoutingKind) kind);
+    }
+    if(parsed.empty())
+        return false;
+    values = parsed;
+    return true;
+}
+
+
+bool ScenarioGrid::set(const string &rawKey, const string &value, string &error) {
+
+    string key = rawKey;
+    replace(key.begin(), key.end(), '-', '_');
+
+    bool ok;
+    vector<int> ints;
+    vector<bool> switches;
+    vector<double> doubles;
+    if(key == "tellers")
+        ok = parseInts(value, tellers) && *min_element(tellers.begin(), tellers.end()) >= 1;
+    else if(key == "inter_arrival_mean")
+        ok = parseDoubles(value, interArrivalTimeMeans);
+    else if(key == "service_mean")
+        ok = parseDoubles(value, serviceTimeMeans);
+    else if(key == "horizon")
+        ok = parseDoubles(value, horizons);
+    else if(key == "replications")
+        ok = parseInts(value, replications) && *min_element(replications.begin(), replications.end()) >= 1;
+    else if(key == "jockeying")
+        ok = parseSwitches(value, jockeying);
+    else if(key == "routing")
+        ok = parseRoutings(value, routings);
+    else if(key == "choices")
+        ok = parseInts(value, ints) && ints.size() == 1 && ints[0] >= 1 && (policy.choices = ints[0], true);
+    else if(key == "jockey_threshold")
+        ok = parseInts(value, ints) && ints.size() == 1 && ints[0] >= 2 && (policy.jockeyThreshold = ints[0], true);
+    else if(key == "jockey_distance")
+        ok = parseInts(value, ints) && ints.size() == 1 && ints[0] >= 0 && (policy.jockeyDistance = ints[0], true);
+    else if(key == "balk_at")
+        ok = parseInts(value, ints) && ints.size() == 1 && ints[0] >= 0 && (policy.balkAt = ints[0], true);
+    else if(key == "queue_capacity")
+        ok = parseInts(value, ints) && ints.size() == 1 && ints[0] >= 0 && (policy.queueCapacity = ints[0], true);
+    else if(key == "patience_mean")
+        ok = value == "0" ? (policy.patienceMean = 0, true) :
+             parseDoubles(value, doubles) && doubles.size() == 1 && (policy.patienceMean = doubles[0], true);
+    else if(key == "threads")
+        ok = parseInts(value, ints) && ints.size() == 1 && ints[0] >= 0 && (threads = ints[0], true);
+    else if(key == "batch")
+        ok = parseInts(value, ints) && ints.size() == 1 && ints[0] >= 0 && ints[0] <= BATCH_MAX_LANES && (batchLanes = ints[0], true);
+    else if(key == "seed")
+        ok = parseSeed(value, masterSeed);
+    else if(key == "event_list")
+        ok = (value == "heap" || value == "pointer") && (eventList = value == "heap" ? HEAP_EVENT_LIST : POINTER_EVENT_LIST, true);
+    else if(key == "quantiles")
+        ok = parseSwitches(value, switches) && switches.size() == 1 && (delayQuantiles = switches[0], true);
+    else if(key == "trace")
+        ok = !value.empty() && (traceFile = value, true);
+    else if(key == "crn")
+        ok = parseSwitches(value, switches) && switches.size() == 1 && (commonRandomNumbers = switches[0], true);
+    else if(key == "antithetic")
+        ok = parseSwitches(value, switches) && switches.size() == 1 && (antithetic = switches[0], true);
+    else if(key == "precision")
+        ok = parseDoubles(value, doubles) && doubles.size() == 1 && doubles[0] < 1 && (relativePrecision = doubles[0], true);
+    else if(key == "steady_state")
+        ok = parseSwitches(value, switches) && switches.size() == 1 && (steadyState = switches[0], true);
+    else if(key == "metrics") {
+        if(!MetricsExporter::check(value, error))
+            return false;
+        metricsFile = value;
+        ok = true;
+    }
+    else if(key == "metrics_format")
+        ok = (value == "json" || value == "prometheus") && (metricsFormat = value == "json" ? METRICS_JSON_LINES : METRICS_PROMETHEUS, true);
+    else if(key == "metrics_interval")
+        ok = parseDoubles(value, doubles) && doubles.size() == 1 && (metricsInterval = doubles[0], true);
+    else if(key == "checkpoint")
+        ok = !value.empty() && (checkpointFile = value, true);
+    else if(key == "checkpoint_every")
+        ok = parseDoubles(value, doubles) && doubles.size() == 1 && (checkpointEvery = doubles[0], true);
+    else if(key == "start_from") {
+        if(!startFrom.load(value, error))
+            return false;
+        startFromFile = value;
+        ok = true;
+    }
+    else if(key == "fresh_statistics")
+        ok = parseSwitches(value, switches) && switches.size() == 1 && (freshStatistics = switches[0], true);
+    else if(key == "branches")
+        ok = parseInts(value, ints) && ints.size() == 1 && ints[0] >= 1 && (branches = ints[0], true);
+    else if(key == "transfer_time")
+        ok = parseDoubles(value, doubles) && doubles.size() == 1 && (transferTime = doubles[0], true);
+    else if(key == "max_transfers")
+        ok = parseInts(value, ints) && ints.size() == 1 && ints[0] >= 0 && (maxTransfers = ints[0], true);
+    else if(key == "shards")
+        ok = parseInts(value, ints) && ints.size() == 1 && ints[0] >= 0 && (shards = ints[0], true);
+    else if(key == "shard_transport")
+        ok = (value == "threads" || value == "sockets") && (shardTransport = value == "threads" ? THREAD_TRANSPORT : SOCKET_TRANSPORT, true);
+    else if(key == "split_levels") {
+        ok = parseInts(value, ints) && ints[0] >= 1;
+        for(size_t i = 1; ok && i < ints.size(); i++)
+            ok = ints[i] > ints[i - 1];
+        if(ok)
+            splitting.levels.assign(ints.begin(), ints.end());
+    }
+    else if(key == "split_effort")
+        ok = parseInts(value, ints) && ints.size() == 1 && ints[0] >= 1 && (splitting.effort = ints[0], true);
+    else if(key == "cache")
+        ok = !value.empty() && (cacheDirectory = value, true);
+    else if(key == "results")
+        ok = !value.empty() && (resultsFile = value, true);
+    else if(key == "service_distribution")
+        return serviceDistribution.parse(value, error);
+    else if(key == "arrival_distribution")
+        return arrivalDistribution.parse(value, error);
+    else if(key == "arrival_profile")
+        return arrivalProfile.parse(value, error);
+    else if(key == "replay") {
+        ArrivalReplay probe;
+        if(!probe.open(value.c_str(), error))
+            return false;
+        replayFile = value;
+        ok = true;
+    }
+    else {
+        error = "unknown parameter '" + rawKey + "'";
+        return false;
+    }
+
+    if(!ok)
+        error = "bad value '" + value + "' for " + rawKey;
+    return ok;
+
+}
+
+
+bool ScenarioGrid::parseFile(const char *path, string &error) {
+
+    ifstream in(path);
+    if(!in) {
+        error = string("cannot open scenario file ") + path;
+        return false;
+    }
+
+    string line;
+    for(int lineNo = 1; getline(in, line); lineNo++) {
+        size_t hash = line.find('#');
+        if(hash != string::npos)
+            line.erase(hash);
+        if(line.find_first_not_of(" \t\r") == string::npos)
+            continue;
+        size_t equals = line.find('=');
+        vector<string> key = splitList(line.substr(0, equals));
+        if(equals == string::npos || key.size() != 1 || !set(key[0], line.substr(equals + 1), error)) {
+            ostringstream where;
+            where << path << ":" << lineNo << ": " << (equals == string::npos || key.size() != 1 ? "expected key = value" : error);
+            error = where.str();
+            return false;
+        }
+    }
+    return true;
+
+}
+
+
+bool ScenarioGrid::parseArgs(int argc, char **argv, string &error) {
+
+    for(int i = 1; i < argc; i++) {
+        string option(argv[i]);
+        if(option.compare(0, 2, "--") != 0 || i + 1 >= argc) {
+            error = "expected --parameter value, got '" + option + "'";
+            return false;
+        }
+        string value(argv[++i]);
+        if(option == "--scenario") {
+            if(!parseFile(value.c_str(), error))
+                return false;
+        }
+        else if(!set(option.substr(2), value, error))
+            return false;
+    }
+    return true;
+
+}
+
+
+vector<Scenario> ScenarioGrid::expand() {
+    vector<Scenario> grid;
+    for(size_t p = 0; p < routings.size(); p++)
+    for(size_t j = 0; j < jockeying.size(); j++)
+    for(size_t r = 0; r < replications.size(); r++)
+    for(size_t h = 0; h < horizons.size(); h++)
+    for(size_t s = 0; s < serviceTimeMeans.size(); s++)
+    for(size_t a = 0; a < interArrivalTimeMeans.size(); a++)
+    for(size_t t = 0; t < tellers.size(); t++) {
+        Scenario scenario;
+        scenario.numTellers = tellers[t];
+        scenario.interArrivalTimeMean = interArrivalTimeMeans[a];
+        scenario.serviceTimeMean = serviceTimeMeans[s];
+        scenario.horizon = horizons[h];
+        scenario.replications = replications[r];
+        scenario.jockeying = jockeying[j];
+        scenario.routing = routings[p];
+        grid.push_back(scenario);
+    }
+    return grid;
+}
+
+
+bool ScenarioGrid::varies(const string &key) {
+    if(key == "tellers")            return tellers.size() > 1;
+    if(key == "inter_arrival_mean") return interArrivalTimeMeans.size() > 1;
+    if(key == "service_mean")       return serviceTimeMeans.size() > 1;
+    if(key == "horizon")            return horizons.size() > 1;
+    if(key == "replications")       return replications.size() > 1;
+    if(key == "jockeying")          return jockeying.size() > 1;
+    if(key == "routing")            return routings.size() > 1;
+    return false;
+}
+
+
+#ifndef SIMULATOR_NO_MAIN
+
+/** "a, b, c" */
+template <class T>
+static string describe(const vector<T> &values) {
+    ostringstream out;
+    for(size_t i = 0; i < values.size(); i++)
+        out << (i ? ", " : "") << values[i];
+    return out.str();
+}
+
+/** "a to b" for three or more consecutive integers */
+static string describe(const vector<int> &values) {
+    bool consecutive = values.size() > 2;
+    for(size_t i = 1; i < values.size(); i++)
+        consecutive = consecutive && values[i] == values[i - 1] + 1;
+    if(!consecutive)
+        return describe<int>(values);
+    ostringstream out;
+    out << values.front() << " to " << values.back();
+    return out.str();
+}
+
+
+
+int main(int argc, char **argv) {
+
+    ScenarioGrid config;
+    string error;
+    if(!config.parseArgs(argc, argv, error)) {
+        cerr << error << endl;
+        cerr << "usage: " << argv[0] << " [--scenario file] [--tellers 4:9] [--inter-arrival-mean 1.0] [--service-mean 4.5]" << endl
+             << "       [--horizon 480] [--replications 100] [--jockeying on,off] [--threads N] [--batch 0] [--seed S]" << endl
+             << "       [--routing shortest,jiq,power_of_d,shared] [--choices 2] [--jockey-threshold 2]" << endl
+             << "       [--jockey-distance 0] [--balk-at 0] [--patience-mean 0] [--queue-capacity 0]" << endl
+             << "       [--service-distribution exponential|lognormal:cv|gamma:k|empirical:file]" << endl
+             << "       [--arrival-distribution ...] [--arrival-profile 0:0.5,120:1.5]" << endl
+             << "       [--event-list heap|pointer] [--quantiles on|off] [--trace file] [--replay file]" << endl
+             << "       [--crn on|off] [--antithetic on|off] [--precision 0.05] [--steady-state on|off]" << endl
+             << "       [--metrics file] [--metrics-format json|prometheus] [--metrics-interval 1]" << endl
+             << "       [--checkpoint file] [--checkpoint-every 10000] [--start-from file] [--fresh-statistics on|off]" << endl
+             << "       [--branches 1] [--transfer-time 1] [--max-transfers 1] [--shards N] [--shard-transport threads|sockets]" << endl
+             << "       [--split-levels 10,20,30,40,50] [--split-effort 1000] [--cache dir] [--results file]" << endl;
+        return 1;
+    }
+
+    if(!config.arrivalProfile.empty() && config.arrivalDistribution.getKind() != EXPONENTIAL_DISTRIBUTION) {
+        cerr << "an arrival profile needs exponential inter-arrival times" << endl;
+        return 1;
+    }
+
+    /** the branches of a network are run together window by window, which the single run features do not follow */
+    bool network = config.branches > 1;
+    if(network && (!config.replayFile.empty() || !config.traceFile.empty() || config.steadyState || config.delayQuantiles ||
+                   !config.metricsFile.empty() || config.relativePrecision > 0 || !config.checkpointFile.empty() ||
+                   !config.startFromFile.empty())) {
+        cerr << "branches > 1 does not go with replay, trace, steady_state, quantiles, metrics, precision, checkpoint or start_from" << endl;
+        return 1;
+    }
+
+    /** a snapshot has no place for the position in a replay file */
+    if(!config.replayFile.empty() && (!config.checkpointFile.empty() || !config.startFromFile.empty())) {
+        cerr << "replay does not go with checkpoint or start_from" << endl;
+        return 1;
+    }
+    /** a splitting run clones the bank from level to level, on streams of its own */
+    bool splitting = !config.splitting.levels.empty();
+    if(splitting && (network || !config.replayFile.empty() || !config.traceFile.empty() || config.steadyState ||
+                     config.relativePrecision > 0 || config.antithetic || config.commonRandomNumbers ||
+                     !config.checkpointFile.empty() || !config.startFromFile.empty())) {
+        cerr << "split_levels does not go with branches, replay, trace, steady_state, precision, antithetic, crn, checkpoint or start_from" << endl;
+        return 1;
+    }
+
+    /** a pair is one observation, and the interval of a single one would print as a zero width one */
+    if(config.antithetic && !config.steadyState &&
+       *min_element(config.getReplications().begin(), config.getReplications().end()) < 3) {
+        cerr << "antithetic needs at least 3 replications, rounded up to 2 pairs" << endl;
+        return 1;
+    }
+    if(!config.checkpointFile.empty() && config.checkpointEvery <= 0) {
+        cerr << "checkpoint needs checkpoint_every" << endl;
+        return 1;
+    }
+    if(!config.startFromFile.empty() && (int) config.startFrom.tellers > *min_element(config.getTellers().begin(), config.getTellers().end())) {
+        cerr << config.startFromFile << " has " << config.startFrom.tellers << " tellers, runs from it need at least as many" << endl;
+        return 1;
+    }
+
+    int threads = config.threads > 0 ? config.threads : (int) thread::hardware_concurrency();
+    ReplicationRunner runner(threads);
+    runner.setBatchLanes(config.batchLanes);
+    ResultCache cache;
+    if(!config.cacheDirectory.empty()) {
+        if(!cache.open(config.cacheDirectory, error)) {
+            cerr << error << endl;
+            return 1;
+        }
+        runner.setCache(&cache);
+    }
+    ResultWriter resultFile;
+    if(!config.resultsFile.empty()) {
+        if(!resultFile.open(config.resultsFile, error)) {
+            cerr << error << endl;
+            return 1;
+        }
+        runner.setResultFile(&resultFile);
+    }
+    vector<Scenario> grid = config.expand();
+
+    vector<string> jockeyingNames;
+    for(size_t i = 0; i < config.getJockeying().size(); i++)
+        jockeyingNames.push_back(config.getJockeying()[i] ? "on" : "off");
+    vector<string> routingNames;
+    for(size_t i = 0; i < config.getRoutings().size(); i++)
+        routingNames.push_back(routingName(config.getRoutings()[i]));
+    const QueuePolicy &policy = config.policy;
+
+    result << "Multi-teller bank with jockeying " << endl;
+    result << "________________________________________________________________________________" << endl;
+    result << "Total tellers:\t\t\t\t" << describe(config.getTellers()) << endl;
+    result << "Mean inter-arrival time:\t\t" << describe(config.getInterArrivalMeans()) << " minutes" << endl;
+    result << "Mean service time:\t\t\t" << describe(config.getServiceMeans()) << " minutes" << endl;
+    result << "Duration:\t\t\t\t" << describe(config.getHorizons()) << " minutes" << endl;
+    if(config.serviceDistribution.getKind() != EXPONENTIAL_DISTRIBUTION)
+        result << "Service times:\t\t\t\t" << config.serviceDistribution.describe() << endl;
+    if(config.arrivalDistribution.getKind() != EXPONENTIAL_DISTRIBUTION)
+        result << "Inter-arrival times:\t\t\t" << config.arrivalDistribution.describe() << endl;
+    if(!config.arrivalProfile.empty())
+        result << "Arrival rate:\t\t\t\t" << config.arrivalProfile.describe() << " minutes" << endl;
+    if(config.steadyState)
+        result << "Steady state:\t\t\t\tone run per point, batch means after an MSER-5 warm-up" << endl;
+    else
+        result << "Replications:\t\t\t\t" << describe(config.getReplications()) << endl;
+    result << "Jockeying:\t\t\t\t" << describe(jockeyingNames) << endl;
+    if(config.varies("routing") || config.getRoutings()[0] != SHORTEST_QUEUE_ROUTING)
+        result << "Routing:\t\t\t\t" << describe(routingNames) << endl;
+    if(policy.jockeyThreshold != 2 || policy.jockeyDistance > 0) {
+        result << "Jockey rule:\t\t\t\tto a teller with " << policy.jockeyThreshold << " fewer customers";
+        if(policy.jockeyDistance > 0)
+            result << ", at most " << policy.jockeyDistance << " tellers away";
+        result << endl;
+    }
+    if(policy.balkAt > 0)
+        result << "Balking:\t\t\t\tat " << policy.balkAt << " customers waiting" << endl;
+    if(policy.patienceMean > 0)
+        result << "Reneging:\t\t\t\tmean patience " << policy.patienceMean << " minutes" << endl;
+    if(policy.queueCapacity > 0) {
+        int most = *max_element(config.getTellers().begin(), config.getTellers().end());
+        result << "Queue capacity:\t\t\t\t" << policy.queueCapacity << " waiting per teller, at most "
+               << (Simulator::memoryCeiling(most, policy, config.delayQuantiles) + 1023) / 1024 << " KiB per run at " << most << " tellers" << endl;
+    }
+    if(network)
+        result << "Branches:\t\t\t\t" << config.branches << " in a ring, " << config.transferTime << " minutes apart, customers go on at most "
+               << config.maxTransfers << " times" << endl;
+    if(!config.startFromFile.empty())
+        result << "Started from:\t\t\t\t" << config.startFromFile << (config.freshStatistics ? ", statistics from there on" : "") << endl;
+    if(!config.replayFile.empty())
+        result << "Replayed from:\t\t\t\t" << config.replayFile << " (arrival and service times)" << endl;
+    if(splitting)
+        result << "Importance splitting:\t\t\tlevels " << describe(config.splitting.levels) << " of the total queue length, "
+               << config.splitting.effort << " runs per level" << endl;
+
+    /** a steady state run is a single replication, so there is nothing for a plan to do */
+    ReplicationPlan plan;
+    plan.commonRandomNumbers = config.commonRandomNumbers && !config.steadyState;
+    plan.antithetic = config.antithetic && !config.steadyState;
+    plan.relativePrecision = config.steadyState ? 0 : config.relativePrecision;
+    plan.confidence = 0.95;
+
+    /** with any variance reduction the boundaries are the confidence interval of the mean delay across the
+        replications, the quantity the plan works on, instead of the average of the per run intervals */
+    bool acrossReplications = plan.commonRandomNumbers || plan.antithetic || plan.relativePrecision > 0 || network;
+    if(plan.commonRandomNumbers || plan.antithetic)
+        result << "Variance reduction:\t\t\t" << (plan.commonRandomNumbers ? "common random numbers" : "")
+               << (plan.commonRandomNumbers && plan.antithetic ? ", " : "") << (plan.antithetic ? "antithetic pairs" : "") << endl;
+    if(plan.relativePrecision > 0)
+        result << "Target precision:\t\t\t" << plan.relativePrecision * 100 << "% of the mean delay" << endl;
+    if(acrossReplications)
+        result << "Confidence interval:\t\t\t95% across replications" << (plan.antithetic ? " (pair averages)" : "") << endl;
+
+    result << endl << endl;
+
+    /** the parameters that take more than one value get a column of their own in front of the usual ones.
+        under the stopping rule the number of replications run is shown as well */
+    bool showReplications = (config.varies("replications") && !config.steadyState) || plan.relativePrecision > 0;
+    const char *keys[] = { "inter_arrival_mean", "service_mean", "horizon", "replications", "jockeying", "routing" };
+    const char *titles[] = { "IAT mean\t", "Svc mean\t", "Horizon\t\t", "Reps\t", "Jockey\t", "Routing\t\t" };
+    for(int k = 0; k < 6; k++)
+        if(k == 3 ? showReplications : config.varies(keys[k]))
+            result << titles[k];
+    if(splitting)
+        result << "#tellers\tP(queue >= " << config.splitting.levels.back() << ")\tLeft boundary\tRight boundary\tRel. error\tEvents/est.";
+    else
+        result << "#tellers\tAvg q len\tAvg delay\tLeft boundary\tRight boundary";
+    if(config.delayQuantiles && !splitting)
+        result << "\tp50 delay\tp95 delay\tp99 delay";
+    if(config.steadyState)
+        result << "\tWarm-up\t\tBatches";
+    if(policy.balkAt > 0 && !splitting)
+        result << "\tBalked %";
+    if(policy.patienceMean > 0 && !splitting)
+        result << "\tReneged %";
+    if(policy.queueCapacity > 0 && !splitting)
+        result << "\tLost %";
+    if(network)
+        result << "\tTransferred %";
+    result << endl;
     result << "________________________________________________________________________________" << endl;
-
-    for(int numTellers = 4; numTellers <= 9; numTellers++) {
-
-        double accumulatedAverageDelay = 0;
-        double accumulatedQueueLength = 0;
-        double accumulatedRange = 0;
-
-        for(int i = 0; i < RUN_SIMULATION_TIMES; i++) {
-
-            int N = numTellers;
-
-            Simulator* sim = new Simulator(N);
-            timeAvg = new TimeAvgGenerator*[N];
-            for(int i = 0; i < N; i++)
-                timeAvg[i] = new TimeAvgGenerator();
-            avg = new AvgGenerator();
-
-            sim->scheduleEvent(new ArrivalEvent(0.0));
-            sim->setSimulationEndTime(480.0);
-            sim->run();
-
-            delete sim;
-
-            double timeAverage = 0;
-            for(int i = 0; i < N; i++) {
-                timeAverage += timeAvg[i]->timeAvg();
-            }
-
-            accumulatedAverageDelay += avg->avg();
-            accumulatedQueueLength += timeAverage;
-            accumulatedRange += avg->getConfidenceIntervalRange();
-
-            delete avg;
-            for(int i = 0; i < N; i++)
-                delete timeAvg[i];
-            delete timeAvg;
-
-        }
-
-        double averageAverageDelay = accumulatedAverageDelay / RUN_SIMULATION_TIMES;
-        double averageRange = accumulatedRange / RUN_SIMULATION_TIMES;
-        double leftBoundary = averageAverageDelay - averageRange;
-        double rightBoundary = averageAverageDelay + averageRange;
-        double averageQueueLength = accumulatedQueueLength / RUN_SIMULATION_TIMES;
-
-        printf("%d\t\t%-10.6f\t%-10.6f\t%-10.6f\t%-10.6f\n", numTellers, averageQueueLength, averageAverageDelay, leftBoundary, rightBoundary);
-    }
+
+    /** one job per grid point; the runner fills in the replications. without common random numbers every
+        replication of the sweep gets a substream of its own */
+    vector<ReplicationJob> scenarios;
+    vector<int> maxReplications;
+    for(size_t g = 0; g < grid.size(); g++) {
+        ReplicationJob job;
+        job.scenario = g;
+        job.numTellers = grid[g].numTellers;
+        job.replication = 0;
+        job.interArrivalTimeMean = grid[g].interArrivalTimeMean;
+        job.serviceTimeMean = grid[g].serviceTimeMean;
+        job.horizon = grid[g].horizon;
+        job.jockeying = grid[g].jockeying;
+        job.policy = config.policy;
+        job.policy.routing = grid[g].routing;
+        job.serviceDistribution = config.serviceDistribution.getKind() != EXPONENTIAL_DISTRIBUTION ? &config.serviceDistribution : NULL;
+        job.arrivalDistribution = config.arrivalDistribution.getKind() != EXPONENTIAL_DISTRIBUTION ? &config.arrivalDistribution : NULL;
+        job.arrivalProfile = config.arrivalProfile.empty() ? NULL : &config.arrivalProfile;
+        job.masterSeed = config.masterSeed;
+        job.substream = 0;
+        job.eventList = config.eventList;
+        job.delayQuantiles = config.delayQuantiles;
+        job.traceFile = g == 0 ? config.traceFile : string();
+        job.replayFile = config.replayFile;
+        job.antithetic = false;
+        job.synchronizedService = false;
+        job.steadyState = config.steadyState;
+        job.checkpointFile = g == 0 ? config.checkpointFile : string();
+        job.checkpointEvery = config.checkpointEvery;
+        job.startFrom = config.startFromFile.empty() ? NULL : &config.startFrom;
+        job.freshStatistics = config.freshStatistics;
+        job.splitting = splitting ? &config.splitting : NULL;
+        job.fingerprint = 0;
+        scenarios.push_back(job);
+        maxReplications.push_back(config.steadyState ? 1 : grid[g].replications);
+    }
+
+    MetricsExporter *exporter = config.metricsFile.empty() ? NULL :
+                                new MetricsExporter(config.metricsFile, config.metricsFormat, config.metricsInterval);
+    runner.setMetrics(exporter);
+
+    /** a network is one replication spread over the shards, run one at a time */
+    chrono::steady_clock::time_point started = chrono::steady_clock::now();
+    vector<vector<ReplicationResult> > results;
+    long long windows = 0;
+    if(network) {
+        NetworkJob job;
+        job.branches = config.branches;
+        job.transferTime = config.transferTime;
+        job.maxTransfers = config.maxTransfers;
+        job.shards = config.shards > 0 ? config.shards : threads;
+        job.transport = config.shardTransport;
+        if(!BranchNetwork::runScenarios(scenarios, maxReplications, plan, job, results, windows, error,
+                                        resultFile.isOpen() ? &resultFile : NULL)) {
+            cerr << error << endl;
+            return 1;
+        }
+    }
+    else
+        results = runner.runScenarios(scenarios, maxReplications, plan);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+
+    runner.setMetrics(NULL);
+    delete exporter;                 /** writes the last snapshot */
+
+    /** the rows went out as the replications ran */
+    if(resultFile.isOpen()) {
+        runner.setResultFile(NULL);
+        if(!resultFile.close())
+            cerr << "result file " << config.resultsFile << " is incomplete" << endl;
+    }
+
+    long long events = 0;
+    for(size_t g = 0; g < grid.size(); g++) {
+
+        int runs = results[g].size();
+        double accumulatedAverageDelay = 0;
+        double accumulatedQueueLength = 0;
+        double accumulatedRange = 0;
+        double accumulatedQuantiles[3] = { 0, 0, 0 };
+        long long arrivals = 0, balked = 0, reneged = 0, lost = 0, transferred = 0;
+        long long pointEvents = 0;
+        AvgGenerator estimates;
+
+        for(int i = 0; i < runs; i++) {
+            const ReplicationResult &r = results[g][i];
+            accumulatedAverageDelay += r.avgDelay;
+            accumulatedQueueLength += r.avgQueueLength;
+            accumulatedRange += r.confidenceRange;
+            accumulatedQuantiles[0] += r.delayP50;
+            accumulatedQuantiles[1] += r.delayP95;
+            accumulatedQuantiles[2] += r.delayP99;
+            events += r.events;
+            pointEvents += r.events;
+            estimates.pushData(r.tailProbability);
+            arrivals += r.arrivals;
+            balked += r.balked;
+            reneged += r.reneged;
+            lost += r.lost;
+            transferred += r.transferred;
+        }
+
+        double averageAverageDelay = accumulatedAverageDelay / runs;
+        double averageRange = accumulatedRange / runs;
+        if(acrossReplications)
+            ReplicationRunner::acrossReplications(results[g], plan.antithetic, plan.confidence, averageAverageDelay, averageRange);
+        double leftBoundary = averageAverageDelay - averageRange;
+        double rightBoundary = averageAverageDelay + averageRange;
+        double averageQueueLength = accumulatedQueueLength / runs;
+
+        if(config.varies("inter_arrival_mean")) printf("%-10g\t", grid[g].interArrivalTimeMean);
+        if(config.varies("service_mean"))       printf("%-10g\t", grid[g].serviceTimeMean);
+        if(config.varies("horizon"))            printf("%-10g\t", grid[g].horizon);
+        if(showReplications)                    printf("%d\t", runs);
+        if(config.varies("jockeying"))          printf("%s\t", grid[g].jockeying ? "on" : "off");
+        if(config.varies("routing"))            printf("%-10s\t", routingName(grid[g].routing));
+        if(splitting) {
+            double p = estimates.avg(), halfWidth = estimates.getConfidenceIntervalRange();
+            printf("%d\t\t%-10.4e\t%-10.4e\t%-10.4e\t%-10.4f\t%lld\n", grid[g].numTellers, p, p - halfWidth, p + halfWidth,
+                   p > 0 ? halfWidth / p : 0.0, pointEvents / runs);
+            continue;
+        }
+        printf("%d\t\t%-10.6f\t%-10.6f\t%-10.6f\t%-10.6f", grid[g].numTellers, averageQueueLength, averageAverageDelay, leftBoundary, rightBoundary);
+        if(config.delayQuantiles)
+            printf("\t%-10.6f\t%-10.6f\t%-10.6f", accumulatedQuantiles[0] / runs, accumulatedQuantiles[1] / runs, accumulatedQuantiles[2] / runs);
+        if(config.steadyState)
+            printf("\t%-10.6g\t%d", results[g][0].warmupTime, results[g][0].batches);
+        if(policy.balkAt > 0)
+            printf("\t%-8.3f", arrivals ? 100.0 * balked / arrivals : 0.0);
+        if(policy.patienceMean > 0)
+            printf("\t%-8.3f", arrivals ? 100.0 * reneged / arrivals : 0.0);
+        if(policy.queueCapacity > 0)
+            printf("\t%-8.3f", arrivals ? 100.0 * lost / arrivals : 0.0);
+        if(network)
+            printf("\t%-8.3f", arrivals ? 100.0 * transferred / arrivals : 0.0);
+        printf("\n");
+    }
+
+    /** throughput goes to stderr so that the table above stays as it was. it counts the events simulated in
+        this run; the replications read from the cache are reported on a line of their own */
+    long long cachedEvents = network ? 0 : runner.getCachedEvents();
+    cerr << (config.eventList == HEAP_EVENT_LIST ? "heap" : "pointer") << " event list: " << events - cachedEvents << " events in "
+         << seconds << " s, " << (events - cachedEvents) / seconds << " events/s" << endl;
+    if(network)
+        cerr << config.branches << " branches: " << windows << " time windows" << endl;
+    if(!config.cacheDirectory.empty() && !network)
+        cerr << "result cache: " << runner.getCachedReplications() << " replications (" << cachedEvents << " events) read from "
+             << config.cacheDirectory << ", not simulated again" << endl;
 
     return 0;
-
-}
+
+}
+
+#endif
@@ -1,37 +1,50 @@
 #include <queue>
 #include <iostream>
-#include <string>
-#include <fstream>
-#include <random>
-#include <ctime>
-#include <deque>
-#include <iomanip>
+#include <string>
+#include <fstream>
+#include <random>
+#include <ctime>
+#include <deque>
+#include <iomanip>
 #include <cstdlib>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+#include <cmath>
+#include <chrono>
+#include <cstring>
+#include <climits>
+#include <algorithm>
+#include <sstream>
+#include <cstdio>
+#include <mutex>
+#include <condition_variable>
 
 using namespace std;
-
-#define INVALID_TIME             -1.0
-#define INTER_ARRIVAL_TIME_MEAN  1.0
-#define SERVICE_TIME_MEAN        4.5
-#define INFINITY                 99999999
-#define RUN_SIMULATION_TIMES     100
-
-#define result cout
-
-class TimeAvgGenerator;
-class AvgGenerator;
-
-TimeAvgGenerator **timeAvg = NULL;
-AvgGenerator     *avg      = NULL;
+
+#define INVALID_TIME             -1.0
+#define INTER_ARRIVAL_TIME_MEAN  1.0
+#define SERVICE_TIME_MEAN        4.5
+#define RUN_SIMULATION_TIMES     100
+#define SIMULATION_HORIZON       480.0
+
+#define result cout
 
 typedef double t_simtime;
 
 class Simulator;
+struct TransferMessage;
+struct SplittingPlan;
+class ResultCache;
+class ResultWriter;
 
 enum EventType {
     EXIT,
-    ARRIVAL,
-    DEPARTURE
+    ARRIVAL,
+    DEPARTURE,
+    RENEGE,                          /** a waiting customer runs out of patience */
+    TRANSFER                         /** a customer arrives from another branch, see network.h */
 };
 
 class Event {
@@ -54,13 +67,15 @@ class Event {
         inline string getEventName ()   { return this->eventName; }
 
         friend ostream & operator << (ostream & out, Event &e);
-
+
         virtual void processEvent(Simulator *sim) = 0;
-};
-
+        virtual int32_t getArgument()   { return -1; }     /** the tellerId of the event as an EventRecord */
+        virtual ~Event() { }
+};
+
 
 ostream & operator << (ostream & out, Event & e) {
-    out << e.getEventName() << " at " << e.getEventTime() ;
+    out << e.getEventName() << " at " << e.getEventTime() ;
     return out;
 }
 
@@ -71,188 +86,686 @@ class CompareEvent {
         bool operator() (Event* &e1, Event* &e2) {
             return e1->getEventTime() > e2->getEventTime();
         }
-};
-
-
-/** stats generators */
-
-class TimeAvgGenerator {
-
-        double accumulatedValue;
-        double lastRecordedTime;
-        int    lastRecordedValue;
-        int    totalSamples;
-        double maximum;
-        double minimum;
-
-    public:
-        TimeAvgGenerator() {
-            accumulatedValue = 0.0;
-            lastRecordedValue = 0.0;
-            lastRecordedTime = 0.0;
-            totalSamples = 0;
-            maximum = -INFINITY;
-            minimum = +INFINITY;
-        }
-
-        void pushData(int length, t_simtime timeOfRecord) {
-            accumulatedValue += (timeOfRecord - lastRecordedTime) * lastRecordedValue;
-            lastRecordedTime = timeOfRecord;
-            lastRecordedValue = length;
-            totalSamples++;
-            if(length < minimum)
-                minimum = length;
-            if(length > maximum)
-                maximum = length;
-        }
-
-        double timeAvg() {
-            return accumulatedValue / lastRecordedTime;
-        }
-
-        int getSampleCount() {
-            return totalSamples;
-        }
-
-        double getMaxValue() {
-            return maximum;
-        }
-
-        double getMinValue() {
-            return minimum;
-        }
-
-};
-
-
-
-class AvgGenerator {
-
-        t_simtime accumulatedValue;
-        t_simtime valueRecords[1000];
-        int noOfSamples;
-        double maximum;
-        double minimum;
-
-    public:
-        AvgGenerator() {
-            accumulatedValue = 0;
-            noOfSamples = 0;
-            maximum = -INFINITY;
-            minimum = +INFINITY;
-        }
-
-        void pushData(t_simtime value) {
-            accumulatedValue += value;
-            valueRecords[noOfSamples++] = value;
-            if(value < minimum) minimum = value;
-            if(value > maximum) maximum = value;
-        }
-
-        t_simtime getConfidenceIntervalRange() {
-            t_simtime average = this->avg();
-            t_simtime val = 0;
-            for(int i = 0; i < noOfSamples; i++)
-                val += (valueRecords[i] - average)*(valueRecords[i] - average);
-            t_simtime estimOfVariance = val / (noOfSamples - 1);
-            return sqrt(estimOfVariance * estimOfVariance / noOfSamples);
-        }
-
-        t_simtime avg() {
-            return accumulatedValue / noOfSamples;
-        }
-
-        t_simtime getMaximum() {
-            return maximum;
-        }
-
-        t_simtime getMinimum() {
-            return minimum;
-        }
-};
-
-
-
-/** The queue that we mimic is a queue of customers, hence this class.*/
-class Customer {
-
-    public:
-        int customerId;                 /** The ids are 1,2,3,...*/
-        t_simtime arrivalTime;          /** Following are self explanatory.*/
-        t_simtime serviceTimeStartsAt;
-        t_simtime departureTime;
-
-        Customer(int customerId, t_simtime arrivalTime) {
-            this->customerId = customerId;
-            this->arrivalTime = arrivalTime;
-            this->serviceTimeStartsAt = INVALID_TIME;
-            this->departureTime = INVALID_TIME;
-        }
-
-        /** When a customer is destructed, log the arrival and departure times for further calculations.*/
-        ~Customer() {
-            avg->pushData(abs(this->serviceTimeStartsAt - this->arrivalTime));
-        }
-};
-
-/** Exponentially distributed random stream. The mean has to be provided in the constructor. here, [ mean = beta = 1 / (lambda) ] */
-class RandomStream {
-        default_random_engine dre;
-        exponential_distribution<t_simtime> distribution;
-    public:
-        inline RandomStream(t_simtime mean)    { exponential_distribution<t_simtime> temp(1.0/mean); distribution = temp; dre.seed(rand()); }
-        inline t_simtime next()                { t_simtime t = distribution(dre); return t; }
+};
+
+
+#include "checkpoint.h"
+#include "eventlist.h"
+
+
+/** stats generators */
+
+/** Time weighted average of an integer valued quantity, a queue length. The area under the curve is brought up
+    to date only when the value changes, so a change costs O(1) whatever the value did in between, and the
+    average up to any time t, also in the middle of a run, is read in O(1) from the area, the current value and
+    the time of the last change. The value is 0 at time 0, where the average starts unless restarted. */
+class TimeAvgGenerator {
+
+        double    area;                  /** integral of the value from start to lastChange */
+        t_simtime start;
+        t_simtime lastChange;
+        int32_t   value;                 /** held since lastChange */
+        int32_t   maximum;
+        int32_t   minimum;
+        long long changes;
+
+    public:
+        TimeAvgGenerator() {
+            area = 0.0;
+            start = 0.0;
+            lastChange = 0.0;
+            value = 0;
+            maximum = 0;
+            minimum = 0;
+            changes = 0;
+        }
+
+        inline void pushData(int32_t newValue, t_simtime timeOfRecord) {
+            area += (timeOfRecord - lastChange) * value;
+            lastChange = timeOfRecord;
+            value = newValue;
+            changes++;
+            maximum = max(maximum, newValue);
+            minimum = min(minimum, newValue);
+        }
+
+        /** integral of the value from the start up to t, t not before the last change */
+        inline double integral(t_simtime t) {
+            return area + (t - lastChange) * value;
+        }
+
+        /** average over [start, t] */
+        inline double timeAvg(t_simtime t) {
+            return t > start ? integral(t) / (t - start) : 0;
+        }
+
+        /** forgets the past: the average starts over at time t, t not before the last change, from the value held */
+        void restart(t_simtime t) {
+            area = 0.0;
+            start = t;
+            lastChange = t;
+            maximum = value;
+            minimum = value;
+            changes = 0;
+        }
+
+        /** average over [start, last change] */
+        double timeAvg() {
+            return timeAvg(lastChange);
+        }
+
+        inline int32_t current()                { return value; }
+        inline t_simtime getStart()             { return start; }
+        inline long long getSampleCount()       { return changes; }
+        inline int32_t getMaxValue()            { return maximum; }
+        inline int32_t getMinValue()            { return minimum; }
+
+};
+
+
+
+/** standard normal quantile, Acklam's rational approximation */
+inline double normalQuantile(double p) {
+    static const double a[] = { -3.969683028665376e+01, 2.209460984245205e+02, -2.759285104469687e+02,
+                                 1.383577518672690e+02, -3.066479806614716e+01, 2.506628277459239e+00 };
+    static const double b[] = { -5.447609879822406e+01, 1.615858368580409e+02, -1.556989798598866e+02,
+                                 6.680131188771972e+01, -1.328068155288572e+01 };
+    static const double c[] = { -7.784894002430293e-03, -3.223964580411365e-01, -2.400758277161838e+00,
+                                -2.549732539343734e+00, 4.374664141464968e+00, 2.938163982698783e+00 };
+    static const double d[] = { 7.784695709041462e-03, 3.224671290700398e-01, 2.445134137142996e+00, 3.754408661907416e+00 };
+    if(p < 0.02425) {
+        double q = sqrt(-2 * log(p));
+        return (((((c[0]*q + c[1])*q + c[2])*q + c[3])*q + c[4])*q + c[5]) / ((((d[0]*q + d[1])*q + d[2])*q + d[3])*q + 1);
+    }
+    if(p > 1 - 0.02425)
+        return -normalQuantile(1 - p);
+    double q = p - 0.5, r = q * q;
+    return (((((a[0]*r + a[1])*r + a[2])*r + a[3])*r + a[4])*r + a[5])*q / (((((b[0]*r + b[1])*r + b[2])*r + b[3])*r + b[4])*r + 1);
+}
+
+/** Student t quantile t(p, df). Exact for 1 and 2 degrees of freedom, Cornish-Fisher expansion around the
+    normal quantile above that: for p up to 0.975 within 0.12% for df >= 3, for p = 0.995 within 0.8% at df = 3,
+    0.22% at df = 4 and 0.01% for df >= 10 */
+inline double studentTQuantile(double p, long df) {
+    if(df == 1)
+        return tan(M_PI * (p - 0.5));
+    if(df == 2)
+        return (2 * p - 1) / sqrt(2 * p * (1 - p));
+    double z = normalQuantile(p), z2 = z * z, v = (double) df;
+    double g1 = (z2 + 1) * z / 4;
+    double g2 = ((5 * z2 + 16) * z2 + 3) * z / 96;
+    double g3 = (((3 * z2 + 19) * z2 + 17) * z2 - 15) * z / 384;
+    double g4 = ((((79 * z2 + 776) * z2 + 1482) * z2 - 1920) * z2 - 945) * z / 92160;
+    return z + g1 / v + g2 / (v * v) + g3 / (v * v * v) + g4 / (v * v * v * v);
+}
+
+
+/** Log-linear histogram in the style of HdrHistogram, for delay quantiles. Values are counted in units of
+    QUANTILE_RESOLUTION; below 2^(QUANTILE_SUB_BITS + 1) units every unit has its own bucket, above that every
+    power of two is split in 2^QUANTILE_SUB_BITS buckets, so a quantile is off by at most 1/64 of its value.
+    The bucket array has a fixed size, and two histograms merge by adding their counts. */
+
+#define QUANTILE_RESOLUTION      1e-3
+#define QUANTILE_SUB_BITS        6
+#define QUANTILE_MAX_EXPONENT    47
+#define QUANTILE_BUCKETS         ((2 << QUANTILE_SUB_BITS) + (QUANTILE_MAX_EXPONENT - QUANTILE_SUB_BITS) * (1 << QUANTILE_SUB_BITS))
+
+class QuantileHistogram {
+
+        uint64_t counts[QUANTILE_BUCKETS];
+        uint64_t total;
+
+        static int bucketOf(uint64_t units) {
+            if(units < (2u << QUANTILE_SUB_BITS))
+                return (int) units;
+            int exponent = 63 - __builtin_clzll(units);
+            if(exponent > QUANTILE_MAX_EXPONENT)
+                return QUANTILE_BUCKETS - 1;
+            int sub = (int) (units >> (exponent - QUANTILE_SUB_BITS)) & ((1 << QUANTILE_SUB_BITS) - 1);
+            return (2 << QUANTILE_SUB_BITS) + (exponent - QUANTILE_SUB_BITS - 1) * (1 << QUANTILE_SUB_BITS) + sub;
+        }
+
+        /** midpoint of a bucket, in units */
+        static double valueOf(int bucket) {
+            if(bucket < (2 << QUANTILE_SUB_BITS))
+                return bucket;
+            int octave = (bucket - (2 << QUANTILE_SUB_BITS)) >> QUANTILE_SUB_BITS;
+            int sub = bucket & ((1 << QUANTILE_SUB_BITS) - 1);
+            int exponent = octave + QUANTILE_SUB_BITS + 1;
+            double width = ldexp(1.0, exponent - QUANTILE_SUB_BITS);
+            return ldexp(1.0, exponent) + sub * width + width / 2;
+        }
+
+    public:
+        QuantileHistogram() {
+            memset(counts, 0, sizeof(counts));
+            total = 0;
+        }
+
+        inline void pushData(double value) {
+            uint64_t units = value <= 0 ? 0 : (uint64_t) (value / QUANTILE_RESOLUTION);
+            counts[bucketOf(units)]++;
+            total++;
+        }
+
+        void merge(const QuantileHistogram &other) {
+            for(int i = 0; i < QUANTILE_BUCKETS; i++)
+                counts[i] += other.counts[i];
+            total += other.total;
+        }
+
+        /** smallest recorded value v such that at least a fraction q of the values are <= v */
+        double quantile(double q) {
+            if(total == 0)
+                return 0;
+            uint64_t rank = (uint64_t) ceil(q * total);
+            if(rank < 1)
+                rank = 1;
+            uint64_t seen = 0;
+            for(int i = 0; i < QUANTILE_BUCKETS; i++) {
+                seen += counts[i];
+                if(seen >= rank)
+                    return valueOf(i) * QUANTILE_RESOLUTION;
+            }
+            return valueOf(QUANTILE_BUCKETS - 1) * QUANTILE_RESOLUTION;
+        }
+
+        inline uint64_t getSampleCount()   { return total; }
+};
+
+
+/** Streaming mean and variance (Welford's update, merged with Chan et al.'s pairwise formula), so the memory
+    used does not depend on how many customers a run serves. Quantiles are kept only when asked for. */
+class AvgGenerator {
+
+        long long noOfSamples;
+        t_simtime mean;
+        t_simtime sumOfSquaredDeviations;
+        t_simtime maximum;
+        t_simtime minimum;
+        QuantileHistogram *quantiles;   /** NULL unless quantiles were asked for */
+
+    public:
+        AvgGenerator(bool keepQuantiles = false) {
+            noOfSamples = 0;
+            mean = 0;
+            sumOfSquaredDeviations = 0;
+            maximum = 0;
+            minimum = 0;
+            quantiles = keepQuantiles ? new QuantileHistogram() : NULL;
+        }
+
+        ~AvgGenerator() {
+            delete quantiles;
+        }
+
+        void pushData(t_simtime value) {
+            noOfSamples++;
+            t_simtime delta = value - mean;
+            mean += delta / noOfSamples;
+            sumOfSquaredDeviations += delta * (value - mean);
+            if(noOfSamples == 1 || value < minimum) minimum = value;
+            if(noOfSamples == 1 || value > maximum) maximum = value;
+            if(quantiles)
+                quantiles->pushData(value);
+        }
+
+        /** folds the samples of another generator into this one, e.g. the results of another thread */
+        void merge(const AvgGenerator &other) {
+            if(other.noOfSamples == 0)
+                return;
+            if(noOfSamples == 0 || other.minimum < minimum) minimum = other.minimum;
+            if(noOfSamples == 0 || other.maximum > maximum) maximum = other.maximum;
+            long long n = noOfSamples + other.noOfSamples;
+            t_simtime delta = other.mean - mean;
+            sumOfSquaredDeviations += other.sumOfSquaredDeviations + delta * delta * noOfSamples * other.noOfSamples / n;
+            mean += delta * other.noOfSamples / n;
+            noOfSamples = n;
+            if(quantiles && other.quantiles)
+                quantiles->merge(*other.quantiles);
+        }
+
+        t_simtime variance() {
+            return noOfSamples > 1 ? sumOfSquaredDeviations / (noOfSamples - 1) : 0;
+        }
+
+        /** back to no samples; the quantile histogram, if any, is kept and emptied */
+        void reset() {
+            bool keepQuantiles = quantiles != NULL;
+            delete quantiles;
+            noOfSamples = 0;
+            mean = 0;
+            sumOfSquaredDeviations = 0;
+            maximum = 0;
+            minimum = 0;
+            quantiles = keepQuantiles ? new QuantileHistogram() : NULL;
+        }
+
+        /** half width of the confidence interval of the mean: t(1 - alpha/2, n - 1) * s / sqrt(n) */
+        t_simtime getConfidenceIntervalRange(double confidence = 0.95) {
+            if(noOfSamples < 2)
+                return 0;
+            double t = studentTQuantile(1 - (1 - confidence) / 2, noOfSamples - 1);
+            return t * sqrt(variance() / noOfSamples);
+        }
+
+        t_simtime avg() {
+            return mean;
+        }
+
+        t_simtime quantile(double q) {
+            return quantiles ? quantiles->quantile(q) : 0;
+        }
+
+        inline bool hasQuantiles()     { return quantiles != NULL; }
+
+        void save(StateWriter &out) const {
+            out.put(noOfSamples);
+            out.put(mean);
+            out.put(sumOfSquaredDeviations);
+            out.put(maximum);
+            out.put(minimum);
+            out.put(quantiles != NULL);
+            if(quantiles)
+                out.put(*quantiles);
+        }
+
+        /** the quantile histogram comes and goes with the saved one */
+        bool restore(StateReader &in) {
+            bool keepQuantiles = false;
+            in.get(noOfSamples);
+            in.get(mean);
+            in.get(sumOfSquaredDeviations);
+            in.get(maximum);
+            in.get(minimum);
+            in.get(keepQuantiles);
+            delete quantiles;
+            quantiles = keepQuantiles ? new QuantileHistogram() : NULL;
+            if(quantiles)
+                in.get(*quantiles);
+            return in.ok();
+        }
+
+        long long getSampleCount() {
+            return noOfSamples;
+        }
+
+        t_simtime getMaximum() {
+            return maximum;
+        }
+
+        t_simtime getMinimum() {
+            return minimum;
+        }
+
+    private:
+        AvgGenerator(const AvgGenerator &);
+        AvgGenerator &operator = (const AvgGenerator &);
+};
+
+
+
+/** The queue that we mimic is a queue of customers, hence this class.*/
+class Customer {
+
+    public:
+        int customerId;                 /** The ids are 1,2,3,...*/
+        t_simtime arrivalTime;          /** Following are self explanatory.*/
+        t_simtime serviceTimeStartsAt;
+        t_simtime departureTime;
+        t_simtime serviceTime;          /** recorded service duration when replaying (see replay.h), else INVALID_TIME */
+        int32_t queue;                  /** teller whose queue the customer is in, -1 for the shared queue */
+        bool renegePending;             /** a renege event for this customer is still in the event list */
+        int32_t transfers;              /** times the customer was sent on to another branch */
+
+        Customer() {
+            this->customerId = 0;
+            this->arrivalTime = INVALID_TIME;
+            this->serviceTimeStartsAt = INVALID_TIME;
+            this->departureTime = INVALID_TIME;
+            this->serviceTime = INVALID_TIME;
+            this->queue = -1;
+            this->renegePending = false;
+            this->transfers = 0;
+        }
+
+        Customer(int customerId, t_simtime arrivalTime) {
+            this->customerId = customerId;
+            this->arrivalTime = arrivalTime;
+            this->serviceTimeStartsAt = INVALID_TIME;
+            this->departureTime = INVALID_TIME;
+            this->serviceTime = INVALID_TIME;
+            this->queue = -1;
+            this->renegePending = false;
+            this->transfers = 0;
+        }
+
+        inline t_simtime delay()                { return this->serviceTimeStartsAt - this->arrivalTime; }
+};
+
+#include "customerpool.h"
+#include "streams.h"
+#include "distributions.h"
+#include "tellerindex.h"
+#include "simdscan.h"
+#include "kernels.h"
+#include "trace.h"
+#include "replay.h"
+#include "steadystate.h"
+#include "metrics.h"
+
+/** Random stream of the given mean, exponentially distributed unless a shape is given (see distributions.h).
+    here, for the exponential, [ mean = beta = 1 / (lambda) ]. The stream is identified by the master seed, the
+    substream of the replication and the stream id (see streams.h). Samples are drawn SAMPLE_BLOCK at a time. */
+class RandomStream {
+        StreamEngine engine;
+        t_simtime mean;
+        const Distribution *shape;       /** NULL: exponential */
+        t_simtime block[SAMPLE_BLOCK];
+        int used;                        /** samples of block[] already handed out */
+
+        void refill() {
+            if(shape)
+                shape->fill(engine, mean, block, SAMPLE_BLOCK);
+            else
+                for(int i = 0; i < SAMPLE_BLOCK; i++)
+                    block[i] = -mean * log(engine.nextUniform());
+            used = 0;
+        }
+
+    public:
+        inline RandomStream(t_simtime mean, uint64_t masterSeed, uint32_t substream, uint32_t streamId, bool antithetic = false,
+                            const Distribution *shape = NULL)
+                                               : engine(masterSeed, substream, streamId, antithetic) {
+            this->mean = mean;
+            this->shape = shape;
+            used = SAMPLE_BLOCK;
+        }
+        inline t_simtime next()                { if(used == SAMPLE_BLOCK) refill(); return block[used++]; }
+
+        /** the engine, the mean and the samples drawn but not handed out yet; the shape stays the stream's own */
+        void save(StateWriter &out) const {
+            out.put(engine);
+            out.put(mean);
+            out.putArray(block, SAMPLE_BLOCK);
+            out.put(used);
+        }
+
+        bool restore(StateReader &in) {
+            in.get(engine);
+            in.get(mean);
+            in.getArray(block, SAMPLE_BLOCK);
+            in.get(used);
+            return in.ok() && used >= 0 && used <= SAMPLE_BLOCK;
+        }
+};
+
+/** what one teller did during a run, for the per teller rows of a result file (see results.h) */
+struct TellerTotals {
+    long long served;                /** customers who left from this teller */
+    double delaySum;                 /** their delays */
+    double busyTime;                 /** time spent serving them */
+    long long jockeysIn;             /** customers who jockeyed to this teller's queue */
 };
 
 class Simulator {
-
+
     private:
+        EventListKind eventListKind;     /** which of the two event lists below is in use */
         priority_queue<Event*, vector<Event*>, CompareEvent>  *eventQueue;
-        t_simtime simclock;
-
-        deque<Customer*> **Q;            /** the queue of customers */
-        bool *serverBusy;                /** used to check if the server is currently busy or not*/
-        Customer **customerBeingServed;  /** the customer currently being served.*/
-        int customerIdRecord;            /** used to generate the customer ids sequentially 1->2->3->...*/
+        EventHeap eventHeap;
+        t_simtime simclock;
+        long long eventCount;            /** events processed by run() so far */
+        long long restoredEvents;        /** of them, the ones counted before the snapshot restore() took over */
+
+        CustomerPool customers;          /** every customer in the bank lives here, the rest of the simulator holds handles */
+        CustomerQueue **Q;               /** the queue of customers */
+        int32_t *tellerState;            /** one block holding queueLength[N], serverBusy[N] and tellerLoad[N], see kernels.h */
+        int32_t *queueLength;            /** Q[i]->size(), kept contiguous for the selection scans */
+        int32_t *serverBusy;             /** used to check if the server is currently busy or not*/
+        int32_t *tellerLoad;             /** queueLength + serverBusy, what arrivals and jockeys compare */
+        t_customer *customerBeingServed; /** the customer currently being served, NO_CUSTOMER if none.*/
+        int customerIdRecord;            /** used to generate the customer ids sequentially 1->2->3->...*/
+        int statisticsFromId;            /** customers up to this id came before the statistics were restarted */
         t_simtime serviceEndsAt;         /** used to schedule next arrival, next arrival scheduled only when time complies*/
-
-        int N;                           /** number of tellers */
+        t_simtime arrivalAfterEnd;       /** the arrival drawn past the end time, INVALID_TIME if none. a later end
+                                             time (see setSimulationEndTime) lets it in */
+
+        int N;                           /** number of tellers */
+        uint64_t masterSeed;             /** the key of the random streams, see reseed() */
+        uint32_t substream;
+        bool antithetic;
+        t_simtime interArrivalTimeMean;
+        t_simtime serviceTimeMean;
+        bool jockeying;                  /** customers jockey on departures, on by default */
+        QueuePolicy policy;              /** routing and its parameters, see kernels.h */
+        CustomerQueue sharedQueue;       /** the single queue of shared routing, empty otherwise */
+        long long balked;                /** customers who did not join a queue */
+        long long reneged;               /** customers who left a queue unserved */
+        long long lost;                  /** customers turned away by a full queue or a full customer pool */
+        t_simtime runLimit;              /** run() stops before the first event at or after this time */
+        int32_t stopAtQueueLength;       /** run() also stops after the event that brings the total queue length
+                                             to this, see runUntilQueueLength */
+
+        vector<TransferMessage> *outbox; /** NULL unless the bank is a branch of a network, see network.h */
+        int branch;                      /** this branch and the number of branches of the network */
+        int branches;
+        t_simtime transferTime;          /** time a customer takes to the next branch */
+        int maxTransfers;                /** times a customer may be sent on before balking for good */
+        long long transferred;           /** customers sent on to the next branch */
+        long long received;              /** customers sent here from another branch */
+        long long transferSequence;      /** messages sent so far, orders messages of equal time */
+        bool synchronizedService;        /** service times drawn per customer on arrival, see setSynchronizedService */
+
+        TellerIndex *tellerIndex;        /** NULL below TELLER_INDEX_MIN_TELLERS tellers, where the scans are faster */
+        TraceWriter *trace;              /** NULL unless the run is traced, see trace.h */
+        ArrivalReplay *replay;           /** NULL unless arrivals and service times are replayed, see replay.h */
+        SteadyStateEstimator *steadyState; /** NULL unless the run is a steady state run, see steadystate.h */
+        SimulatorMetrics *metrics;       /** NULL unless the event loop is instrumented, see metrics.h */
+        const Distribution *serviceDistribution;   /** NULL: exponential service, see distributions.h */
+        const Distribution *arrivalDistribution;   /** NULL: exponential inter-arrival times */
+        const ArrivalProfile *arrivalProfile;      /** NULL: a constant arrival rate */
+
+        void allocateTellers(int N);
+        void releaseTellers();
+        void pushRecord(const EventRecord &event);                   /** into whichever event list is in use */
+
+        /** to be called after every change of Q[tellerId] or serverBusy[tellerId]. the queue length statistics
+            of the teller and of the whole bank are only touched when the length actually changed */
+        inline void tellerChanged(int tellerId)  {
+            int32_t length = Q[tellerId]->size();
+            if(length != queueLength[tellerId]) {
+                timeAvg[tellerId].pushData(length, simclock);
+                totalQueueLength.pushData(totalQueueLength.current() + length - queueLength[tellerId], simclock);
+                queueLength[tellerId] = length;
+                if(totalQueueLength.current() >= stopAtQueueLength)
+                    runLimit = -HUGE_VAL;
+            }
+            tellerLoad[tellerId] = queueLength[tellerId] + serverBusy[tellerId];
+            if(tellerIndex)
+                tellerIndex->update(tellerId, queueLength[tellerId], serverBusy[tellerId]);
+        }
+
+        /** same for the shared queue, which only counts in the total */
+        inline void sharedQueueChanged(int32_t oldLength) {
+            totalQueueLength.pushData(totalQueueLength.current() + (int32_t) sharedQueue.size() - oldLength, simclock);
+            if(totalQueueLength.current() >= stopAtQueueLength)
+                runLimit = -HUGE_VAL;
+        }
 
-    public:
-        RandomStream *serviceTimeStream;                            /** two exponentially distributed random stream to mimic randomness */
-        RandomStream *interArrivalTimeStream;
+        inline void traceEvent(TraceKind kind, t_customer C, int fromTeller, int toTeller) {
+            if(trace)
+                trace->append(now(), customers[C].customerId, kind, fromTeller, toTeller);
+        }
+
+        /** service time of the customer who just went into service at tellerId */
+        inline t_simtime serviceTimeAt(int tellerId) {
+            if(replay || synchronizedService) {
+                t_simtime recorded = customers[customerBeingServed[tellerId]].serviceTime;
+                if(recorded != INVALID_TIME)     /** else restored from a run without, see checkpoint.h */
+                    return recorded;
+            }
+            return serviceTimeStream[tellerId]->next();
+        }
+
+        inline TellerView tellerView() {
+            TellerView v = { N, queueLength, serverBusy, tellerLoad, tellerIndex, routingEngine, &policy };
+            return v;
+        }
+
+        /** the event loop and the event routines, compiled per teller count and policy (kernels.h) */
+        template <class Routing> void dispatchJockeying();
+        template <class Routing, class Jockeying> void dispatchKernel();
+        template <int FIXED_N, class Routing, class Jockeying> void runKernel();
+        template <int FIXED_N, class Routing, class Jockeying> void processRecord(const EventRecord &event);
+        void eventTimed(int type, chrono::steady_clock::time_point started);
+        template <int FIXED_N, class Routing> void arrive();
+        template <int FIXED_N, class Routing> void join(t_customer C);
+        template <int FIXED_N, class Routing> void transferIn(t_customer C);
+        template <int FIXED_N, class Routing, class Jockeying> void depart(int tellerId);
+        void jockeyFrom(int jumperJockeysFrom, int tellerId);
+        void takeFromSharedQueue(int tellerId);
 
-        void scheduleEvent(Event *event);
+        TimeAvgGenerator *timeAvg;       /** per teller time averaged queue length. owned by this simulator, so that replications can run in parallel */
+        TimeAvgGenerator totalQueueLength;  /** the sum of the queue lengths of all tellers */
+        AvgGenerator *avg;               /** delay of the customers served by this simulator */
+        TellerTotals *tellerTotals;      /** per teller, counted on departures and jockeys */
+
+    public:
+        RandomStream **serviceTimeStream;                           /** exponentially distributed random streams to mimic randomness, */
+        RandomStream *interArrivalTimeStream;                       /** one for the arrivals and one for the service of each teller */
+        RandomStream *customerServiceStream;                        /** service times in arrival order, when synchronized */
+        RandomStream *patienceStream;                               /** patience of the customers, mean 1, scaled by patienceMean */
+        StreamEngine *routingEngine;                                /** for the randomized routing policies */
+        StreamEngine *thinningEngine;                               /** keeps or drops candidate arrivals under a profile */
+
+        void scheduleEvent(Event *event);                           /** pointer event list only */
+        void scheduleArrival(t_simtime time);                       /** these two work with both event lists */
+        void scheduleDeparture(t_simtime time, int tellerId);
+        void scheduleRenege(t_simtime time, t_customer C);
+        t_simtime nextArrivalAfter(t_simtime time);                 /** time of the arrival after one at time, drawn */
+        t_simtime thinArrivals(t_simtime candidate);                /** first candidate from this one on kept by the arrival profile */
         void setSimulationEndTime(t_simtime endTime);
         void run();
-        t_simtime now();
-
-        void makeServerBusy(int tellerId);                          /** pops one from Q and adds to service. Everyone thus should join Q straightway,
-                                                                    and then make a call to this if server is free. This also updates the customer's
-                                                                    service start time.*/
-        void makeServerIdle(int tellerId);                          /** makes the server idle by setting the necessary flags (server busy,
-                                                                    customer being served) and also
-                                                                    updates the customer's departure time record. if the server is free, does nothing.*/
-        int getFreeTellerId();                                      /** upon arrival, we look for a free teller. If the teller free then the customer
-                                                                    joins the service immediately. This method serves the purpose. */
-        int getShortestQuedTellerId();                              /** in case no free teller, the customer will join the teller with shortest queue.
-                                                                    this method serves this particular purpose */
-        int getJockeyableQueueId(int tellerId);                     /** in case a customer leaves a service, in particular, when a queue length at some teller
-                                                                    we will have to look around to see if is shortened, we have to look around to find
-                                                                    the leftmost Q that has a customer who can jockey. In brief, the customer at the tail
-                                                                    of the jockey-able Q will jockey. */
-        void jockey(int);                                           /** the event of jockeying is handled here separately as a non-event routine. this
-                                                                    routine is invoked from the departure event routine, where the queue from which a
-                                                                    departure has occurred is passed as the argument */
-
-        inline void addCustomerToQueue(Customer *C, int tellerId)   { Q[tellerId]->push_back(C); timeAvg[tellerId]->pushData(Q[tellerId]->size(), now()); }
-        inline bool isServerBusy(int tellerId)                      { return serverBusy[tellerId]; }
-        inline int nextCustomerId()                                 { return ++customerIdRecord; }
-        inline t_simtime serviceEndTime()                           { return serviceEndsAt; }
-
-        Simulator(int);
+        void runUntil(t_simtime limit);                             /** runs the events before limit, leaves the rest in the event list */
+        bool runUntilQueueLength(int32_t level, t_simtime limit);   /** same, but stops right after the event that brings the total
+                                                                    queue length to level; true if it got there, see splitting.h */
+        t_simtime nextEventTime();                                  /** time of the first event in the event list, HUGE_VAL if none */
+        t_simtime now();
+
+        void handleArrival();                                       /** the event routines. shared by the Event classes and the switch in run() */
+        void handleDeparture(int tellerId);
+        void handleRenege(t_customer C);
+        void handleTransfer(t_customer C);
+
+        void makeServerBusy(int tellerId);                          /** pops one from Q and adds to service. Everyone thus should join Q straightway,
+                                                                    and then make a call to this if server is free. This also updates the customer's
+                                                                    service start time.*/
+        void makeServerIdle(int tellerId);                          /** makes the server idle by setting the necessary flags (server busy,
+                                                                    customer being served) and also
+                                                                    updates the customer's departure time record. if the server is free, does nothing.*/
+        int getFreeTellerId();                                      /** upon arrival, we look for a free teller. If the teller free then the customer
+                                                                    joins the service immediately. This method serves the purpose. */
+        int getShortestQuedTellerId();                              /** in case no free teller, the customer will join the teller with shortest queue.
+                                                                    this method serves this particular purpose */
+        int getJockeyableQueueId(int tellerId);                     /** in case a customer leaves a service, in particular, when a queue length at some teller
+                                                                    we will have to look around to see if is shortened, we have to look around to find
+                                                                    the leftmost Q that has a customer who can jockey. In brief, the customer at the tail
+                                                                    of the jockey-able Q will jockey. */
+        void jockey(int);                                           /** the event of jockeying is handled here separately as a non-event routine. this
+                                                                    routine is invoked from the departure event routine, where the queue from which a
+                                                                    departure has occurred is passed as the argument */
+
+        inline void addCustomerToQueue(t_customer C, int tellerId)  { Q[tellerId]->push_back(C); customers[C].queue = tellerId; tellerChanged(tellerId); }
+        inline bool isServerBusy(int tellerId)                      { return serverBusy[tellerId]; }
+        inline int nextCustomerId()                                 { return ++customerIdRecord; }
+        inline t_simtime serviceEndTime()                           { return serviceEndsAt; }
+
+        inline int getTellerCount()                                 { return N; }
+        inline long long getEventCount()                            { return eventCount; }
+        inline long long getEventsRun()                             { return eventCount - restoredEvents; }   /** since reset() or restore() */
+        inline TimeAvgGenerator *getQueueLengthStats(int tellerId)  { return &timeAvg[tellerId]; }
+        inline TimeAvgGenerator *getTotalQueueLengthStats()         { return &totalQueueLength; }   /** timeAvg(now()) is the mean total queue length so far */
+        inline double queueLengthIntegral()                         { return totalQueueLength.integral(simclock); }
+        inline AvgGenerator *getDelayStats()                        { return avg; }
+        inline CustomerPool &getCustomerPool()                      { return customers; }
+        inline void setJockeying(bool enabled)                      { jockeying = enabled; }
+        void setPolicy(const QueuePolicy &policy);                  /** call after reset(), before run() */
+        inline const QueuePolicy &getPolicy()                       { return policy; }
+        inline long long getArrivalCount()                          { return customerIdRecord - statisticsFromId - received; }  /** from outside, not by transfer */
+        inline long long getBalkCount()                             { return balked; }
+        inline long long getRenegeCount()                           { return reneged; }
+        inline long long getLossCount()                             { return lost; }
+        inline const TellerTotals &getTellerTotals(int tellerId)    { return tellerTotals[tellerId]; }
+        long long getJockeyCount();                                 /** over all tellers */
+        double getUtilization(int tellerId);                        /** fraction of the time since the statistics started that
+                                                                    the teller was serving, services up to now() counted */
+        double getUtilization();                                    /** the same averaged over the tellers */
+
+        /** with a queue capacity, the most customer records a run keeps: the ones waiting and in service, and
+            as many again under reneging for the served customers whose renege event is still pending */
+        static size_t customerLimit(int N, const QueuePolicy &policy);
+
+        /** bytes the state of a run with N tellers can take at most under the policy's queue capacity, 0 if it
+            has none: the customer pool, the queue rings, the event list, the per teller arrays and streams */
+        static size_t memoryCeiling(int N, const QueuePolicy &policy, bool delayQuantiles);
+        inline long long getTransferCount()                         { return transferred; }
+
+        /** makes this bank branch number branch of a network of branches: a customer who would balk is sent on to
+            branch + 1 (mod branches), where it arrives transferTime later, at most maxTransfers times. the
+            messages go to outbox; NULL makes the bank stand alone again */
+        void setNetwork(vector<TransferMessage> *outbox, int branch, int branches, t_simtime transferTime, int maxTransfers);
+        void injectTransfer(const TransferMessage &message);        /** schedules the arrival of a customer sent here */
+        inline EventListKind getEventListKind()                     { return eventListKind; }
+        inline void setTrace(TraceWriter *trace)                    { this->trace = trace; }   /** NULL stops tracing */
+        inline void setReplay(ArrivalReplay *replay)                { this->replay = replay; } /** NULL goes back to the random streams */
+        inline void setSteadyState(SteadyStateEstimator *estimator) { steadyState = estimator; }  /** batches the delays up to the end time */
+        inline void setMetrics(SimulatorMetrics *metrics)           { this->metrics = metrics; }   /** NULL switches the instrumentation off */
+
+        /** shapes of the service and inter-arrival times and the arrival rate profile of the runs from the next
+            reset() on. NULL for the original exponential times at a constant rate; the objects must outlive the runs */
+        inline void setDistributions(const Distribution *service, const Distribution *arrival, const ArrivalProfile *profile) {
+            serviceDistribution = service;
+            arrivalDistribution = arrival;
+            arrivalProfile = profile;
+        }
+
+        /** common random numbers: every customer draws its service time on arrival from one stream, instead of
+            the teller drawing it when service starts, so runs with the same substream but different teller
+            counts or policies see the very same customers */
+        inline void setSynchronizedService(bool enabled)            { synchronizedService = enabled; }
+
+        /** makes this simulator a fresh, empty bank with the given parameters, reusing the memory of the previous run.
+            antithetic runs draw 1 - u wherever the plain run on the same substream draws u */
+        void reset(int N, uint64_t masterSeed, uint32_t substream, t_simtime interArrivalTimeMean, t_simtime serviceTimeMean,
+                   bool antithetic = false);
+
+        /** new random streams for the rest of the run, as reset() with these parameters would make them. a
+            run restored from a snapshot keeps the streams it was saved with unless reseeded */
+        void reseed(uint64_t masterSeed, uint32_t substream, t_simtime interArrivalTimeMean, t_simtime serviceTimeMean,
+                    bool antithetic = false);
+        bool hasSeed(uint64_t masterSeed, uint32_t substream, t_simtime interArrivalTimeMean, t_simtime serviceTimeMean,
+                     bool antithetic = false);                      /** the streams are the ones reseed() with these would make */
+
+        /** the state of the bank into snapshot, see checkpoint.h. between events only, not while replaying */
+        void saveState(SimulatorSnapshot &snapshot);
+
+        /** the bank as it was when the snapshot was taken, with tellers tellers (0: as many as then). tellers
+            beyond the saved ones open idle at the snapshot time, with service streams of their own. false with a
+            message, and an empty bank, if the snapshot is damaged, has more tellers, or was taken with or without
+            a shared queue when this simulator's routing is the other way. call after setPolicy() */
+        bool restoreState(const SimulatorSnapshot &snapshot, int tellers, string &error);
+
+        /** delays, queue lengths and counts start over now; the bank itself stays as it is. for runs restored
+            from a snapshot that should only report what happened after it */
+        void restartStatistics();
+
+        inline void enableDelayQuantiles()                          { if(!avg->hasQuantiles()) { delete avg; avg = new AvgGenerator(true); } }  /** call before run() */
+
+        Simulator(int N, uint64_t masterSeed, uint32_t substream, EventListKind eventListKind = HEAP_EVENT_LIST,
+                  t_simtime interArrivalTimeMean = INTER_ARRIVAL_TIME_MEAN, t_simtime serviceTimeMean = SERVICE_TIME_MEAN);
         ~Simulator();
-
+
 };
 
 class EndEvent : public Event {
@@ -268,14 +781,39 @@ class ArrivalEvent : public Event {
         ArrivalEvent(t_simtime time, EventType type, string name);
         ArrivalEvent(t_simtime time);
         void processEvent(Simulator *sim);
-};
-
-class DepartureEvent : public Event {
-        int tellerId;             /** this is needed because in the event of a departure, we need to invoke jockey.
-                                      To do jockeying, we have to know which teller was serving him, therefore this.*/
-    public:
-        DepartureEvent(t_simtime time, int tellerId, EventType type, string name);
-        DepartureEvent(t_simtime time, int tellerId);
-        void processEvent(Simulator *sim);
-        inline int getTellerId() { return tellerId; }
-};
+};
+
+class DepartureEvent : public Event {
+        int tellerId;             /** this is needed because in the event of a departure, we need to invoke jockey.
+                                      To do jockeying, we have to know which teller was serving him, therefore this.*/
+    public:
+        DepartureEvent(t_simtime time, int tellerId, EventType type, string name);
+        DepartureEvent(t_simtime time, int tellerId);
+        void processEvent(Simulator *sim);
+        int32_t getArgument()    { return tellerId; }
+        inline int getTellerId() { return tellerId; }
+};
+
+class TransferEvent : public Event {
+        t_customer customer;
+    public:
+        TransferEvent(t_simtime time, t_customer customer);
+        void processEvent(Simulator *sim);
+        int32_t getArgument()    { return (int32_t) customer; }
+};
+
+class RenegeEvent : public Event {
+        t_customer customer;
+    public:
+        RenegeEvent(t_simtime time, t_customer customer);
+        void processEvent(Simulator *sim);
+        int32_t getArgument()    { return (int32_t) customer; }
+};
+
+#include "replication.h"
+#include "splitting.h"
+#include "resultcache.h"
+#include "results.h"
+#include "batch.h"
+#include "network.h"
+#include "scenario.h"
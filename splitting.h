@@ -0,0 +1,89 @@
+/** Rare event estimation by importance splitting (fixed effort splitting, Garvels and Kroese 1998). The
+    quantity is the probability that the total queue length of the bank reaches a target level L during the
+    day, before the arrivals stop at the horizon. With enough tellers that is far too rare for plain
+    replications to see. The way up to L is cut by levels L1 < L2 < ... < Lm = L:
+
+        stage 1      effort runs from an empty bank, each until the total queue reaches L1 or the arrivals
+                     are over; p1 is the fraction that got there, and the state of each at that moment is kept
+        stage k      effort runs, started round robin from the states kept at stage k - 1, each on random
+                     streams of its own, until the queue reaches Lk or the arrivals are over
+
+    and the product p1 p2 ... pm is an unbiased estimate of P(total queue reaches L). Every stage only has to
+    estimate a probability that is not small, so the estimate needs orders of magnitude fewer events than
+    plain replications for the same relative error. A run stops right after the event that reaches its level
+    (see Simulator::runUntilQueueLength), and the states are cloned through Simulator::saveState() into
+    snapshot buffers (see checkpoint.h) that are reused from stage to stage.
+
+    One splitting run gives one estimate; the replications of a grid point are independent splitting runs, and
+    the confidence interval is taken across them. */
+
+#define SPLITTING_DEFAULT_EFFORT 1000
+
+struct SplittingPlan {
+    vector<int32_t> levels;          /** increasing total queue lengths, the last one is the target. empty: off */
+    int effort;                      /** runs per stage */
+};
+
+class SplittingEstimator {
+
+    public:
+        /** one estimate of P(total queue length reaches the last level) for the job, run on sim. every run of
+            it draws from a key of its own, derived from the job's master seed and substream */
+        static ReplicationResult run(const ReplicationJob &job, Simulator &sim);
+};
+
+
+inline ReplicationResult SplittingEstimator::run(const ReplicationJob &job, Simulator &sim) {
+
+    const SplittingPlan &plan = *job.splitting;
+    uint64_t key = job.masterSeed ^ (0x9E3779B97F4A7C15ULL * ((uint64_t) job.substream + 1));
+    t_simtime limit = nextafter(job.horizon, HUGE_VAL);   /** arrivals at the horizon still count */
+
+    /** entrances[0 .. entranceCount) are the states that reached the previous level; the buffers of both
+        vectors are swapped back and forth and keep their memory */
+    vector<SimulatorSnapshot> entrances, reached;
+    int entranceCount = 0;
+    double probability = 1;
+    long long events = 0;
+
+    ReplicationJob start = job;
+    start.masterSeed = key;
+    for(size_t k = 0; k < plan.levels.size() && probability > 0; k++) {
+        bool last = k + 1 == plan.levels.size();
+        int hits = 0;
+        for(int j = 0; j < plan.effort; j++) {
+            uint32_t substream = (uint32_t) (k * plan.effort + j);
+            if(k == 0) {
+                start.substream = substream;
+                ReplicationRunner::prepare(start, sim);
+                ReplicationRunner::startArrivals(start, sim);
+            }
+            else {
+                string error;
+                if(!sim.restoreState(entrances[j % entranceCount], 0, error)) {
+                    cerr << error << endl;
+                    exit(1);
+                }
+                sim.reseed(key, substream, job.interArrivalTimeMean, job.serviceTimeMean);
+            }
+            long long before = sim.getEventCount();
+            bool hit = sim.runUntilQueueLength(plan.levels[k], limit);
+            events += sim.getEventCount() - before;
+            if(hit && !last) {
+                if(hits == (int) reached.size())
+                    reached.push_back(SimulatorSnapshot());
+                sim.saveState(reached[hits]);
+            }
+            hits += hit;
+        }
+        probability *= (double) hits / plan.effort;
+        entrances.swap(reached);
+        entranceCount = hits;
+    }
+
+    ReplicationResult r = ReplicationResult();
+    r.events = events;
+    r.tailProbability = probability;
+    return r;
+
+}
@@ -0,0 +1,131 @@
+/** Steady state estimation from one long run. The customers leaving the bank are grouped in consecutive
+    batches of equal size; a batch keeps the sum of the delays of its customers, and the integral of the total
+    queue length over the time it spans. Only STEADY_STATE_BATCHES batches are kept: when they are all full,
+    neighbours are merged pairwise and the batch size doubles, so memory stays constant however long the run is
+    and the batches grow with it.
+
+    At the end the warm-up is cut with MSER (White, 1997): the truncation point d, at most half the batches,
+    minimizes the squared standard error of the mean of the batches after it,
+
+        MSER(d) = sum_{j >= d} (y_j - mean_d)^2 / (n - d)^2
+
+    on batch means of STEADY_STATE_FIRST_BATCH customers (MSER-5) for as long as the run fits in the batches
+    without merging, on the merged batches after that. The mean and the confidence interval then come from the
+    batches left, as non-overlapping batch means. */
+
+#define STEADY_STATE_BATCHES     64
+#define STEADY_STATE_FIRST_BATCH 5
+
+class SteadyStateEstimator {
+
+        double delaySum[STEADY_STATE_BATCHES];
+        double queueIntegral[STEADY_STATE_BATCHES];  /** integral of the total queue length over the batch */
+        double duration[STEADY_STATE_BATCHES];
+        double startTime[STEADY_STATE_BATCHES];
+        int batches;                     /** full batches */
+        long long batchSize;             /** customers per batch */
+
+        double openDelaySum;             /** the batch being filled */
+        long long openCount;
+        double openStartTime;
+        double openStartIntegral;
+
+        /** pairs of neighbours become one batch of twice the size */
+        void merge() {
+            for(int j = 0; j < batches / 2; j++) {
+                delaySum[j] = delaySum[2 * j] + delaySum[2 * j + 1];
+                queueIntegral[j] = queueIntegral[2 * j] + queueIntegral[2 * j + 1];
+                duration[j] = duration[2 * j] + duration[2 * j + 1];
+                startTime[j] = startTime[2 * j];
+            }
+            batches /= 2;
+            batchSize *= 2;
+        }
+
+    public:
+        SteadyStateEstimator() {
+            batches = 0;
+            batchSize = STEADY_STATE_FIRST_BATCH;
+            openDelaySum = 0;
+            openCount = 0;
+            openStartTime = 0;
+            openStartIntegral = 0;
+        }
+
+        /** drops every batch: the batches start over at time now, where the queue length integral is as given */
+        void restart(t_simtime now, double queueIntegralNow) {
+            *this = SteadyStateEstimator();
+            openStartTime = now;
+            openStartIntegral = queueIntegralNow;
+        }
+
+        /** one more delay; true if it completed the batch, which the caller then closes with closeBatch() */
+        inline bool add(t_simtime delay) {
+            openDelaySum += delay;
+            return ++openCount == batchSize;
+        }
+
+        /** closes the full batch at time now, where queueIntegralNow is the integral of the total queue length
+            from the start of the run */
+        void closeBatch(t_simtime now, double queueIntegralNow) {
+            delaySum[batches] = openDelaySum;
+            queueIntegral[batches] = queueIntegralNow - openStartIntegral;
+            duration[batches] = now - openStartTime;
+            startTime[batches] = openStartTime;
+            batches++;
+            openDelaySum = 0;
+            openCount = 0;
+            openStartTime = now;
+            openStartIntegral = queueIntegralNow;
+
+            /** the open batch is empty here, so it simply takes the doubled size */
+            if(batches == STEADY_STATE_BATCHES)
+                merge();
+        }
+
+        /** MSER truncation point: the number of leading batches to delete */
+        int truncation() {
+            if(batches < 2)
+                return 0;
+            /** suffix sums of the batch means and their squares */
+            double sum = 0, sumOfSquares = 0;
+            double values[STEADY_STATE_BATCHES];
+            int best = 0;
+            double bestValue = -1;
+            for(int d = batches - 1; d >= 0; d--) {
+                double y = delaySum[d] / batchSize;
+                sum += y;
+                sumOfSquares += y * y;
+                int n = batches - d;
+                values[d] = (sumOfSquares - sum * sum / n) / ((double) n * n);
+            }
+            for(int d = 0; d <= batches / 2; d++) {
+                if(bestValue < 0 || values[d] < bestValue) {
+                    bestValue = values[d];
+                    best = d;
+                }
+            }
+            return best;
+        }
+
+        /** steady state mean delay and time averaged total queue length after the warm-up, and the half width of
+            the confidence interval of the mean delay from the batch means */
+        void estimate(double confidence, double &meanDelay, double &halfWidth, double &meanQueueLength, double &warmupTime, int &batchesUsed) {
+            int d = truncation();
+            AvgGenerator batchMeans;
+            double integral = 0, time = 0;
+            for(int j = d; j < batches; j++) {
+                batchMeans.pushData(delaySum[j] / batchSize);
+                integral += queueIntegral[j];
+                time += duration[j];
+            }
+            meanDelay = batchMeans.avg();
+            halfWidth = batchMeans.getConfidenceIntervalRange(confidence);
+            meanQueueLength = time > 0 ? integral / time : 0;
+            warmupTime = d < batches ? startTime[d] : 0;
+            batchesUsed = batches - d;
+        }
+
+        inline int getBatchCount()              { return batches; }
+        inline long long getBatchSize()         { return batchSize; }
+};
@@ -0,0 +1,83 @@
+/** Random stream management. Every random number in a run comes from a Philox4x32-10 counter based generator
+    (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3"). The generator is a pure function of a
+    64 bit key and a 128 bit counter, so a stream is just a position in the counter space:
+
+        key         = master seed
+        counter[3]  = substream   (one per replication)
+        counter[2]  = stream id   (arrivals, service of teller 0, 1, ...)
+        counter[1:0]= block index within the stream
+
+    Two different (substream, stream id) pairs can therefore never overlap, the same master seed always gives
+    the same run, and no state is shared between replications running on different threads.
+
+    An antithetic engine hands out the bitwise complement of every word, so its uniforms are 1 - u (+ 2^-53)
+    of the plain engine on the same stream, and an exponential draw that was short becomes a long one. */
+
+#define DEFAULT_MASTER_SEED      20140921ULL
+
+#define ARRIVAL_STREAM           0
+#define SERVICE_STREAM(tellerId) (1 + (tellerId))
+#define CUSTOMER_SERVICE_STREAM  0xFFFFFFFFu    /** service times drawn per customer, see Simulator::setSynchronizedService */
+#define ROUTING_STREAM           0xFFFFFFFEu    /** draws of the randomized routing policies, see kernels.h */
+#define PATIENCE_STREAM          0xFFFFFFFDu    /** patience of the waiting customers, see QueuePolicy */
+#define THINNING_STREAM          0xFFFFFFFCu    /** acceptance draws of time varying arrivals, see ArrivalProfile */
+
+class StreamEngine {
+
+        uint32_t key[2];
+        uint32_t counter[4];
+        uint32_t block[4];               /** output of the last generated block */
+        int used;                        /** words of block[] already handed out */
+        uint32_t flip;                   /** all ones for an antithetic engine */
+
+        static inline void mulhilo(uint32_t a, uint32_t b, uint32_t &hi, uint32_t &lo) {
+            uint64_t p = (uint64_t) a * b;
+            hi = (uint32_t) (p >> 32);
+            lo = (uint32_t) p;
+        }
+
+        void generate() {
+            uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+            uint32_t k0 = key[0], k1 = key[1];
+            for(int round = 0; round < 10; round++) {
+                uint32_t hi0, lo0, hi1, lo1;
+                mulhilo(0xD2511F53u, c0, hi0, lo0);
+                mulhilo(0xCD9E8D57u, c2, hi1, lo1);
+                c0 = hi1 ^ c1 ^ k0;
+                c1 = lo1;
+                c2 = hi0 ^ c3 ^ k1;
+                c3 = lo0;
+                k0 += 0x9E3779B9u;
+                k1 += 0xBB67AE85u;
+            }
+            block[0] = c0; block[1] = c1; block[2] = c2; block[3] = c3;
+            used = 0;
+            if(++counter[0] == 0)
+                ++counter[1];
+        }
+
+    public:
+        StreamEngine(uint64_t masterSeed, uint32_t substream, uint32_t streamId, bool antithetic = false) {
+            key[0] = (uint32_t) masterSeed;
+            key[1] = (uint32_t) (masterSeed >> 32);
+            counter[0] = 0;
+            counter[1] = 0;
+            counter[2] = streamId;
+            counter[3] = substream;
+            used = 4;
+            flip = antithetic ? 0xFFFFFFFFu : 0;
+        }
+
+        inline uint32_t next32() {
+            if(used == 4)
+                generate();
+            return block[used++] ^ flip;
+        }
+
+        /** uniform on (0, 1], 53 bits. Zero is excluded so that log() of it is always finite. */
+        inline double nextUniform() {
+            uint64_t hi = next32();
+            uint64_t lo = next32();
+            return (double) ((((hi << 32) | lo) >> 11) + 1) * (1.0 / 9007199254740992.0);
+        }
+};
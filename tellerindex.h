@@ -0,0 +1,116 @@
+/** Indexed teller state for large teller pools. The linear scans in Simulator are the fastest thing there is
+    for a handful of tellers, and vectorized (simdscan.h) they stay ahead up to a few hundred, but they make every
+    arrival and departure O(N). From TELLER_INDEX_MIN_TELLERS tellers on the simulator keeps this index up to
+    date instead and asks it:
+
+        free teller       two level bitset of idle tellers (idle and nothing queued), find first set
+        shortest queue    segment tree of queue lengths, leftmost minimum, O(log N)
+        jockey source     segment tree of queue length + busy, nearest teller on either side whose total
+                          exceeds a threshold, O(log N). on equal distance the left one wins, as in the scan.
+
+    Every answer is the same teller the corresponding scan would pick. */
+
+#define TELLER_INDEX_MIN_TELLERS 512
+
+class TellerIndex {
+
+        int N;
+        int leaves;                      /** N rounded up to a power of two */
+        vector<int> minQueue;            /** segment tree, node 1 is the root and leaf i is leaves + i */
+        vector<int> maxTotal;
+        vector<uint64_t> idle;           /** bit i set: teller i is idle with an empty queue */
+        vector<uint64_t> idleSummary;    /** bit w set: idle[w] is not zero */
+
+        int firstAbove(int node, int lo, int hi, int from, int threshold) {
+            if(hi < from || maxTotal[node] <= threshold)
+                return -1;
+            if(lo == hi)
+                return lo;
+            int mid = (lo + hi) / 2;
+            int found = firstAbove(2 * node, lo, mid, from, threshold);
+            return found != -1 ? found : firstAbove(2 * node + 1, mid + 1, hi, from, threshold);
+        }
+
+        int lastAbove(int node, int lo, int hi, int to, int threshold) {
+            if(lo > to || maxTotal[node] <= threshold)
+                return -1;
+            if(lo == hi)
+                return lo;
+            int mid = (lo + hi) / 2;
+            int found = lastAbove(2 * node + 1, mid + 1, hi, to, threshold);
+            return found != -1 ? found : lastAbove(2 * node, lo, mid, to, threshold);
+        }
+
+    public:
+        TellerIndex(int N) {
+            this->N = N;
+            leaves = 1;
+            while(leaves < N)
+                leaves *= 2;
+            minQueue.assign(2 * leaves, INT_MAX);
+            maxTotal.assign(2 * leaves, INT_MIN);
+            idle.assign((N + 63) / 64, 0);
+            idleSummary.assign((idle.size() + 63) / 64, 0);
+            for(int i = 0; i < N; i++)
+                update(i, 0, false);
+        }
+
+        /** bytes an index of N tellers takes */
+        static size_t memory(int N) {
+            size_t leaves = 1;
+            while(leaves < (size_t) N)
+                leaves *= 2;
+            size_t words = (N + 63) / 64;
+            return sizeof(TellerIndex) + 2 * leaves * 2 * sizeof(int) + (words + (words + 63) / 64) * sizeof(uint64_t);
+        }
+
+        /** to be called whenever the queue length or the busy flag of a teller changes */
+        void update(int tellerId, int queueLength, bool busy) {
+            int node = leaves + tellerId;
+            minQueue[node] = queueLength;
+            maxTotal[node] = queueLength + (busy ? 1 : 0);
+            for(node /= 2; node >= 1; node /= 2) {
+                minQueue[node] = min(minQueue[2 * node], minQueue[2 * node + 1]);
+                maxTotal[node] = max(maxTotal[2 * node], maxTotal[2 * node + 1]);
+            }
+
+            int word = tellerId / 64;
+            uint64_t bit = 1ULL << (tellerId % 64);
+            if(!busy && queueLength == 0)
+                idle[word] |= bit;
+            else
+                idle[word] &= ~bit;
+            if(idle[word])
+                idleSummary[word / 64] |= 1ULL << (word % 64);
+            else
+                idleSummary[word / 64] &= ~(1ULL << (word % 64));
+        }
+
+        int getFreeTellerId() {
+            for(size_t s = 0; s < idleSummary.size(); s++) {
+                if(idleSummary[s]) {
+                    size_t word = s * 64 + __builtin_ctzll(idleSummary[s]);
+                    return (int) (word * 64 + __builtin_ctzll(idle[word]));
+                }
+            }
+            return -1;
+        }
+
+        int getShortestQuedTellerId() {
+            int node = 1;
+            while(node < leaves)
+                node = minQueue[2 * node] <= minQueue[2 * node + 1] ? 2 * node : 2 * node + 1;
+            return node - leaves;
+        }
+
+        /** nearest teller other than tellerId whose queue + service exceeds threshold, -1 if none */
+        int getNearestAbove(int tellerId, int threshold) {
+            int left = tellerId > 0 ? lastAbove(1, 0, leaves - 1, tellerId - 1, threshold) : -1;
+            int right = tellerId < N - 1 ? firstAbove(1, 0, leaves - 1, tellerId + 1, threshold) : -1;
+            if(left == -1)
+                return right;
+            if(right == -1)
+                return left;
+            return tellerId - left <= right - tellerId ? left : right;
+        }
+};
@@ -0,0 +1,273 @@
+/** Binary event trace. With a trace attached (Simulator::setTrace) every arrival, queue join, service start,
+    departure, jockey, balk, renege and transfer of a run is written as one fixed size TraceRecord, so a trace of millions of events can
+    be analyzed in place instead of being parsed back out of text. The file is a TraceHeader followed by the
+    records, in the byte order of the machine that wrote it.
+
+    TraceWriter fills a batch of records on the simulating thread and hands full batches to a background thread
+    that writes them out; the simulator only waits when all TRACE_BATCHES batches are still being written.
+    TraceReader maps a trace file into memory and gives out the records as a plain array, and writeTraceText()
+    turns records back into the text log format of log.txt (see tracetool.cpp). */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define TRACE_MAGIC              "BANKTRC1"
+#define TRACE_VERSION            1
+#define TRACE_BATCH_RECORDS      8192
+#define TRACE_BATCHES            4
+
+enum TraceKind {
+    TRACE_ARRIVAL,                   /** customer entered the bank */
+    TRACE_JOIN_QUEUE,                /** customer joined the queue of toTeller, -1 the shared queue */
+    TRACE_SERVICE_START,             /** customer went into service at toTeller */
+    TRACE_DEPARTURE,                 /** customer left the bank from fromTeller */
+    TRACE_JOCKEY,                    /** customer moved from the tail of fromTeller's queue to toTeller */
+    TRACE_BALK,                      /** customer left on arrival instead of joining the queue of toTeller */
+    TRACE_RENEGE,                    /** customer gave up waiting in the queue of fromTeller */
+    TRACE_TRANSFER                   /** customer left on arrival for branch toTeller of the network */
+};
+
+struct TraceRecord {
+    t_simtime time;
+    int32_t customerId;              /** the sequential id of the customer, 1, 2, 3, ... within the run */
+    int32_t kind;                    /** a TraceKind */
+    int32_t fromTeller;              /** -1 where the kind has no such teller */
+    int32_t toTeller;
+};
+
+struct TraceHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize;             /** sizeof(TraceRecord) of the writer */
+};
+
+
+class TraceWriter {
+
+        FILE *file;
+        TraceRecord *current;            /** batch being filled by the simulator */
+        size_t used;
+
+        vector<TraceRecord *> batches;   /** all TRACE_BATCHES buffers, for freeing */
+        deque<pair<TraceRecord *, size_t> > full;   /** waiting for the writer thread, oldest first */
+        vector<TraceRecord *> empty;     /** written out, free to fill again */
+        bool closing;
+        bool failed;                     /** a write came short, the trace is incomplete */
+        mutex lock;
+        condition_variable changed;
+        thread writer;
+
+        void writeBatches() {
+            unique_lock<mutex> guard(lock);
+            while(true) {
+                while(full.empty() && !closing)
+                    changed.wait(guard);
+                if(full.empty())
+                    return;
+                pair<TraceRecord *, size_t> batch = full.front();
+                full.pop_front();
+                guard.unlock();
+                bool written = fwrite(batch.first, sizeof(TraceRecord), batch.second, file) == batch.second;
+                guard.lock();
+                failed = failed || !written;
+                empty.push_back(batch.first);
+                changed.notify_all();
+            }
+        }
+
+        /** queues the current batch and takes an empty one, waiting for the writer if there is none */
+        void submit() {
+            unique_lock<mutex> guard(lock);
+            full.push_back(make_pair(current, used));
+            changed.notify_all();
+            while(empty.empty())
+                changed.wait(guard);
+            current = empty.back();
+            empty.pop_back();
+            used = 0;
+        }
+
+    public:
+        TraceWriter() {
+            file = NULL;
+            current = NULL;
+            used = 0;
+            closing = false;
+            failed = false;
+        }
+
+        ~TraceWriter() {
+            close();
+        }
+
+        bool open(const string &path, string &error) {
+            file = fopen(path.c_str(), "wb");
+            if(!file) {
+                error = "cannot open trace file " + path;
+                return false;
+            }
+            TraceHeader header;
+            memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+            header.version = TRACE_VERSION;
+            header.recordSize = sizeof(TraceRecord);
+            if(fwrite(&header, sizeof(header), 1, file) != 1) {
+                fclose(file);
+                file = NULL;
+                error = "cannot write trace file " + path;
+                return false;
+            }
+
+            for(int i = 0; i < TRACE_BATCHES; i++)
+                batches.push_back(new TraceRecord[TRACE_BATCH_RECORDS]);
+            empty.assign(batches.begin() + 1, batches.end());
+            current = batches[0];
+            used = 0;
+            closing = false;
+            failed = false;
+            writer = thread(&TraceWriter::writeBatches, this);
+            return true;
+        }
+
+        inline bool isOpen()            { return file != NULL; }
+
+        inline void append(t_simtime time, int customerId, TraceKind kind, int fromTeller, int toTeller) {
+            TraceRecord &r = current[used++];
+            r.time = time;
+            r.customerId = customerId;
+            r.kind = kind;
+            r.fromTeller = fromTeller;
+            r.toTeller = toTeller;
+            if(used == TRACE_BATCH_RECORDS)
+                submit();
+        }
+
+        /** writes out what is left and closes the file. false if any part of the trace could not be written */
+        bool close() {
+            if(!file)
+                return true;
+            {
+                lock_guard<mutex> guard(lock);
+                if(used > 0)
+                    full.push_back(make_pair(current, used));
+                used = 0;
+                closing = true;
+                changed.notify_all();
+            }
+            writer.join();
+            bool ok = !failed && fclose(file) == 0;
+            file = NULL;
+            for(size_t i = 0; i < batches.size(); i++)
+                delete [] batches[i];
+            batches.clear();
+            empty.clear();
+            current = NULL;
+            return ok;
+        }
+
+    private:
+        TraceWriter(const TraceWriter &);
+        TraceWriter &operator = (const TraceWriter &);
+};
+
+
+/** read only view of a trace file, mapped into memory. the records are used where they lie in the mapping */
+class TraceReader {
+
+        void *mapping;
+        size_t mappingSize;
+        const TraceRecord *records;
+        size_t count;
+
+    public:
+        TraceReader() {
+            mapping = NULL;
+            mappingSize = 0;
+            records = NULL;
+            count = 0;
+        }
+
+        ~TraceReader() {
+            close();
+        }
+
+        bool open(const char *path, string &error) {
+            close();
+            int fd = ::open(path, O_RDONLY);
+            if(fd < 0) {
+                error = string("cannot open trace file ") + path;
+                return false;
+            }
+            struct stat info;
+            if(fstat(fd, &info) != 0 || (size_t) info.st_size < sizeof(TraceHeader)) {
+                ::close(fd);
+                error = string(path) + " is not a trace file";
+                return false;
+            }
+            mappingSize = info.st_size;
+            mapping = mmap(NULL, mappingSize, PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            if(mapping == MAP_FAILED) {
+                mapping = NULL;
+                error = string("cannot map trace file ") + path;
+                return false;
+            }
+
+            const TraceHeader *header = (const TraceHeader *) mapping;
+            if(memcmp(header->magic, TRACE_MAGIC, sizeof(header->magic)) != 0 || header->version != TRACE_VERSION ||
+               header->recordSize != sizeof(TraceRecord)) {
+                close();
+                error = string(path) + " is not a trace file of this version";
+                return false;
+            }
+            madvise(mapping, mappingSize, MADV_SEQUENTIAL);
+            records = (const TraceRecord *) ((const char *) mapping + sizeof(TraceHeader));
+            count = (mappingSize - sizeof(TraceHeader)) / sizeof(TraceRecord);
+            return true;
+        }
+
+        void close() {
+            if(mapping)
+                munmap(mapping, mappingSize);
+            mapping = NULL;
+            mappingSize = 0;
+            records = NULL;
+            count = 0;
+        }
+
+        inline size_t size()                                    { return count; }
+        inline const TraceRecord *begin()                       { return records; }
+        inline const TraceRecord *end()                         { return records + count; }
+        inline const TraceRecord &operator[](size_t i)          { return records[i]; }
+
+    private:
+        TraceReader(const TraceReader &);
+        TraceReader &operator = (const TraceReader &);
+};
+
+
+/** the records as lines of the text log ("customer 4 joined service 1 at 1.96825"), after its header. as in
+    log.txt a jockey is the customer joining its new queue again ("joined Q"), so a customer has a "joined Q"
+    line per queue it waited in; with jockeyLines it is a "jockeyed from Q x to Q y" line instead, which log.txt
+    does not have. balks, reneges and transfers have no form in log.txt either */
+inline void writeTraceText(const TraceRecord *first, const TraceRecord *last, FILE *out, bool jockeyLines = false) {
+    fprintf(out, "Simulator started.\n\n");
+    for(const TraceRecord *r = first; r != last; r++) {
+        switch(r->kind) {
+            case TRACE_ARRIVAL:       fprintf(out, "customer %d arrived at %g\n", r->customerId, r->time);                      break;
+            case TRACE_JOIN_QUEUE:    fprintf(out, "customer %d joined Q %d at %g\n", r->customerId, r->toTeller, r->time);       break;
+            case TRACE_SERVICE_START: fprintf(out, "customer %d joined service %d at %g\n", r->customerId, r->toTeller, r->time); break;
+            case TRACE_DEPARTURE:     fprintf(out, "customer %d left queue %d at %g\n", r->customerId, r->fromTeller, r->time);   break;
+            case TRACE_JOCKEY:
+                if(jockeyLines)
+                    fprintf(out, "customer %d jockeyed from Q %d to Q %d at %g\n", r->customerId, r->fromTeller, r->toTeller, r->time);
+                else
+                    fprintf(out, "customer %d joined Q %d at %g\n", r->customerId, r->toTeller, r->time);
+                break;
+            case TRACE_BALK:          fprintf(out, "customer %d balked at Q %d at %g\n", r->customerId, r->toTeller, r->time);         break;
+            case TRACE_RENEGE:        fprintf(out, "customer %d reneged from Q %d at %g\n", r->customerId, r->fromTeller, r->time);    break;
+            case TRACE_TRANSFER:      fprintf(out, "customer %d went on to branch %d at %g\n", r->customerId, r->toTeller, r->time);   break;
+        }
+    }
+}
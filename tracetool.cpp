@@ -0,0 +1,81 @@
+/** Reads a binary event trace (see trace.h) written by ./simulator --trace file, and makes replay files (see
+    replay.h) for ./simulator --replay file.
+
+    build:  g++ -std=c++11 -O2 -pthread -o tracetool tracetool.cpp
+    run:    ./tracetool trace                          the trace as the text log, like log.txt, on stdout
+            ./tracetool --jockey-lines trace           the same, jockeys as "jockeyed from Q x to Q y" lines
+                                                       instead of the second "joined Q" line of log.txt
+            ./tracetool --summary trace                record counts per kind and the time span
+            ./tracetool --arrivals trace               "arrival, service" of every customer of the trace that left
+            ./tracetool --make-replay text replay      replay file from "arrival, service" lines */
+
+#define SIMULATOR_NO_MAIN
+#include "simulator.cpp"
+
+
+int main(int argc, char **argv) {
+
+    string mode = argc > 2 ? argv[1] : "";
+    if(!(argc == 2 || (argc == 3 && (mode == "--summary" || mode == "--arrivals" || mode == "--jockey-lines")) ||
+         (argc == 4 && mode == "--make-replay"))) {
+        cerr << "usage: " << argv[0] << " [--summary | --arrivals | --jockey-lines] trace" << endl
+             << "       " << argv[0] << " --make-replay text replay" << endl;
+        return 1;
+    }
+
+    string error;
+    if(mode == "--make-replay") {
+        if(!writeReplayColumns(argv[2], argv[3], error)) {
+            cerr << error << endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    TraceReader reader;
+    if(!reader.open(argv[argc - 1], error)) {
+        cerr << error << endl;
+        return 1;
+    }
+
+    if(argc == 2 || mode == "--jockey-lines") {
+        writeTraceText(reader.begin(), reader.end(), stdout, mode == "--jockey-lines");
+        return 0;
+    }
+
+    /** customer ids run 1, 2, 3, ... in arrival order, so they index the arrival and service start times */
+    if(mode == "--arrivals") {
+        vector<t_simtime> arrivals, starts, services;
+        for(const TraceRecord *r = reader.begin(); r != reader.end(); r++) {
+            size_t i = r->customerId - 1;
+            if(r->kind == TRACE_ARRIVAL) {
+                arrivals.resize(i + 1, INVALID_TIME);
+                starts.resize(i + 1, INVALID_TIME);
+                services.resize(i + 1, INVALID_TIME);
+                arrivals[i] = r->time;
+            }
+            else if(r->kind == TRACE_SERVICE_START)
+                starts[i] = r->time;
+            else if(r->kind == TRACE_DEPARTURE)
+                services[i] = r->time - starts[i];
+        }
+        for(size_t i = 0; i < arrivals.size(); i++)
+            if(services[i] != INVALID_TIME)
+                printf("%.17g, %.17g\n", arrivals[i], services[i]);
+        return 0;
+    }
+
+    const char *names[] = { "arrivals", "queue joins", "service starts", "departures", "jockeys", "balks", "reneges", "transfers" };
+    long long counts[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+    for(const TraceRecord *r = reader.begin(); r != reader.end(); r++)
+        if(r->kind >= TRACE_ARRIVAL && r->kind <= TRACE_TRANSFER)
+            counts[r->kind]++;
+
+    printf("records:\t%zu\n", reader.size());
+    for(int k = 0; k < 8; k++)
+        printf("%s:\t%lld\n", names[k], counts[k]);
+    if(reader.size() > 0)
+        printf("time span:\t%g to %g\n", reader[0].time, reader[reader.size() - 1].time);
+    return 0;
+
+}